@@ -0,0 +1,42 @@
+/*
+ * Copyright 2023-2023 yanruibinghxu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __KX_BENCH_H__
+#define __KX_BENCH_H__
+
+#include <string.h>
+#include <time.h>
+#include "kx_config.h"
+#include "kx_member.h"
+
+/* Monotonic time in nanoseconds. */
+static inline uint64_t bench_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* Initializes a member with a distinct IPv4 address for every index. */
+static inline int bench_member_init(cluster_member_t *member, uint32_t idx) {
+    cluster_sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = CLUSTER_HTONL(0x0a000000 | (idx >> 4));
+    addr.sin_port = CLUSTER_HTONS(10000 + (idx & 0x0f));
+    return cluster_member_init(member, (const cluster_sockaddr_storage *) &addr,
+                               sizeof(addr), "bench", 5);
+}
+
+#endif
@@ -0,0 +1,246 @@
+/*
+ * Copyright 2023-2023 yanruibinghxu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <poll.h>
+#include "kx_bench.h"
+#include "kx_errors.h"
+#include "kx_gossip.h"
+#include "kx_log.h"
+#include "kx_messages.h"
+#include "kx_utils.h"
+
+/* Messages sent and acknowledged per round, so the queue
+ * depth stays the same while acks are measured. The time
+ * includes receiving the acks from the socket. */
+#define BENCH_ROUND_SIZE    32
+#define BENCH_ROUNDS        256
+#define BENCH_JOIN_TIMEOUT  5000
+#define BENCH_SENDER_PORT   18101
+#define BENCH_PEER_PORT     18102
+
+static const uint32_t bench_depths[] = {64, 1024, 16384};
+
+static void bench_data_receiver(void *context, cluster_gossip_t *gossip,
+                                const uint8_t *data, size_t data_size) {
+}
+
+static cluster_gossip_t *bench_node_create(uint16_t port, const char *uname, uint32_t max_output_messages) {
+    cluster_sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = CLUSTER_HTONL(INADDR_LOOPBACK);
+    addr.sin_port = CLUSTER_HTONS(port);
+    cluster_addr_t self_addr = {(const cluster_sockaddr *) &addr, sizeof(addr)};
+
+    cluster_gossip_config_t config;
+    cluster_gossip_config_init(&config);
+    // Sent messages wait for their acks instead of being retried.
+    config.retry_interval = 3600 * 1000;
+    config.message_max_size = 1024;
+    config.max_output_messages = max_output_messages;
+    config.plumtree = 0;
+    config.sync_interval = 0;
+    return cluster_gossip_create_ex(&self_addr, bench_data_receiver, NULL, uname, &config);
+}
+
+/* Runs both nodes until they see each other. */
+static int bench_join(cluster_gossip_t *sender, cluster_gossip_t *peer) {
+    cluster_sockaddr_in seed;
+    memset(&seed, 0, sizeof(seed));
+    seed.sin_family = AF_INET;
+    seed.sin_addr.s_addr = CLUSTER_HTONL(INADDR_LOOPBACK);
+    seed.sin_port = CLUSTER_HTONS(BENCH_SENDER_PORT);
+    cluster_addr_t seed_addr = {(const cluster_sockaddr *) &seed, sizeof(seed)};
+
+    int result = cluster_gossip_join(sender, NULL, 0);
+    if (result < 0) return result;
+    result = cluster_gossip_join(peer, &seed_addr, 1);
+    if (result < 0) return result;
+
+    cluster_gossip_t *nodes[] = {sender, peer};
+    uint64_t start = cluster_time();
+    while (cluster_time() - start < BENCH_JOIN_TIMEOUT) {
+        for (int i = 0; i < 2; ++i) {
+            cluster_gossip_process_receive_batch(nodes[i], 64);
+            cluster_gossip_tick(nodes[i]);
+            cluster_gossip_process_send(nodes[i]);
+        }
+        if (cluster_gossip_state(sender) == STATE_CONNECTED &&
+            cluster_gossip_state(peer) == STATE_CONNECTED &&
+            cluster_gossip_member_list(sender)->size == 1 &&
+            cluster_gossip_member_list(peer)->size == 1) {
+            // Leave only the benchmarked messages in the sender's socket.
+            struct pollfd fds = {cluster_gossip_socket_fd(sender), POLLIN, 0};
+            while (poll(&fds, 1, 100) > 0) {
+                result = cluster_gossip_process_receive_batch(sender, 64);
+                if (result < 0) return result;
+            }
+            result = cluster_gossip_process_send(sender);
+            return result < 0 ? result : CLUSTER_ERR_NONE;
+        }
+        poll(NULL, 0, 10);
+    }
+    return CLUSTER_ERR_BAD_STATE;
+}
+
+static uint64_t bench_queue_depth(cluster_gossip_t *self) {
+    cluster_gossip_stats_t stats;
+    cluster_gossip_stats(self, &stats);
+    return stats.envelope_allocs - stats.envelope_frees;
+}
+
+/* Sequence numbers of the Data messages which wait for acks. */
+typedef struct bench_pending {
+    uint32_t *seqs;
+    uint32_t size;
+    cluster_rng_t rng;
+} bench_pending_t;
+
+/* Reads the next Data message which arrived at the peer's socket
+ * and remembers its sequence number. */
+static int bench_receive_data(cluster_gossip_t *peer, bench_pending_t *pending) {
+    uint8_t buffer[2048];
+    while (1) {
+        struct pollfd fds = {cluster_gossip_socket_fd(peer), POLLIN, 0};
+        if (poll(&fds, 1, 1000) <= 0) return CLUSTER_ERR_READ_FAILED;
+        ssize_t buffer_size = recv(fds.fd, buffer, sizeof(buffer), 0);
+        if (buffer_size < 0) return CLUSTER_ERR_READ_FAILED;
+        if (message_type_decode(buffer, buffer_size) != MESSAGE_DATA_TYPE) continue;
+
+        int flags = message_flags_decode(buffer, buffer_size);
+        if (flags < 0) return flags;
+        if (flags & MESSAGE_FLAG_PIGGYBACK) {
+            const uint8_t *members = NULL;
+            size_t members_size = 0;
+            uint8_t members_n = 0;
+            int payload_size = message_piggyback_decode(buffer, buffer_size, &members,
+                                                        &members_size, &members_n);
+            if (payload_size < 0) return payload_size;
+            buffer_size = payload_size;
+        }
+        message_data_t msg;
+        int result = message_data_decode(buffer, buffer_size, &msg);
+        if (result < 0) return result;
+        pending->seqs[pending->size++] = msg.header.sequence_num;
+        return CLUSTER_ERR_NONE;
+    }
+}
+
+/* Sends new Data messages and collects them from the peer's socket
+ * one by one, so that the peer node itself never sees them. */
+static int bench_send(cluster_gossip_t *sender, cluster_gossip_t *peer,
+                      bench_pending_t *pending, uint32_t messages_num) {
+    uint8_t data[16] = {0};
+    for (uint32_t i = 0; i < messages_num; ++i) {
+        int result = cluster_gossip_send_data(sender, data, sizeof(data));
+        if (result < 0) return result;
+        result = cluster_gossip_process_send(sender);
+        if (result < 0) return result;
+        result = bench_receive_data(peer, pending);
+        if (result < 0) return result;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+/* Acks random pending messages on behalf of the peer. */
+static int bench_ack(cluster_gossip_t *peer, bench_pending_t *pending, uint32_t acks_num) {
+    cluster_sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = CLUSTER_HTONL(INADDR_LOOPBACK);
+    addr.sin_port = CLUSTER_HTONS(BENCH_SENDER_PORT);
+
+    for (uint32_t i = 0; i < acks_num; ++i) {
+        uint32_t idx = cluster_rng_uniform(&pending->rng, pending->size);
+        message_ack_t msg;
+        message_header_init(&msg.header, MESSAGE_ACK_TYPE, 0);
+        msg.ack_sequence_num = pending->seqs[idx];
+        pending->seqs[idx] = pending->seqs[--pending->size];
+
+        uint8_t buffer[64];
+        int buffer_size = message_ack_encode(&msg, buffer, sizeof(buffer));
+        if (buffer_size < 0) return buffer_size;
+        if (sendto(cluster_gossip_socket_fd(peer), buffer, buffer_size, 0,
+                   (const cluster_sockaddr *) &addr, sizeof(addr)) < 0) {
+            return CLUSTER_ERR_WRITE_FAILED;
+        }
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+/* Returns the average time the sender spends on a single ack in
+ * nanoseconds, while the queue stays at the given depth. */
+static double bench_acks(cluster_gossip_t *sender, cluster_gossip_t *peer,
+                         bench_pending_t *pending, uint32_t depth) {
+    uint64_t base_depth = bench_queue_depth(sender) - pending->size;
+    if (pending->size < depth &&
+        bench_send(sender, peer, pending, depth - pending->size) < 0) {
+        return -1.0;
+    }
+
+    uint64_t elapsed = 0;
+    for (uint32_t i = 0; i < BENCH_ROUNDS; ++i) {
+        if (bench_send(sender, peer, pending, BENCH_ROUND_SIZE) < 0) return -1.0;
+        if (bench_ack(peer, pending, BENCH_ROUND_SIZE) < 0) return -1.0;
+
+        struct pollfd fds = {cluster_gossip_socket_fd(sender), POLLIN, 0};
+        if (poll(&fds, 1, 1000) <= 0) return -1.0;
+
+        uint64_t start = bench_time_ns();
+        if (cluster_gossip_process_receive_batch(sender, BENCH_ROUND_SIZE) < 0) return -1.0;
+        elapsed += bench_time_ns() - start;
+
+        // Every ack has to remove its message from the queue.
+        if (bench_queue_depth(sender) != base_depth + depth) return -1.0;
+    }
+    return (double) elapsed / (BENCH_ROUNDS * BENCH_ROUND_SIZE);
+}
+
+int main(void) {
+    log_set_level(LOG_ERROR);
+    uint32_t max_depth = bench_depths[sizeof(bench_depths) / sizeof(bench_depths[0]) - 1];
+    cluster_gossip_t *sender = bench_node_create(BENCH_SENDER_PORT, "sender", max_depth + BENCH_ROUND_SIZE);
+    cluster_gossip_t *peer = bench_node_create(BENCH_PEER_PORT, "peer", max_depth + BENCH_ROUND_SIZE);
+    if (sender == NULL || peer == NULL) {
+        fprintf(stderr, "Failed to create the nodes\n");
+        return 1;
+    }
+    if (bench_join(sender, peer) < 0) {
+        fprintf(stderr, "The nodes failed to join each other\n");
+        return 1;
+    }
+
+    bench_pending_t pending;
+    pending.seqs = (uint32_t *) malloc((max_depth + BENCH_ROUND_SIZE) * sizeof(uint32_t));
+    if (pending.seqs == NULL) return 1;
+    pending.size = 0;
+    cluster_rng_seed(&pending.rng, 1);
+
+    printf("%12s %12s\n", "queue depth", "ns/ack");
+    for (size_t i = 0; i < sizeof(bench_depths) / sizeof(bench_depths[0]); ++i) {
+        double ack_ns = bench_acks(sender, peer, &pending, bench_depths[i]);
+        if (ack_ns < 0) {
+            fprintf(stderr, "Acks weren't processed at queue depth %u\n", bench_depths[i]);
+            return 1;
+        }
+        printf("%12u %12.1f\n", bench_depths[i], ack_ns);
+    }
+
+    free(pending.seqs);
+    cluster_gossip_destroy(sender);
+    cluster_gossip_destroy(peer);
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2023-2023 yanruibinghxu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include "kx_bench.h"
+#include "kx_errors.h"
+#include "kx_utils.h"
+
+#define BENCH_MEMBERS_NUM   10000
+/* The index is verified after this many removals. */
+#define BENCH_CHECK_PERIOD  500
+
+static cluster_member_t bench_members[BENCH_MEMBERS_NUM];
+static cluster_bool_t bench_present[BENCH_MEMBERS_NUM];
+static uint32_t bench_order[BENCH_MEMBERS_NUM];
+
+/* Verifies that every present member is found by its address and
+ * that none of the removed ones is. */
+static int bench_check(cluster_member_set_t *set) {
+    uint32_t present_num = 0;
+    for (uint32_t i = 0; i < BENCH_MEMBERS_NUM; ++i) {
+        cluster_member_t *found = cluster_member_set_find(set, &bench_members[i].address);
+        if (!bench_present[i]) {
+            if (found != NULL) return CLUSTER_ERR_BAD_STATE;
+            continue;
+        }
+        if (found == NULL || !cluster_member_addr_equals(&found->address, &bench_members[i].address)) {
+            return CLUSTER_ERR_BAD_STATE;
+        }
+        ++present_num;
+    }
+    return present_num == set->size ? CLUSTER_ERR_NONE : CLUSTER_ERR_BAD_STATE;
+}
+
+static void bench_shuffle(cluster_rng_t *rng) {
+    for (uint32_t i = BENCH_MEMBERS_NUM - 1; i > 0; --i) {
+        uint32_t j = cluster_rng_uniform(rng, i + 1);
+        uint32_t tmp = bench_order[i];
+        bench_order[i] = bench_order[j];
+        bench_order[j] = tmp;
+    }
+}
+
+/* Returns the average time of a single put in nanoseconds. */
+static double bench_put(cluster_member_set_t *set, uint32_t members_num) {
+    uint64_t start = bench_time_ns();
+    for (uint32_t i = 0; i < members_num; ++i) {
+        uint32_t idx = bench_order[i];
+        if (cluster_member_set_put(set, &bench_members[idx], 1) < 0) return -1.0;
+        bench_present[idx] = CLUSTER_TRUE;
+    }
+    uint64_t elapsed = bench_time_ns() - start;
+    if (bench_check(set) < 0) return -1.0;
+    return (double) elapsed / members_num;
+}
+
+/* Removes members in the shuffled order. Every removal moves the last
+ * member of the set into the freed position and shifts back the index
+ * entries which follow the deleted one. */
+static double bench_remove(cluster_member_set_t *set, uint32_t members_num) {
+    uint64_t elapsed = 0;
+    uint32_t i = 0;
+    while (i < members_num) {
+        uint32_t period_end = i + BENCH_CHECK_PERIOD < members_num ? i + BENCH_CHECK_PERIOD : members_num;
+        uint64_t start = bench_time_ns();
+        for (; i < period_end; ++i) {
+            uint32_t idx = bench_order[i];
+            cluster_member_t *member = cluster_member_set_find(set, &bench_members[idx].address);
+            if (member == NULL || !cluster_member_set_remove(set, member)) return -1.0;
+            bench_present[idx] = CLUSTER_FALSE;
+        }
+        elapsed += bench_time_ns() - start;
+        if (bench_check(set) < 0) return -1.0;
+    }
+    return (double) elapsed / members_num;
+}
+
+/* Returns the average time of a single lookup in nanoseconds. */
+static double bench_find(cluster_member_set_t *set) {
+    uint32_t found_num = 0;
+    uint64_t start = bench_time_ns();
+    for (uint32_t i = 0; i < BENCH_MEMBERS_NUM; ++i) {
+        if (cluster_member_set_find(set, &bench_members[bench_order[i]].address) != NULL) ++found_num;
+    }
+    uint64_t elapsed = bench_time_ns() - start;
+    if (found_num != set->size) return -1.0;
+    return (double) elapsed / BENCH_MEMBERS_NUM;
+}
+
+static int bench_report(const char *operation, uint32_t members_num, double ns) {
+    if (ns < 0) {
+        fprintf(stderr, "The member set is inconsistent after: %s\n", operation);
+        return CLUSTER_ERR_BAD_STATE;
+    }
+    printf("%-24s %8u %10.1f\n", operation, members_num, ns);
+    return CLUSTER_ERR_NONE;
+}
+
+int main(void) {
+    for (uint32_t i = 0; i < BENCH_MEMBERS_NUM; ++i) {
+        if (bench_member_init(&bench_members[i], i) < 0) return 1;
+        bench_present[i] = CLUSTER_FALSE;
+        bench_order[i] = i;
+    }
+    cluster_rng_t rng;
+    cluster_rng_seed(&rng, 1);
+
+    cluster_member_set_t set;
+    if (cluster_member_set_init(&set) < 0) return 1;
+
+    uint32_t half = BENCH_MEMBERS_NUM / 2;
+    printf("%-24s %8s %10s\n", "operation", "members", "ns/op");
+    bench_shuffle(&rng);
+    if (bench_report("put", BENCH_MEMBERS_NUM, bench_put(&set, BENCH_MEMBERS_NUM)) < 0) return 1;
+    bench_shuffle(&rng);
+    if (bench_report("find", BENCH_MEMBERS_NUM, bench_find(&set)) < 0) return 1;
+    bench_shuffle(&rng);
+    if (bench_report("remove", half, bench_remove(&set, half)) < 0) return 1;
+    // Put the removed half back into the fragmented index.
+    if (bench_report("put after remove", half, bench_put(&set, half)) < 0) return 1;
+    bench_shuffle(&rng);
+    if (bench_report("remove all", BENCH_MEMBERS_NUM, bench_remove(&set, BENCH_MEMBERS_NUM)) < 0) return 1;
+
+    cluster_member_set_destroy(&set);
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2023-2023 yanruibinghxu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include "kx_bench.h"
+#include "kx_errors.h"
+#include "kx_vectorclock.h"
+
+/* The number of compared records per measurement, split
+ * into as many comparisons as the clock size allows. */
+#define BENCH_RECORDS (64 * 1024 * 1024)
+
+#if VECTOR_CLOCK_SIMD
+#define BENCH_KERNEL "simd"
+#else
+#define BENCH_KERNEL "scalar"
+#endif
+
+static const uint32_t bench_sizes[] = {20, 256, 4096};
+
+/* Fills both clocks with the same members, so that only sequence numbers differ. */
+static int bench_clocks_init(vector_clock_t *first, vector_clock_t *second, uint32_t size) {
+    for (uint32_t i = 0; i < size; ++i) {
+        cluster_member_t member;
+        int result = bench_member_init(&member, i);
+        if (result < 0) return result;
+        result = vector_clock_set(first, &member, i + 1, NULL);
+        if (result < 0) return result;
+        result = vector_clock_set(second, &member, i + 1, NULL);
+        if (result < 0) return result;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+/* Returns the average time of a single comparison in nanoseconds,
+ * or a negative value if any comparison has an unexpected outcome. */
+static double bench_compare(vector_clock_t *first, const vector_clock_t *second,
+                            cluster_bool_t merge, vector_clock_comp_res_t expected) {
+    uint32_t iterations = BENCH_RECORDS / first->size;
+    uint32_t mismatches = 0;
+    uint64_t start = bench_time_ns();
+    for (uint32_t i = 0; i < iterations; ++i) {
+        if (vector_clock_compare(first, second, merge) != expected) ++mismatches;
+    }
+    uint64_t elapsed = bench_time_ns() - start;
+    if (mismatches > 0) return -1.0;
+    return (double) elapsed / iterations;
+}
+
+static int bench_run(uint32_t size) {
+    vector_clock_t first;
+    vector_clock_t second;
+    vector_clock_init(&first);
+    vector_clock_init(&second);
+
+    int result = bench_clocks_init(&first, &second, size);
+    if (result < 0) {
+        fprintf(stderr, "Failed to build clocks of %u records: %d\n", size, result);
+        vector_clock_destroy(&first);
+        vector_clock_destroy(&second);
+        return result;
+    }
+
+    // Identical clocks have to be scanned to the end.
+    double equal_ns = bench_compare(&first, &second, CLUSTER_FALSE, VC_EQUAL);
+
+    // The last record differs, so the outcome isn't known before the end either.
+    cluster_member_t last;
+    bench_member_init(&last, size - 1);
+    vector_clock_set(&second, &last, size + 1, NULL);
+    double before_ns = bench_compare(&first, &second, CLUSTER_FALSE, VC_BEFORE);
+
+    // Merging into the newer clock keeps both clocks intact between iterations.
+    double merge_ns = bench_compare(&second, &first, CLUSTER_TRUE, VC_AFTER);
+
+    vector_clock_destroy(&first);
+    vector_clock_destroy(&second);
+
+    if (equal_ns < 0 || before_ns < 0 || merge_ns < 0) {
+        fprintf(stderr, "Unexpected comparison result with %u records\n", size);
+        return CLUSTER_ERR_BAD_STATE;
+    }
+    printf("%-8s %8u %14.1f %14.1f %14.1f\n", BENCH_KERNEL, size, equal_ns, before_ns, merge_ns);
+    return CLUSTER_ERR_NONE;
+}
+
+int main(void) {
+    printf("%-8s %8s %14s %14s %14s\n", "kernel", "records", "equal ns/op", "before ns/op", "merge ns/op");
+    for (size_t i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); ++i) {
+        if (bench_run(bench_sizes[i]) < 0) return 1;
+    }
+    return 0;
+}
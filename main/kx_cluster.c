@@ -66,6 +66,7 @@ int main(int argc, char *argv[]) {
     };
 
     int poll_interval = GOSSIP_TICK_INTERVAL;
+    int recv_batch_limit = 256; // the maximum number of messages read per wakeup
     int recv_result = 0;
     int send_result = 0;
     int poll_result = 0;
@@ -79,8 +80,8 @@ int main(int argc, char *argv[]) {
                 cluster_gossip_destroy(gossip);
                 return -1;
             } else if (gossip_poll_fd.revents & POLLIN) {
-                // Tell Pittacus to read a message from the socket.
-                recv_result = cluster_gossip_process_receive(gossip);
+                // Tell Pittacus to read all pending messages from the socket.
+                recv_result = cluster_gossip_process_receive_batch(gossip, recv_batch_limit);
                 if (recv_result < 0) {
                     log_error("Gossip receive failed: %d\n", recv_result);
                     cluster_gossip_destroy(gossip);
@@ -145,11 +145,14 @@ static void *thread_start(void *arg){
     char                message[256];
     cluster_socket_fd   gossip_fd;
     int                 poll_interval = GOSSIP_TICK_INTERVAL;
+    int                 recv_batch_limit = 256; // max messages read per wakeup
     int                 recv_result = 0;
     int                 send_result = 0;
     int                 poll_result = 0;
     int                 send_data_interval = 5; // send data every 5 seconds
     time_t              previous_data_msg_ts = time(NULL);
+    char                snapshot_path[64];
+    cluster_gossip_config_t config;
 
     self_in.sin_family = AF_INET;
     self_in.sin_port = 0; // pick up a random port.
@@ -166,14 +169,21 @@ static void *thread_start(void *arg){
     gcsnode.seed_node.addr = (const cluster_sockaddr *)&seed_node_in;
     gcsnode.seed_node.addr_len = sizeof(struct sockaddr_in);
 
+    // Keep the known members on disk, so that a restarted node
+    // can rejoin the cluster even if the seed node is down.
+    cluster_gossip_config_init(&config);
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s.members",
+             gcsnode.nodename[0] != '\0' ? gcsnode.nodename : "gfs");
+    config.member_snapshot_path = snapshot_path;
+
     // Create a new Pittacus descriptor instance.
-    gcsnode.gossip = cluster_gossip_create(&gcsnode.self, &data_receiver, NULL, gcsnode.nodename);
+    gcsnode.gossip = cluster_gossip_create_ex(&gcsnode.self, &data_receiver, NULL, gcsnode.nodename, &config);
     if (gcsnode.gossip == NULL) {
         log_error("Gossip initialization failed: %s\n", strerror(errno));
         return NULL;
     }
 
-    result = cluster_gossip_join(gcsnode.gossip, &gcsnode.seed_node, 1);
+    result = cluster_gossip_join_from_snapshot(gcsnode.gossip, &gcsnode.seed_node, 1);
     if (result < 0) {
         log_error("Gossip join failed: %d\n", result);
         cluster_gossip_destroy(gcsnode.gossip);
@@ -206,8 +216,8 @@ static void *thread_start(void *arg){
                 cluster_gossip_destroy(gcsnode.gossip);
                 goto err;
             } else if (gossip_poll_fd.revents & POLLIN) {
-                // Tell Pittacus to read a message from the socket.
-                recv_result = cluster_gossip_process_receive(gcsnode.gossip);
+                // Tell Pittacus to read all pending messages from the socket.
+                recv_result = cluster_gossip_process_receive_batch(gcsnode.gossip, recv_batch_limit);
                 if (recv_result < 0) {
                     log_error("Gossip receive failed: %d\n", recv_result);
                     cluster_gossip_destroy(gcsnode.gossip);
@@ -123,14 +123,18 @@ static int ls() {
     pthread_rwlock_rdlock(&gcsnode.rwlock);
     mset = cluster_gossip_member_list(gcsnode.gossip);
     for (int i = 0; i < mset->size; i++) {
-        printf("[*] %-16s %12u\n", mset->set[i]->username, mset->set[i]->uid);
+        printf("[*] %-16s %12u\n", mset->set[i].username, mset->set[i].uid);
     }
     pthread_rwlock_unlock(&gcsnode.rwlock);
 
     return 0;
 }
 
-static void ls_showaddr(cluster_sockaddr_storage *sa) {
+static void ls_showaddr(const cluster_member_addr_t *addr) {
+    cluster_sockaddr_storage storage;
+    cluster_member_addr_to_sockaddr(addr, &storage);
+    cluster_sockaddr_storage *sa = &storage;
+
     if (sa->ss_family == AF_INET) {
         struct sockaddr_in* sa4 = (struct sockaddr_in*)sa;
         char ip4[INET_ADDRSTRLEN];
@@ -152,7 +156,7 @@ static int ls_index() {
     pthread_rwlock_rdlock(&gcsnode.rwlock);
     mset = cluster_gossip_member_list(gcsnode.gossip);
     for (int i = 0; i < mset->size; i++) {
-        ls_showaddr(mset->set[i]->address);
+        ls_showaddr(&mset->set[i].address);
     }
     pthread_rwlock_unlock(&gcsnode.rwlock);
 
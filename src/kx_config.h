@@ -26,6 +26,7 @@ extern "C" {
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <stdlib.h>
 #include <string.h>
@@ -41,7 +42,9 @@ typedef struct sockaddr             cluster_sockaddr;
 typedef struct sockaddr_in          cluster_sockaddr_in;
 typedef struct sockaddr_in6         cluster_sockaddr_in6;
 typedef struct sockaddr_storage     cluster_sockaddr_storage;
+typedef struct mmsghdr              cluster_mmsghdr;
 
+typedef struct cluster_member_addr  cluster_member_addr_t;
 typedef struct cluster_member       cluster_member_t;
 typedef struct cluster_member_set   cluster_member_set_t;
 typedef enum cluster_error          cluster_error_t;
@@ -56,20 +59,70 @@ typedef struct message_member_list  message_member_list_t;
 typedef struct message_ack          message_ack_t;
 typedef struct message_data         message_data_t;
 typedef struct message_status       message_status_t;
+typedef struct message_ping         message_ping_t;
+typedef struct message_ping_req     message_ping_req_t;
+typedef struct message_indirect_ack message_indirect_ack_t;
+typedef struct message_digest       message_digest_t;
+typedef struct message_ihave        message_ihave_t;
+typedef struct message_graft        message_graft_t;
+typedef struct message_prune        message_prune_t;
+typedef struct message_view         message_view_t;
+typedef struct message_disconnect   message_disconnect_t;
+typedef struct message_data_fragment message_data_fragment_t;
+typedef struct message_fragment_request message_fragment_request_t;
+typedef struct cluster_timer        cluster_timer_t;
+typedef struct cluster_timer_heap   cluster_timer_heap_t;
+typedef struct cluster_pool         cluster_pool_t;
+typedef struct cluster_rng          cluster_rng_t;
+typedef struct cluster_journal      cluster_journal_t;
 
 #include "kx_log.h"
 #include "kx_gossip.h"
 #include "kx_errors.h"
 #include "kx_network.h"
-#include "kx_member.h"
 #include "kx_utils.h"
+#include "kx_member.h"
 #include "kx_vectorclock.h"
 #include "kx_messages.h"
+#include "kx_timer.h"
+#include "kx_pool.h"
+#include "kx_journal.h"
 
 #ifndef PROTOCOL_VERSION
-#define PROTOCOL_VERSION 0x01
+#define PROTOCOL_VERSION 0x0B
 #endif
 
+/* The lowest protocol version which understands the compact member
+ * encoding in Member List messages. */
+#define PROTOCOL_VERSION_COMPACT_MEMBERS 0x02
+/* The lowest protocol version which takes part in the SWIM failure
+ * detection (Ping, Ping-Req and Indirect Ack messages). */
+#define PROTOCOL_VERSION_PROBE 0x03
+/* The lowest protocol version which exchanges the liveness state
+ * (alive, suspect or dead) and the incarnation of members. */
+#define PROTOCOL_VERSION_LIVENESS 0x04
+/* The lowest protocol version which accepts membership events
+ * piggybacked on Status, Data and Ack messages. */
+#define PROTOCOL_VERSION_PIGGYBACK 0x05
+/* The lowest protocol version which reconciles the member
+ * set by exchanging digests. */
+#define PROTOCOL_VERSION_DIGEST 0x06
+/* The lowest protocol version which takes part in the epidemic
+ * broadcast tree (IHave, Graft and Prune messages). */
+#define PROTOCOL_VERSION_PLUMTREE 0x07
+/* The lowest protocol version which maintains partial views (Forward
+ * Join, Neighbor, Shuffle and Disconnect messages). */
+#define PROTOCOL_VERSION_HYPARVIEW 0x08
+/* The lowest protocol version which accepts Status messages
+ * with clocks encoded as deltas. */
+#define PROTOCOL_VERSION_DELTA_STATUS 0x09
+/* The lowest protocol version which reassembles data payloads
+ * sent as fragments (Data Fragment and Fragment Request messages). */
+#define PROTOCOL_VERSION_FRAGMENTS 0x0A
+/* The lowest protocol version which exchanges the largest datagram
+ * size of members in Member List messages. */
+#define PROTOCOL_VERSION_DATAGRAM_SIZE 0x0B
+
 /* The interval in milliseconds between retry attempts. */
 #ifndef MESSAGE_RETRY_INTERVAL
 #define MESSAGE_RETRY_INTERVAL 10000
@@ -86,27 +139,231 @@ typedef struct message_status       message_status_t;
 #endif
 
 /* The maximum supported size of the message 
- * including a protocol overhead. */
+ * including a protocol overhead. Zero sizes messages
+ * to the MTU of the network interface. */
 #ifndef MESSAGE_MAX_SIZE
 #define MESSAGE_MAX_SIZE 512
 #endif
 
+/* The size of messages sent to members which haven't
+ * advertised the largest datagram they accept. */
+#ifndef MESSAGE_LEGACY_MAX_SIZE
+#define MESSAGE_LEGACY_MAX_SIZE 512
+#endif
+
 /* The maximum number of unique messages that 
  * can be stored in the outbound message queue. */
 #ifndef MAX_OUTPUT_MESSAGES
 #define MAX_OUTPUT_MESSAGES 100
 #endif
 
+/* The number of datagrams that can be read from the
+ * socket with a single system call. */
+#ifndef MESSAGE_RECV_BATCH_SIZE
+#define MESSAGE_RECV_BATCH_SIZE 32
+#endif
+
+/* The maximum number of datagrams that can be written
+ * to the socket with a single system call. */
+#ifndef MESSAGE_SEND_BATCH_SIZE
+#define MESSAGE_SEND_BATCH_SIZE 32
+#endif
+
+/* The number of outbound envelopes the envelope pool
+ * grows by when all previously allocated ones are in use. */
+#ifndef ENVELOPE_POOL_CHUNK_SIZE
+#define ENVELOPE_POOL_CHUNK_SIZE 256
+#endif
+
 /* The time interval in milliseconds that determines 
  * how often the Gossip tick event should be triggered. */
 #ifndef GOSSIP_TICK_INTERVAL
 #define GOSSIP_TICK_INTERVAL 1000
 #endif
 
+/* The number of originators whose recent data messages
+ * are kept for anti-entropy. */
 #ifndef DATA_LOG_SIZE
 #define DATA_LOG_SIZE 25
 #endif
 
+/* The number of the most recent data messages kept per originator.
+ * Members lagging behind further than this can't recover the oldest
+ * missing messages. */
+#ifndef DATA_LOG_DEPTH
+#define DATA_LOG_DEPTH 16
+#endif
+
+/* The upper bound on the total size in bytes of the logged data payloads.
+ * The oldest messages are dropped first once it's exceeded. */
+#ifndef DATA_LOG_MAX_BYTES
+#define DATA_LOG_MAX_BYTES (4 * 1024 * 1024)
+#endif
+
+/* The size in bytes the persistent data log file has to reach before
+ * it's compacted. The compaction also requires that at least half of
+ * the file is taken by records which are no longer live. */
+#ifndef DATA_LOG_COMPACT_SIZE
+#define DATA_LOG_COMPACT_SIZE (1024 * 1024)
+#endif
+
+/* The time in milliseconds after which a gap in the data messages of
+ * an originator is skipped if anti-entropy failed to fill it. */
+#ifndef DATA_LOG_GAP_TIMEOUT
+#define DATA_LOG_GAP_TIMEOUT 10000
+#endif
+
+/* The upper bound on the total size in bytes of the data payloads being
+ * reassembled from fragments. It's also the largest payload a member sends. */
+#ifndef DATA_REASSEMBLY_MAX_BYTES
+#define DATA_REASSEMBLY_MAX_BYTES (4 * 1024 * 1024)
+#endif
+
+/* The time in milliseconds after which a payload that stopped
+ * receiving fragments is abandoned. */
+#ifndef DATA_REASSEMBLY_TIMEOUT
+#define DATA_REASSEMBLY_TIMEOUT 30000
+#endif
+
+/* The maximum number of requested fragments of a payload which haven't
+ * arrived yet. It bounds the fragments a member adds to the outbound
+ * queue of the member it pulls them from. */
+#ifndef DATA_FRAGMENT_WINDOW
+#define DATA_FRAGMENT_WINDOW 16
+#endif
+
+/* The time in milliseconds without new fragments after which the missing
+ * fragments of a payload are requested again from the next member. */
+#ifndef DATA_FRAGMENT_TIMEOUT
+#define DATA_FRAGMENT_TIMEOUT 500
+#endif
+
+/* The number of members that announced a payload to remember.
+ * The missing fragments are requested from each of them in turn. */
+#ifndef DATA_FRAGMENT_SOURCES
+#define DATA_FRAGMENT_SOURCES 4
+#endif
+
+/* The interval in milliseconds between failure detector probes. */
+#ifndef GOSSIP_PROBE_INTERVAL
+#define GOSSIP_PROBE_INTERVAL 1000
+#endif
+
+/* The time in milliseconds a probed member is given to respond. */
+#ifndef GOSSIP_PROBE_TIMEOUT
+#define GOSSIP_PROBE_TIMEOUT 300
+#endif
+
+/* The number of members that are asked to probe
+ * a member which didn't respond directly. */
+#ifndef GOSSIP_PROBE_INDIRECT_MEMBERS
+#define GOSSIP_PROBE_INDIRECT_MEMBERS 3
+#endif
+
+/* The suspicion timeout is this many probe intervals
+ * multiplied by log10 of the cluster size. */
+#ifndef GOSSIP_SUSPICION_MULT
+#define GOSSIP_SUSPICION_MULT 4
+#endif
+
+/* A membership event is piggybacked on outgoing messages this
+ * many times multiplied by log10 of the cluster size. */
+#ifndef GOSSIP_PIGGYBACK_MULT
+#define GOSSIP_PIGGYBACK_MULT 3
+#endif
+
+/* The maximum number of membership events awaiting dissemination. */
+#ifndef GOSSIP_PIGGYBACK_CAPACITY
+#define GOSSIP_PIGGYBACK_CAPACITY 64
+#endif
+
+/* The interval in milliseconds between two membership digest
+ * exchanges with a random member. */
+#ifndef GOSSIP_SYNC_INTERVAL
+#define GOSSIP_SYNC_INTERVAL 5000
+#endif
+
+/* Set to 1 to disseminate Data messages along the epidemic
+ * broadcast tree (Plumtree) instead of random members. */
+#ifndef GOSSIP_PLUMTREE
+#define GOSSIP_PLUMTREE 0
+#endif
+
+/* The time in milliseconds to wait for a Data message announced
+ * with IHave before requesting it with Graft. */
+#ifndef GOSSIP_IHAVE_TIMEOUT
+#define GOSSIP_IHAVE_TIMEOUT 500
+#endif
+
+/* The maximum number of announced but not yet received Data messages. */
+#ifndef GOSSIP_PLUMTREE_MISSING
+#define GOSSIP_PLUMTREE_MISSING 64
+#endif
+
+/* The number of announcers of a missing Data message to remember.
+ * Each of them is grafted in turn until the message arrives. */
+#ifndef GOSSIP_PLUMTREE_ANNOUNCERS
+#define GOSSIP_PLUMTREE_ANNOUNCERS 3
+#endif
+
+/* The size of the active view used for dissemination. 0 disables
+ * partial views and every node keeps the full member set. */
+#ifndef GOSSIP_ACTIVE_VIEW_SIZE
+#define GOSSIP_ACTIVE_VIEW_SIZE 0
+#endif
+
+/* The size of the passive view used to repair the active one. */
+#ifndef GOSSIP_PASSIVE_VIEW_SIZE
+#define GOSSIP_PASSIVE_VIEW_SIZE 30
+#endif
+
+/* The interval in milliseconds between two passive view shuffles. */
+#ifndef GOSSIP_SHUFFLE_INTERVAL
+#define GOSSIP_SHUFFLE_INTERVAL 10000
+#endif
+
+/* The interval in milliseconds between two snapshots of the member set. */
+#ifndef MEMBER_SNAPSHOT_INTERVAL
+#define MEMBER_SNAPSHOT_INTERVAL 30000
+#endif
+
+/* The number of hops a Forward Join message and a Shuffle
+ * request make before they are accepted. */
+#ifndef GOSSIP_ACTIVE_WALK_LENGTH
+#define GOSSIP_ACTIVE_WALK_LENGTH 6
+#endif
+
+/* The hop at which a forwarded newcomer is added to the passive view. */
+#ifndef GOSSIP_PASSIVE_WALK_LENGTH
+#define GOSSIP_PASSIVE_WALK_LENGTH 3
+#endif
+
+/* The number of active and passive members sent in a Shuffle request. */
+#ifndef GOSSIP_SHUFFLE_ACTIVE
+#define GOSSIP_SHUFFLE_ACTIVE 3
+#endif
+#ifndef GOSSIP_SHUFFLE_PASSIVE
+#define GOSSIP_SHUFFLE_PASSIVE 4
+#endif
+
+/* The maximum number of peers whose Status clocks are tracked
+ * for delta encoding. The least recently used peer is forgotten. */
+#ifndef GOSSIP_STATUS_PEERS
+#define GOSSIP_STATUS_PEERS 64
+#endif
+
+/* The maximum number of probes this node can
+ * perform on behalf of other members at once. */
+#ifndef GOSSIP_PROBE_INDIRECT_PENDING
+#define GOSSIP_PROBE_INDIRECT_PENDING 32
+#endif
+
+/* Compare vector clocks with SSE2/AVX2 kernels when the CPU
+ * supports them. 0 always uses the scalar code. */
+#ifndef VECTOR_CLOCK_SIMD
+#define VECTOR_CLOCK_SIMD 1
+#endif
+
 #define CLUSTER_NTOHS(i) ntohs((i))
 #define CLUSTER_NTOHL(i) ntohl((i))
 #define CLUSTER_HTONS(i) htons((i))
@@ -18,8 +18,7 @@
 #include "kx_gossip.h"
 
 #define RETURN_IF_NOT_CONNECTED(state)  if ((state) != STATE_CONNECTED) return CLUSTER_ERR_BAD_STATE;
-#define INPUT_BUFFER_SIZE               MESSAGE_MAX_SIZE
-#define OUTPUT_BUFFER_SIZE              MAX_OUTPUT_MESSAGES * MESSAGE_MAX_SIZE
+#define OUTPUT_SLOT_WORDS(slots)        (((slots) + 63) / 64)
 
 typedef struct message_envelope_in {
     const cluster_sockaddr_storage *sender;
@@ -33,10 +32,12 @@ typedef struct message_envelope_out {
     cluster_socklen_t recipient_len;
     const uint8_t *buffer;
     size_t buffer_size;
+    uint32_t buffer_slot;
     uint32_t sequence_num;
     uint64_t attempt_ts;
     uint16_t attempt_num;
     uint16_t max_attempts;
+    cluster_timer_t retry_timer;
     struct message_envelope_out *prev;
     struct message_envelope_out *next;
 } message_envelope_out_t;
@@ -44,25 +45,197 @@ typedef struct message_envelope_out {
 typedef struct message_queue {
     message_envelope_out_t *head;
     message_envelope_out_t *tail;
+    // Open addressing (linear probing) index of envelopes by sequence number.
+    message_envelope_out_t **index;
+    uint32_t index_size;
+    uint32_t index_capacity;
+    // Envelopes ordered by the time of their next delivery attempt.
+    cluster_timer_heap_t due;
+    // Storage for envelopes, so that the queue doesn't hit the system
+    // allocator for every recipient of every message.
+    cluster_pool_t pool;
+    // The number of envelopes referencing each slot of the output buffer
+    // and the bitmap of slots that are referenced by at least one envelope.
+    uint32_t *slot_refs;
+    uint64_t *slot_bitmap;
+    uint32_t slots_num;
 } message_queue_t;
 
+static const uint32_t QUEUE_INDEX_INITIAL_CAPACITY = 64;
+static const uint8_t QUEUE_INDEX_EXTENSION_FACTOR = 2;
+static const double QUEUE_INDEX_LOAD_FACTOR = 0.5;
+
 typedef struct data_log_record {
-    vector_record_t version;
-    uint16_t data_size;
-    uint8_t data[MESSAGE_MAX_SIZE];
+    uint32_t sequence_number;
+    uint32_t data_size;
+    uint8_t *data;
+    uint64_t order;
+    // Neighbours in the order of arrival across all streams.
+    struct data_log_record *older;
+    struct data_log_record *newer;
 } data_log_record_t;
 
+/* The recent data messages of a single originator. The record with the
+ * sequence number N is stored at N % depth. Sequence numbers below the
+ * floor are treated as delivered, since their records were dropped.
+ * Everything up to delivered has arrived without gaps. */
+typedef struct data_log_stream {
+    member_id_t member_id;
+    uint32_t floor;
+    uint32_t latest;
+    uint32_t delivered;
+    uint32_t gap_edge;
+    uint64_t gap_ts;
+    uint64_t last_order;
+    data_log_record_t *records;
+} data_log_stream_t;
+
 typedef struct data_log {
-    data_log_record_t messages[DATA_LOG_SIZE];
+    data_log_stream_t *streams;
+    data_log_record_t *storage;
+    uint32_t capacity;
     uint32_t size;
-    uint32_t current_idx;
+    uint32_t depth;
+    size_t bytes;
+    size_t max_bytes;
+    /* The number of stored records. */
+    size_t records_num;
+    uint64_t order;
+    data_log_record_t *oldest;
+    data_log_record_t *newest;
 } data_log_t;
 
+typedef enum gossip_probe_phase {
+    PROBE_IDLE = 0,
+    PROBE_DIRECT = 1,
+    PROBE_INDIRECT = 2
+} gossip_probe_phase_t;
+
+// The probe of a single member performed by this node during
+// the current protocol period.
+typedef struct gossip_probe {
+    gossip_probe_phase_t phase;
+    cluster_member_addr_t target;
+    uint32_t ping_seq;
+    uint64_t started_ts;
+    uint64_t deadline;
+    uint64_t next_probe_ts;
+    // Targets are taken from a shuffled list of member indices, so every
+    // member is probed once per round instead of at random.
+    uint32_t *order;
+    uint32_t order_num;
+    uint32_t order_capacity;
+    uint32_t order_cursor;
+} gossip_probe_t;
+
+// A membership event that is piggybacked on outgoing messages
+// until it has been sent the required number of times.
+typedef struct gossip_piggyback_entry {
+    cluster_member_t member;
+    uint32_t transmits;
+    // Copies in the batch of datagrams which hasn't been sent yet.
+    uint32_t pending;
+} gossip_piggyback_entry_t;
+
+// A member suspected by this node that will be declared dead
+// unless it refutes the suspicion before the deadline.
+typedef struct gossip_suspicion {
+    cluster_member_addr_t address;
+    uint32_t uid;
+    uint32_t incarnation;
+    uint64_t deadline;
+} gossip_suspicion_t;
+
+// Members this node pushes Data messages of the given originator to.
+// The rest of members are lazy peers of the tree.
+typedef struct gossip_broadcast_tree {
+    member_id_t root;
+    cluster_member_addr_t *eager_peers;
+    uint32_t eager_peers_num;
+    uint32_t eager_peers_capacity;
+    uint64_t last_used_ts;
+} gossip_broadcast_tree_t;
+
+// A Data message announced by lazy peers but not received yet.
+typedef struct gossip_missing_data {
+    vector_record_t data_version;
+    cluster_member_addr_t announcers[GOSSIP_PLUMTREE_ANNOUNCERS];
+    uint8_t announcers_num;
+    uint8_t grafted_num;
+    uint64_t deadline;
+} gossip_missing_data_t;
+
+// A data payload being reassembled from its fragments. Fragments are requested
+// from one of the members which announced the payload at a time, in the order
+// of their indices starting from the cursor. The received fragments are
+// tracked by the bitmap. A source sends fragments in the order they were
+// requested, so the requested fragments preceding an arrived one are lost
+// and requested again right away.
+typedef struct gossip_reassembly {
+    vector_record_t data_version;
+    uint8_t *data;
+    uint64_t *received;
+    uint32_t total_size;
+    uint16_t fragment_size;
+    uint16_t fragments_num;
+    uint16_t received_num;
+    uint16_t cursor;
+    uint16_t in_flight[DATA_FRAGMENT_WINDOW];
+    uint16_t in_flight_head;
+    uint16_t in_flight_num;
+    uint16_t lost[DATA_FRAGMENT_WINDOW];
+    uint16_t lost_num;
+    cluster_member_addr_t sources[DATA_FRAGMENT_SOURCES];
+    uint8_t sources_num;
+    uint8_t source;
+    uint64_t deadline;
+    uint64_t last_progress_ts;
+} gossip_reassembly_t;
+
+// Clocks exchanged with a peer in Status messages. Clocks sent to the peer
+// are encoded as deltas against the last one it has acknowledged, while
+// either of the last two clocks received from it may be the base of its deltas.
+typedef struct gossip_status_peer {
+    cluster_member_addr_t address;
+    uint32_t acked_seq;
+    vector_clock_t acked;
+    uint32_t sent_seq;
+    vector_clock_t sent;
+    uint32_t received_seq[2];
+    vector_clock_t received[2];
+    uint8_t received_latest;
+    uint64_t last_used_ts;
+} gossip_status_peer_t;
+
+// A probe performed on behalf of another member (Ping-Req).
+typedef struct gossip_indirect_probe {
+    cluster_bool_t active;
+    cluster_member_addr_t target;
+    cluster_sockaddr_storage requester;
+    cluster_socklen_t requester_len;
+    uint32_t requester_seq;
+    uint32_t ping_seq;
+    uint64_t expire_ts;
+} gossip_indirect_probe_t;
+
 struct cluster_gossip {
+    cluster_gossip_config_t config;
     cluster_socket_fd socket;
-    uint8_t input_buffer[INPUT_BUFFER_SIZE];
-    uint8_t output_buffer[OUTPUT_BUFFER_SIZE];
+    uint8_t *input_buffer;
+    cluster_sockaddr_storage input_addr[MESSAGE_RECV_BATCH_SIZE];
+    struct iovec input_iov[MESSAGE_RECV_BATCH_SIZE];
+    cluster_mmsghdr input_msgs[MESSAGE_RECV_BATCH_SIZE];
+    uint8_t *output_buffer;
     size_t output_buffer_offset;
+    uint8_t output_header[MESSAGE_SEND_BATCH_SIZE][sizeof(message_header_t)];
+    uint8_t *output_trailer;
+    struct iovec output_iov[MESSAGE_SEND_BATCH_SIZE][3];
+    cluster_mmsghdr output_msgs[MESSAGE_SEND_BATCH_SIZE];
+    message_envelope_out_t *output_batch[MESSAGE_SEND_BATCH_SIZE];
+    // Piggyback entries carried by each datagram of the batch.
+    uint16_t output_piggyback[MESSAGE_SEND_BATCH_SIZE][GOSSIP_PIGGYBACK_CAPACITY];
+    uint8_t output_piggyback_num[MESSAGE_SEND_BATCH_SIZE];
+    uint32_t output_batch_size;
     message_queue_t outbound_messages;
     uint32_t sequence_num;
     uint32_t data_counter;
@@ -71,52 +244,422 @@ struct cluster_gossip {
     cluster_member_t self_address;
     cluster_member_set_t members;
     data_log_t data_log;
+    cluster_journal_t *journal;
+    vector_clock_t journal_version;
+    /* The journal size at the last sync. */
+    size_t journal_synced_tail;
+    cluster_member_t **reservoir;
+    uint32_t reservoir_size;
+    gossip_probe_t probe;
+    gossip_indirect_probe_t indirect_probes[GOSSIP_PROBE_INDIRECT_PENDING];
+    gossip_piggyback_entry_t piggyback[GOSSIP_PIGGYBACK_CAPACITY];
+    uint32_t piggyback_num;
+    gossip_suspicion_t *suspicions;
+    uint32_t suspicions_num;
+    uint32_t suspicions_capacity;
+    gossip_broadcast_tree_t *trees;
+    uint32_t trees_num;
+    uint32_t trees_capacity;
+    gossip_missing_data_t missing_data[GOSSIP_PLUMTREE_MISSING];
+    gossip_status_peer_t *status_peers;
+    uint32_t status_peers_num;
+    uint32_t status_peers_capacity;
+    uint32_t missing_data_num;
+    gossip_reassembly_t *reassemblies;
+    uint32_t reassemblies_num;
+    uint32_t reassemblies_capacity;
+    size_t reassembly_bytes;
     uint64_t last_gossip_ts;
+    uint64_t last_sync_ts;
+    uint64_t last_shuffle_ts;
+    uint64_t last_repair_ts;
+    uint64_t last_snapshot_ts;
+    char *member_snapshot_path;
     data_receiver_t data_receiver;
     void *data_receiver_context;
 };
 
-static int gossip_data_log_create_message(const data_log_record_t *record, message_data_t *msg) {
+static int gossip_data_log_init(data_log_t *log, uint32_t capacity, uint32_t depth, size_t max_bytes) {
+    log->streams = (data_log_stream_t *) calloc(capacity, sizeof(data_log_stream_t));
+    if (log->streams == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+    log->storage = (data_log_record_t *) calloc((size_t) capacity * depth, sizeof(data_log_record_t));
+    if (log->storage == NULL) {
+        free(log->streams);
+        log->streams = NULL;
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    }
+    for (uint32_t i = 0; i < capacity; ++i) {
+        log->streams[i].records = log->storage + (size_t) i * depth;
+    }
+    log->capacity = capacity;
+    log->size = 0;
+    log->depth = depth;
+    log->bytes = 0;
+    log->max_bytes = max_bytes;
+    log->records_num = 0;
+    log->order = 0;
+    log->oldest = NULL;
+    log->newest = NULL;
+    return CLUSTER_ERR_NONE;
+}
+
+static void gossip_data_log_record_clear(data_log_t *log, data_log_record_t *record) {
+    if (record->sequence_number == 0) return;
+    if (record->older != NULL) {
+        record->older->newer = record->newer;
+    } else {
+        log->oldest = record->newer;
+    }
+    if (record->newer != NULL) {
+        record->newer->older = record->older;
+    } else {
+        log->newest = record->older;
+    }
+    record->older = NULL;
+    record->newer = NULL;
+    log->bytes -= record->data_size;
+    --log->records_num;
+    free(record->data);
+    record->data = NULL;
+    record->data_size = 0;
+    record->sequence_number = 0;
+}
+
+static void gossip_data_log_destroy(data_log_t *log) {
+    if (log->storage != NULL) {
+        for (size_t i = 0; i < (size_t) log->capacity * log->depth; ++i) {
+            gossip_data_log_record_clear(log, &log->storage[i]);
+        }
+    }
+    free(log->streams);
+    free(log->storage);
+    log->streams = NULL;
+    log->storage = NULL;
+}
+
+/* Returns the lowest sequence number the stream can still hold. */
+static uint32_t gossip_data_log_window_start(const data_log_t *log, const data_log_stream_t *stream) {
+    uint32_t start = stream->latest > log->depth ? stream->latest - log->depth : 0;
+    return (stream->floor > start ? stream->floor : start) + 1;
+}
+
+static data_log_stream_t *gossip_data_log_find(const data_log_t *log, const member_id_t *member_id) {
+    for (uint32_t i = 0; i < log->size; ++i) {
+        if (log->streams[i].member_id == *member_id) return &log->streams[i];
+    }
+    return NULL;
+}
+
+static data_log_record_t *gossip_data_log_record(const data_log_t *log, const data_log_stream_t *stream,
+                                                 uint32_t sequence_number) {
+    if (sequence_number < gossip_data_log_window_start(log, stream) || sequence_number > stream->latest) {
+        return NULL;
+    }
+    data_log_record_t *record = &stream->records[sequence_number % log->depth];
+    return record->sequence_number == sequence_number ? record : NULL;
+}
+
+/* Returns true if the data message is logged or is older than
+ * the window of its originator. */
+static cluster_bool_t gossip_data_log_contains(const data_log_t *log, const vector_record_t *version) {
+    const data_log_stream_t *stream = gossip_data_log_find(log, &version->member_id);
+    if (stream == NULL) return CLUSTER_FALSE;
+    if (version->sequence_number > stream->latest) return CLUSTER_FALSE;
+    if (version->sequence_number < gossip_data_log_window_start(log, stream)) return CLUSTER_TRUE;
+    return gossip_data_log_record(log, stream, version->sequence_number) != NULL;
+}
+
+/* Drops the least recently logged record across all streams. The floor of
+ * its stream moves past it unless records with lower sequence numbers,
+ * which have arrived later, are still logged. */
+static void gossip_data_log_evict_oldest(data_log_t *log) {
+    data_log_record_t *oldest = log->oldest;
+    if (oldest == NULL) return;
+    data_log_stream_t *stream = &log->streams[(oldest - log->storage) / log->depth];
+    uint32_t seq = gossip_data_log_window_start(log, stream);
+    while (seq < oldest->sequence_number && gossip_data_log_record(log, stream, seq) == NULL) ++seq;
+    if (seq == oldest->sequence_number) stream->floor = seq;
+    gossip_data_log_record_clear(log, oldest);
+}
+
+/* Returns the stream of the originator, replacing the least recently
+ * updated one once the log tracks the maximum number of originators. */
+static data_log_stream_t *gossip_data_log_stream_get(data_log_t *log, const vector_record_t *version) {
+    data_log_stream_t *stream = gossip_data_log_find(log, &version->member_id);
+    if (stream != NULL) return stream;
+
+    if (log->size < log->capacity) {
+        stream = &log->streams[log->size++];
+    } else {
+        stream = &log->streams[0];
+        for (uint32_t i = 1; i < log->size; ++i) {
+            if (log->streams[i].last_order < stream->last_order) stream = &log->streams[i];
+        }
+        for (uint32_t i = 0; i < log->depth; ++i) gossip_data_log_record_clear(log, &stream->records[i]);
+    }
+    stream->member_id = version->member_id;
+    // The messages which the originator sent before this one are missing
+    // as well. Those still logged by other members are recovered by anti-entropy.
+    stream->floor = 0;
+    stream->latest = 0;
+    stream->delivered = stream->floor;
+    stream->gap_edge = stream->floor;
+    stream->gap_ts = 0;
+    stream->last_order = 0;
+    return stream;
+}
+
+static int gossip_data_log_create_message(const data_log_stream_t *stream, const data_log_record_t *record,
+                                          message_data_t *msg) {
     message_header_init(&msg->header, MESSAGE_DATA_TYPE, 0);
-    vector_clock_record_copy(&msg->data_version, &record->version);
-    msg->data = (uint8_t *)record->data;
+    msg->data_version.member_id = stream->member_id;
+    msg->data_version.sequence_number = record->sequence_number;
+    msg->data = record->data;
     msg->data_size = record->data_size;
     return CLUSTER_ERR_NONE;
 }
 
 static int gossip_data_log(data_log_t *log, const message_data_t *msg) {
-    data_log_record_t *record = NULL;
+    const vector_record_t *version = &msg->data_version;
+    if (version->sequence_number == 0) return CLUSTER_ERR_INVALID_MESSAGE;
+    if (gossip_data_log_contains(log, version)) return CLUSTER_ERR_NONE;
+
+    uint8_t *data = (uint8_t *) malloc(msg->data_size > 0 ? msg->data_size : 1);
+    if (data == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+    memcpy(data, msg->data, msg->data_size);
+
+    data_log_stream_t *stream = gossip_data_log_stream_get(log, version);
+    if (version->sequence_number > stream->latest) {
+        // Release the slots which the new window no longer covers.
+        uint32_t seq = gossip_data_log_window_start(log, stream);
+        uint32_t new_start = version->sequence_number > log->depth ? version->sequence_number - log->depth + 1 : 1;
+        for (; seq < new_start && seq <= stream->latest; ++seq) {
+            gossip_data_log_record_clear(log, &stream->records[seq % log->depth]);
+        }
+        stream->latest = version->sequence_number;
+    }
+    data_log_record_t *record = &stream->records[version->sequence_number % log->depth];
+    gossip_data_log_record_clear(log, record);
+    record->sequence_number = version->sequence_number;
+    record->data = data;
+    record->data_size = msg->data_size;
+    record->order = ++log->order;
+    record->older = log->newest;
+    record->newer = NULL;
+    if (log->newest != NULL) {
+        log->newest->newer = record;
+    } else {
+        log->oldest = record;
+    }
+    log->newest = record;
+    stream->last_order = record->order;
+    log->bytes += msg->data_size;
+    ++log->records_num;
+
+    // Keep at least the new record even if it exceeds the bound alone.
+    while (log->bytes > log->max_bytes && log->bytes > msg->data_size) {
+        gossip_data_log_evict_oldest(log);
+    }
+    return CLUSTER_ERR_NONE;
+}
 
-    for (int i = 0; i < log->size; ++i) {
-        // Save only the latest data message from each originator.
-        if (log->messages[i].version.member_id == msg->data_version.member_id) {
-            record = &log->messages[i];
-            record->version.sequence_number = msg->data_version.sequence_number;
-            break;
+/* Returns the last sequence number of the originator up to which
+ * all messages have arrived. A gap which isn't filled within
+ * DATA_LOG_GAP_TIMEOUT is skipped, since the missing messages have
+ * most likely been dropped from the logs of other members too. */
+static uint32_t gossip_data_log_delivered(data_log_t *log, data_log_stream_t *stream, uint64_t current_ts) {
+    uint32_t seq = gossip_data_log_window_start(log, stream) - 1;
+    if (stream->delivered > seq) seq = stream->delivered;
+    while (seq < stream->latest && gossip_data_log_record(log, stream, seq + 1) != NULL) ++seq;
+
+    if (seq < stream->latest) {
+        if (stream->gap_edge != seq || stream->gap_ts == 0) {
+            stream->gap_edge = seq;
+            stream->gap_ts = current_ts;
+        } else if (current_ts - stream->gap_ts >= DATA_LOG_GAP_TIMEOUT) {
+            ++seq;
+            while (seq < stream->latest && gossip_data_log_record(log, stream, seq) == NULL) ++seq;
+            while (seq < stream->latest && gossip_data_log_record(log, stream, seq + 1) != NULL) ++seq;
+            stream->gap_edge = seq;
+            stream->gap_ts = current_ts;
         }
     }
+    stream->delivered = seq;
+    return seq;
+}
 
-    if (record == NULL) {
-        // The data message with the same originator was not found.
-        uint32_t new_idx = log->current_idx;
-        record = &log->messages[new_idx];
-        vector_clock_record_copy(&record->version, &msg->data_version);
+/* The types of the records in the persistent data log. */
+static const uint8_t GOSSIP_JOURNAL_DATA = 1;
+static const uint8_t GOSSIP_JOURNAL_VERSION = 2;
+/* The member ID and the sequence number preceding the payload of a data record. */
+#define GOSSIP_JOURNAL_DATA_HEADER_SIZE (sizeof(member_id_t) + sizeof(uint32_t))
+
+static int gossip_journal_data(cluster_journal_t *journal, const vector_record_t *version,
+                               const uint8_t *data, uint32_t data_size) {
+    uint8_t header[GOSSIP_JOURNAL_DATA_HEADER_SIZE];
+    uint64_encode(version->member_id, header);
+    uint32_encode(version->sequence_number, header + sizeof(member_id_t));
+    return cluster_journal_append(journal, GOSSIP_JOURNAL_DATA, header, sizeof(header), data, data_size);
+}
+
+static int gossip_journal_version(cluster_journal_t *journal, const vector_clock_t *version) {
+    size_t encoded_size = vector_clock_encoded_size(version);
+    uint8_t *encoded = (uint8_t *) malloc(encoded_size);
+    if (encoded == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+    int result = vector_clock_encode(version, encoded, encoded_size);
+    if (result >= 0) result = cluster_journal_append(journal, GOSSIP_JOURNAL_VERSION, encoded, result, NULL, 0);
+    free(encoded);
+    return result;
+}
 
-        if (log->size < DATA_LOG_SIZE) ++log->size;
-        if (++log->current_idx >= DATA_LOG_SIZE) log->current_idx = 0;
+static int gossip_data_log_record_order_cmp(const void *first, const void *second) {
+    uint64_t first_order = (*(const data_log_record_t * const *) first)->order;
+    uint64_t second_order = (*(const data_log_record_t * const *) second)->order;
+    return first_order < second_order ? -1 : (first_order > second_order ? 1 : 0);
+}
+
+/* Rewrites the journal with the data version followed by the logged
+ * records in the order they arrived, so that a replay reproduces the log. */
+static int gossip_journal_compact(cluster_journal_t *journal, const data_log_t *log, const vector_clock_t *version) {
+    size_t records_num = 0;
+    data_log_record_t **records = (data_log_record_t **) malloc((size_t) log->capacity * log->depth *
+                                                                sizeof(data_log_record_t *));
+    if (records == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+    for (size_t i = 0; i < (size_t) log->size * log->depth; ++i) {
+        if (log->storage[i].sequence_number != 0) records[records_num++] = &log->storage[i];
     }
-    record->data_size = msg->data_size;
-    memcpy(record->data, msg->data, msg->data_size);
+    qsort(records, records_num, sizeof(data_log_record_t *), gossip_data_log_record_order_cmp);
+
+    cluster_journal_t compacted;
+    int result = cluster_journal_compact_begin(journal, &compacted);
+    if (result == CLUSTER_ERR_NONE) {
+        result = gossip_journal_version(&compacted, version);
+        for (size_t i = 0; i < records_num && result == CLUSTER_ERR_NONE; ++i) {
+            // Records of each stream occupy a contiguous range of the storage.
+            const data_log_stream_t *stream = &log->streams[(records[i] - log->storage) / log->depth];
+            vector_record_t record_version = {.member_id = stream->member_id,
+                                              .sequence_number = records[i]->sequence_number};
+            result = gossip_journal_data(&compacted, &record_version, records[i]->data, records[i]->data_size);
+        }
+        if (result == CLUSTER_ERR_NONE) {
+            result = cluster_journal_compact_end(journal, &compacted);
+        } else {
+            unlink(compacted.path);
+            cluster_journal_close(&compacted);
+        }
+    }
+    free(records);
+    return result;
+}
 
+static int gossip_journal_replay_record(void *context, uint8_t type,
+                                        const uint8_t *payload, size_t payload_size) {
+    cluster_gossip_t *self = (cluster_gossip_t *) context;
+    if (type == GOSSIP_JOURNAL_DATA) {
+        if (payload_size < GOSSIP_JOURNAL_DATA_HEADER_SIZE) return CLUSTER_ERR_NONE;
+        message_data_t msg;
+        msg.data_version.member_id = uint64_decode(payload);
+        msg.data_version.sequence_number = uint32_decode(payload + sizeof(member_id_t));
+        msg.data = (uint8_t *) payload + GOSSIP_JOURNAL_DATA_HEADER_SIZE;
+        msg.data_size = payload_size - GOSSIP_JOURNAL_DATA_HEADER_SIZE;
+        int result = gossip_data_log(&self->data_log, &msg);
+        return result == CLUSTER_ERR_ALLOCATION_FAILED ? result : CLUSTER_ERR_NONE;
+    }
+    if (type == GOSSIP_JOURNAL_VERSION) {
+        // The latest persisted version wins.
+        vector_clock_t version;
+        if (vector_clock_decode(payload, payload_size, &version) < 0) return CLUSTER_ERR_NONE;
+        int result = vector_clock_copy(&self->data_version, &version);
+        vector_clock_destroy(&version);
+        return result < 0 ? result : CLUSTER_ERR_NONE;
+    }
+    // Records of unknown types are skipped.
     return CLUSTER_ERR_NONE;
 }
 
+/* Restores the data log and the data version persisted by the previous
+ * run. The restored messages aren't passed to the data receiver again. */
+static int gossip_journal_open(cluster_gossip_t *self) {
+    vector_clock_init(&self->journal_version);
+    self->journal_synced_tail = 0;
+    if (self->config.data_log_path == NULL) return CLUSTER_ERR_NONE;
+
+    self->journal = (cluster_journal_t *) malloc(sizeof(cluster_journal_t));
+    if (self->journal == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+    int result = cluster_journal_open(self->journal, self->config.data_log_path);
+    if (result == CLUSTER_ERR_NONE) {
+        result = cluster_journal_replay(self->journal, gossip_journal_replay_record, self);
+    }
+    if (result == CLUSTER_ERR_NONE) {
+        result = vector_clock_copy(&self->journal_version, &self->data_version);
+        self->journal_synced_tail = self->journal->tail;
+    }
+    if (result < 0) {
+        cluster_journal_close(self->journal);
+        free(self->journal);
+        self->journal = NULL;
+    }
+    return result;
+}
+
+static void gossip_journal_append_data(cluster_gossip_t *self, const message_data_t *msg) {
+    if (self->journal == NULL) return;
+    // The node keeps working from memory if the log can't be written.
+    int result = gossip_journal_data(self->journal, &msg->data_version, msg->data, msg->data_size);
+    if (result < 0) log_warn("Failed to persist a data message: %d", result);
+}
+
+/* Persists the data version if it has changed since the last time and
+ * compacts the journal once obsolete records take most of it. Nothing
+ * is done unless the journal has grown since the last sync. */
+static int gossip_journal_tick(cluster_gossip_t *self) {
+    if (self->journal == NULL) return CLUSTER_ERR_NONE;
+    if (vector_clock_compare(&self->journal_version, &self->data_version, CLUSTER_FALSE) != VC_EQUAL) {
+        int result = gossip_journal_version(self->journal, &self->data_version);
+        if (result < 0) return result;
+        result = vector_clock_copy(&self->journal_version, &self->data_version);
+        if (result < 0) return result;
+    }
+    if (self->journal->tail == self->journal_synced_tail) return CLUSTER_ERR_NONE;
+
+    if (self->journal->tail >= DATA_LOG_COMPACT_SIZE) {
+        const data_log_t *log = &self->data_log;
+        size_t live_size = CLUSTER_JOURNAL_FRAME_SIZE + vector_clock_encoded_size(&self->data_version) +
+                           log->bytes + log->records_num * (CLUSTER_JOURNAL_FRAME_SIZE + GOSSIP_JOURNAL_DATA_HEADER_SIZE);
+        if (self->journal->tail > 2 * live_size) {
+            int result = gossip_journal_compact(self->journal, log, &self->data_version);
+            if (result < 0) return result;
+        }
+    }
+    int result = cluster_journal_sync(self->journal);
+    if (result == CLUSTER_ERR_NONE) self->journal_synced_tail = self->journal->tail;
+    return result;
+}
+
+static void gossip_journal_close(cluster_gossip_t *self) {
+    if (self->journal != NULL) {
+        // A restart resumes from the latest data version.
+        int result = gossip_journal_tick(self);
+        if (result < 0) log_warn("Failed to persist the data log: %d", result);
+        cluster_journal_close(self->journal);
+        free(self->journal);
+        self->journal = NULL;
+    }
+    vector_clock_destroy(&self->journal_version);
+}
+
+static void gossip_member_snapshot(cluster_gossip_t *self) {
+    int result = cluster_member_snapshot_write(&self->members, self->member_snapshot_path);
+    if (result < 0) log_warn("Failed to save the member snapshot: %d", result);
+}
+
 static message_envelope_out_t *gossip_envelope_create(
+        message_queue_t *queue,
         uint32_t sequence_number,
-        const uint8_t *buffer, size_t buffer_size,
+        const uint8_t *buffer, size_t buffer_size, uint32_t buffer_slot,
         uint16_t max_attempts,
         const cluster_sockaddr_storage *recipient, cluster_socklen_t recipient_len) {
-    message_envelope_out_t *envelope = (message_envelope_out_t *)malloc(sizeof(message_envelope_out_t));
+    message_envelope_out_t *envelope = (message_envelope_out_t *)cluster_pool_alloc(&queue->pool);
     if (envelope == NULL) return NULL;
 
     envelope->sequence_num = sequence_number;
@@ -126,15 +669,131 @@ static message_envelope_out_t *gossip_envelope_create(
     envelope->attempt_ts = 0;
     envelope->buffer = buffer;
     envelope->buffer_size = buffer_size;
+    envelope->buffer_slot = buffer_slot;
     memcpy(&envelope->recipient, recipient, recipient_len);
     envelope->recipient_len = recipient_len;
     envelope->max_attempts = max_attempts;
+    cluster_timer_init(&envelope->retry_timer, envelope);
 
     return envelope;
 }
 
-static void gossip_envelope_destroy(message_envelope_out_t *envelope) {
-    free(envelope);
+static void gossip_envelope_destroy(message_queue_t *queue, message_envelope_out_t *envelope) {
+    cluster_pool_free(&queue->pool, envelope);
+}
+
+static inline uint32_t gossip_envelope_index_slot(uint32_t sequence_num, uint32_t capacity) {
+    // Fibonacci hashing. The capacity is always a power of 2.
+    return (sequence_num * 2654435761U) & (capacity - 1);
+}
+
+static void gossip_envelope_index_insert(message_envelope_out_t **index, uint32_t capacity,
+                                         message_envelope_out_t *envelope) {
+    uint32_t slot = gossip_envelope_index_slot(envelope->sequence_num, capacity);
+    while (index[slot] != NULL) slot = (slot + 1) & (capacity - 1);
+    index[slot] = envelope;
+}
+
+static int gossip_envelope_index_extend(message_queue_t *queue, uint32_t required_size) {
+    uint32_t new_capacity = queue->index_capacity;
+    while (required_size >= new_capacity * QUEUE_INDEX_LOAD_FACTOR) new_capacity *= QUEUE_INDEX_EXTENSION_FACTOR;
+
+    message_envelope_out_t **new_index =
+            (message_envelope_out_t **) calloc(new_capacity, sizeof(message_envelope_out_t *));
+    if (new_index == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+
+    for (int i = 0; i < queue->index_capacity; ++i) {
+        if (queue->index[i] != NULL) {
+            gossip_envelope_index_insert(new_index, new_capacity, queue->index[i]);
+        }
+    }
+    free(queue->index);
+    queue->index = new_index;
+    queue->index_capacity = new_capacity;
+    return CLUSTER_ERR_NONE;
+}
+
+static void gossip_envelope_index_delete(message_queue_t *queue, message_envelope_out_t *envelope) {
+    uint32_t mask = queue->index_capacity - 1;
+    uint32_t slot = gossip_envelope_index_slot(envelope->sequence_num, queue->index_capacity);
+    while (queue->index[slot] != envelope) {
+        if (queue->index[slot] == NULL) return;
+        slot = (slot + 1) & mask;
+    }
+    queue->index[slot] = NULL;
+    --queue->index_size;
+
+    // Shift back the following entries of the same cluster so that
+    // lookups never stop at the freed slot.
+    uint32_t next = slot;
+    while (1) {
+        next = (next + 1) & mask;
+        message_envelope_out_t *candidate = queue->index[next];
+        if (candidate == NULL) break;
+        uint32_t home = gossip_envelope_index_slot(candidate->sequence_num, queue->index_capacity);
+        cluster_bool_t stays = (slot <= next) ? (slot < home && home <= next)
+                                              : (slot < home || home <= next);
+        if (!stays) {
+            queue->index[slot] = candidate;
+            queue->index[next] = NULL;
+            slot = next;
+        }
+    }
+}
+
+static void gossip_output_slot_acquire(message_queue_t *queue, uint32_t slot) {
+    if (queue->slot_refs[slot]++ == 0) queue->slot_bitmap[slot / 64] |= (1ULL << (slot % 64));
+}
+
+static void gossip_output_slot_release(message_queue_t *queue, uint32_t slot) {
+    if (--queue->slot_refs[slot] == 0) queue->slot_bitmap[slot / 64] &= ~(1ULL << (slot % 64));
+}
+
+static int gossip_output_slot_find_free(const message_queue_t *queue) {
+    for (int i = 0; i < OUTPUT_SLOT_WORDS(queue->slots_num); ++i) {
+        uint64_t free_slots = ~queue->slot_bitmap[i];
+        if (free_slots != 0) {
+            int slot = i * 64 + __builtin_ctzll(free_slots);
+            return slot < queue->slots_num ? slot : CLUSTER_ERR_NOT_FOUND;
+        }
+    }
+    return CLUSTER_ERR_NOT_FOUND;
+}
+
+static int gossip_queue_init(message_queue_t *queue, uint32_t slots_num) {
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->slots_num = slots_num;
+    queue->slot_refs = (uint32_t *) calloc(slots_num, sizeof(uint32_t));
+    queue->slot_bitmap = (uint64_t *) calloc(OUTPUT_SLOT_WORDS(slots_num), sizeof(uint64_t));
+    if (queue->slot_refs == NULL || queue->slot_bitmap == NULL) {
+        free(queue->slot_refs);
+        free(queue->slot_bitmap);
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    }
+    queue->index = (message_envelope_out_t **) calloc(QUEUE_INDEX_INITIAL_CAPACITY,
+                                                      sizeof(message_envelope_out_t *));
+    if (queue->index == NULL) {
+        free(queue->slot_refs);
+        free(queue->slot_bitmap);
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    }
+    queue->index_size = 0;
+    queue->index_capacity = QUEUE_INDEX_INITIAL_CAPACITY;
+    if (cluster_timer_heap_init(&queue->due) < 0) {
+        free(queue->index);
+        free(queue->slot_refs);
+        free(queue->slot_bitmap);
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    }
+    if (cluster_pool_init(&queue->pool, sizeof(message_envelope_out_t), ENVELOPE_POOL_CHUNK_SIZE, 0) < 0) {
+        cluster_timer_heap_destroy(&queue->due);
+        free(queue->index);
+        free(queue->slot_refs);
+        free(queue->slot_bitmap);
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    }
+    return CLUSTER_ERR_NONE;
 }
 
 static void gossip_envelope_clear(message_queue_t *queue) {
@@ -142,13 +801,42 @@ static void gossip_envelope_clear(message_queue_t *queue) {
     while (head != NULL) {
         message_envelope_out_t *current = head;
         head = head->next;
-        gossip_envelope_destroy(current);
+        cluster_timer_heap_cancel(&queue->due, &current->retry_timer);
+        gossip_envelope_destroy(queue, current);
     }
     queue->head = NULL;
     queue->tail = NULL;
+    memset(queue->index, 0, queue->index_capacity * sizeof(message_envelope_out_t *));
+    queue->index_size = 0;
+    memset(queue->slot_refs, 0, queue->slots_num * sizeof(uint32_t));
+    memset(queue->slot_bitmap, 0, OUTPUT_SLOT_WORDS(queue->slots_num) * sizeof(uint64_t));
+}
+
+static void gossip_queue_destroy(message_queue_t *queue) {
+    gossip_envelope_clear(queue);
+    cluster_pool_destroy(&queue->pool);
+    cluster_timer_heap_destroy(&queue->due);
+    free(queue->index);
+    free(queue->slot_refs);
+    free(queue->slot_bitmap);
+    queue->index = NULL;
+    queue->slot_refs = NULL;
+    queue->slot_bitmap = NULL;
 }
 
 static int gossip_envelope_enqueue(message_queue_t *queue, message_envelope_out_t *envelope) {
+    uint32_t new_size = queue->index_size + 1;
+    if (new_size >= queue->index_capacity * QUEUE_INDEX_LOAD_FACTOR) {
+        int result = gossip_envelope_index_extend(queue, new_size);
+        if (result < 0) return result;
+    }
+    // A new message is due immediately.
+    int result = cluster_timer_heap_schedule(&queue->due, &envelope->retry_timer, 0);
+    if (result < 0) return result;
+    gossip_envelope_index_insert(queue->index, queue->index_capacity, envelope);
+    queue->index_size = new_size;
+    gossip_output_slot_acquire(queue, envelope->buffer_slot);
+
     envelope->next = NULL;
     if (queue->head == NULL || queue->tail == NULL) {
         queue->head = envelope;
@@ -162,6 +850,10 @@ static int gossip_envelope_enqueue(message_queue_t *queue, message_envelope_out_
 }
 
 static int gossip_envelope_remove(message_queue_t *queue, message_envelope_out_t *envelope) {
+    gossip_envelope_index_delete(queue, envelope);
+    cluster_timer_heap_cancel(&queue->due, &envelope->retry_timer);
+    gossip_output_slot_release(queue, envelope->buffer_slot);
+
     message_envelope_out_t *prev = envelope->prev;
     message_envelope_out_t *next = envelope->next;
     if (next != NULL) {
@@ -174,60 +866,47 @@ static int gossip_envelope_remove(message_queue_t *queue, message_envelope_out_t
     } else {
         queue->head = next;
     }
-    gossip_envelope_destroy(envelope);
+    gossip_envelope_destroy(queue, envelope);
     return CLUSTER_ERR_NONE;
 }
 
 static message_envelope_out_t *
 gossip_envelope_find_by_sequence_num(message_queue_t *queue, uint32_t sequence_num) {
-    message_envelope_out_t *head = queue->head;
-    while (head != NULL) {
-        if (head->sequence_num == sequence_num) return head;
-        head = head->next;
+    uint32_t mask = queue->index_capacity - 1;
+    uint32_t slot = gossip_envelope_index_slot(sequence_num, queue->index_capacity);
+    while (queue->index[slot] != NULL) {
+        if (queue->index[slot]->sequence_num == sequence_num) return queue->index[slot];
+        slot = (slot + 1) & mask;
     }
     return NULL;
 }
 
-static const uint8_t *gossip_find_available_output_buffer(cluster_gossip_t *self) {
-    cluster_bool_t buffer_is_occupied[MAX_OUTPUT_MESSAGES];
-    memset(buffer_is_occupied, 0, MAX_OUTPUT_MESSAGES * sizeof(cluster_bool_t));
-
-    message_envelope_out_t *oldest_envelope = NULL;
-    message_envelope_out_t *head = self->outbound_messages.head;
-    while (head != NULL) {
-        if (oldest_envelope == NULL || head->attempt_num > oldest_envelope->attempt_num) {
-            oldest_envelope = head;
-        }
-        const uint8_t *buffer = head->buffer;
-        uint32_t index = (buffer - self->output_buffer) / MESSAGE_MAX_SIZE;
-        buffer_is_occupied[index] = CLUSTER_TRUE;
-
-        head = head->next;
-    }
+static uint32_t gossip_find_available_output_slot(cluster_gossip_t *self) {
+    message_queue_t *queue = &self->outbound_messages;
 
     // Looking for a buffer that is not used by any message in the outbound queue.
-    for (int i = 0; i < MAX_OUTPUT_MESSAGES; ++i) {
-        if (!buffer_is_occupied[i])
-            return self->output_buffer + (i * MESSAGE_MAX_SIZE);
-    }
+    int free_slot = gossip_output_slot_find_free(queue);
+    if (free_slot >= 0) return free_slot;
 
     // No available buffers were found. Removing the oldest message in a queue
     // to overwrite its buffer.
-    const uint8_t *chosen_buffer = oldest_envelope->buffer;
-    while (oldest_envelope != NULL && oldest_envelope->buffer == chosen_buffer) {
+    message_envelope_out_t *oldest_envelope = queue->head;
+    for (message_envelope_out_t *head = queue->head; head != NULL; head = head->next) {
+        if (head->attempt_num > oldest_envelope->attempt_num) oldest_envelope = head;
+    }
+    uint32_t chosen_slot = oldest_envelope->buffer_slot;
+    message_envelope_out_t *head = queue->head;
+    while (head != NULL && queue->slot_refs[chosen_slot] > 0) {
         // Remove all messages that share the same buffer's region.
-        message_envelope_out_t *to_remove = oldest_envelope;
-        oldest_envelope = oldest_envelope->next;
-        gossip_envelope_remove(&self->outbound_messages, to_remove);
+        message_envelope_out_t *to_remove = head;
+        head = head->next;
+        if (to_remove->buffer_slot == chosen_slot) gossip_envelope_remove(queue, to_remove);
     }
-    return chosen_buffer;
+    return chosen_slot;
 }
 
 static uint32_t gossip_update_output_buffer_offset(cluster_gossip_t *self) {
-    uint32_t offset = 0;
-    if (self->outbound_messages.head != NULL) {
-        offset = gossip_find_available_output_buffer(self) - self->output_buffer;
-    }
+    uint32_t offset = gossip_find_available_output_slot(self) * self->config.message_max_size;
     self->output_buffer_offset = offset;
     return offset;
 }
@@ -239,13 +918,16 @@ static int gossip_enqueue_to_outbound(cluster_gossip_t *self,
                                       const cluster_sockaddr_storage *receiver,
                                       cluster_socklen_t receiver_size) {
     uint32_t seq_num = ++self->sequence_num;
-    message_envelope_out_t *new_envelope = gossip_envelope_create(seq_num,
-                                                                  buffer, buffer_size,
+    uint32_t buffer_slot = (buffer - self->output_buffer) / self->config.message_max_size;
+    message_envelope_out_t *new_envelope = gossip_envelope_create(&self->outbound_messages,
+                                                                  seq_num,
+                                                                  buffer, buffer_size, buffer_slot,
                                                                   max_attempts,
                                                                   receiver, receiver_size);
     if (new_envelope == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
-    gossip_envelope_enqueue(&self->outbound_messages, new_envelope);
-    return CLUSTER_ERR_NONE;
+    int result = gossip_envelope_enqueue(&self->outbound_messages, new_envelope);
+    if (result < 0) gossip_envelope_destroy(&self->outbound_messages, new_envelope);
+    return result;
 }
 
 typedef enum gossip_spreading_type {
@@ -254,40 +936,122 @@ typedef enum gossip_spreading_type {
     GOSSIP_BROADCAST = 2
 } gossip_spreading_type_t;
 
-static int gossip_encode_message(uint8_t msg_type, const void *msg, uint8_t *buffer, uint16_t *max_attempts) {
-    *max_attempts = MESSAGE_RETRY_ATTEMPTS;
+/* Returns the largest message which is sent to the member. Members that
+ * haven't advertised their datagram size, as well as messages shared by
+ * several recipients (NULL member), are limited to MESSAGE_LEGACY_MAX_SIZE. */
+static size_t gossip_member_max_size(const cluster_gossip_t *self, const cluster_member_t *member) {
+    size_t max_size = member != NULL && member->max_message_size != 0 ?
+                      member->max_message_size : MESSAGE_LEGACY_MAX_SIZE;
+    return max_size < self->config.message_max_size ? max_size : self->config.message_max_size;
+}
+
+static size_t gossip_recipient_max_size(cluster_gossip_t *self,
+                                        const cluster_sockaddr_storage *recipient,
+                                        cluster_socklen_t recipient_len) {
+    return gossip_member_max_size(self, cluster_member_set_find_by_addr(&self->members, recipient, recipient_len));
+}
+
+static int gossip_encode_message(const cluster_gossip_config_t *config, uint8_t msg_type,
+                                 const void *msg, uint8_t *buffer, size_t buffer_size,
+                                 uint16_t *max_attempts) {
+    *max_attempts = config->retry_attempts;
     int encode_result = 0;
     // Serialize the message.
     switch (msg_type) {
     case MESSAGE_HELLO_TYPE:
         encode_result = message_hello_encode((const message_hello_t*)msg, 
-                                            buffer, MESSAGE_MAX_SIZE);
+                                            buffer, buffer_size);
         break;
     case MESSAGE_WELCOME_TYPE:
         encode_result = message_welcome_encode((const message_welcome_t*)msg, 
-                                                buffer, MESSAGE_MAX_SIZE);
+                                                buffer, buffer_size);
         // Welcome message can't be acknowledged. It should be removed from the
         // outbound queue after the first attempt.
         *max_attempts = 1;
         break;
     case MESSAGE_MEMBER_LIST_TYPE:
         encode_result = message_member_list_encode((const message_member_list_t *)msg,
-                                                    buffer, MESSAGE_MAX_SIZE);
+                                                    buffer, buffer_size);
         break;
     case MESSAGE_DATA_TYPE:
         encode_result = message_data_encode((const message_data_t *)msg,
-                                            buffer, MESSAGE_MAX_SIZE);
+                                            buffer, buffer_size);
+        // Losses on the broadcast tree are repaired with Graft.
+        if (((const message_data_t *)msg)->header.flags & MESSAGE_FLAG_EAGER_PUSH) *max_attempts = 1;
         break;
     case MESSAGE_ACK_TYPE:
         encode_result = message_ack_encode((const message_ack_t *)msg,
-                                            buffer, MESSAGE_MAX_SIZE);
+                                            buffer, buffer_size);
         // ACK message can't be acknowledged. It should be removed from the
         // outbound queue after the first attempt.
         *max_attempts = 1;
         break;
     case MESSAGE_STATUS_TYPE:
         encode_result = message_status_encode((const message_status_t *)msg,
-                                               buffer, MESSAGE_MAX_SIZE);
+                                               buffer, buffer_size);
+        break;
+    // Probes are never retried. A lost probe is handled by the failure detector.
+    case MESSAGE_PING_TYPE:
+        encode_result = message_ping_encode((const message_ping_t *)msg,
+                                            buffer, buffer_size);
+        *max_attempts = 1;
+        break;
+    case MESSAGE_PING_REQ_TYPE:
+        encode_result = message_ping_req_encode((const message_ping_req_t *)msg,
+                                                buffer, buffer_size);
+        *max_attempts = 1;
+        break;
+    case MESSAGE_INDIRECT_ACK_TYPE:
+        encode_result = message_indirect_ack_encode((const message_indirect_ack_t *)msg,
+                                                    buffer, buffer_size);
+        *max_attempts = 1;
+        break;
+    // A lost digest is compensated by the next synchronization round.
+    case MESSAGE_DIGEST_TYPE:
+        encode_result = message_digest_encode((const message_digest_t *)msg,
+                                              buffer, buffer_size);
+        *max_attempts = 1;
+        break;
+    // The broadcast tree maintenance relies on anti-entropy and
+    // the next announcer rather than on retries.
+    case MESSAGE_IHAVE_TYPE:
+        encode_result = message_ihave_encode((const message_ihave_t *)msg,
+                                             buffer, buffer_size);
+        *max_attempts = 1;
+        break;
+    case MESSAGE_GRAFT_TYPE:
+        encode_result = message_graft_encode((const message_graft_t *)msg,
+                                             buffer, buffer_size);
+        *max_attempts = 1;
+        break;
+    case MESSAGE_PRUNE_TYPE:
+        encode_result = message_prune_encode((const message_prune_t *)msg,
+                                             buffer, buffer_size);
+        *max_attempts = 1;
+        break;
+    // Views are repaired periodically, so a lost message only delays the repair.
+    case MESSAGE_FORWARD_JOIN_TYPE:
+    case MESSAGE_NEIGHBOR_TYPE:
+    case MESSAGE_SHUFFLE_TYPE:
+        encode_result = message_view_encode((const message_view_t *)msg,
+                                            buffer, buffer_size);
+        *max_attempts = 1;
+        break;
+    case MESSAGE_DISCONNECT_TYPE:
+        encode_result = message_disconnect_encode((const message_disconnect_t *)msg,
+                                                  buffer, buffer_size);
+        *max_attempts = 1;
+        break;
+    // Lost fragments are requested again by the member reassembling the payload.
+    case MESSAGE_DATA_FRAGMENT_TYPE:
+        encode_result = message_data_fragment_encode((const message_data_fragment_t *)msg,
+                                                     buffer, buffer_size);
+        *max_attempts = 1;
+        break;
+    case MESSAGE_FRAGMENT_REQUEST_TYPE:
+        encode_result = message_fragment_request_encode((const message_fragment_request_t *)msg,
+                                                        buffer, buffer_size);
+        *max_attempts = 1;
         break;
     default:
         return CLUSTER_ERR_INVALID_MESSAGE;
@@ -304,7 +1068,10 @@ static int gossip_enqueue_message(cluster_gossip_t *self,
     uint32_t offset = gossip_update_output_buffer_offset(self);
     uint8_t *buffer = self->output_buffer + offset;
     uint16_t max_attempts = 0;
-    int encode_result = gossip_encode_message(msg_type, msg, buffer, &max_attempts);
+    size_t buffer_size = spreading_type == GOSSIP_DIRECT ?
+                         gossip_recipient_max_size(self, recipient, recipient_len) :
+                         gossip_member_max_size(self, NULL);
+    int encode_result = gossip_encode_message(&self->config, msg_type, msg, buffer, buffer_size, &max_attempts);
     if (encode_result < 0) return encode_result;
 
     int result = CLUSTER_ERR_NONE;
@@ -316,14 +1083,17 @@ static int gossip_enqueue_message(cluster_gossip_t *self,
                                               recipient, recipient_len);
         case GOSSIP_RANDOM: {
             // Choose some number of random members to distribute the message.
-            cluster_member_t *reservoir[MESSAGE_RUMOR_FACTOR];
+            cluster_member_t **reservoir = self->reservoir;
             int receivers_num = cluster_member_set_random_members(&self->members,
-                                                                  reservoir, MESSAGE_RUMOR_FACTOR);
+                                                                  reservoir, self->config.rumor_factor);
             for (int i = 0; i < receivers_num; ++i) {
                 // Create a new envelope for each recipient.
                 // Note: all created envelopes share the same buffer.
+                cluster_sockaddr_storage member_addr;
+                cluster_socklen_t member_addr_len = cluster_member_addr_to_sockaddr(&reservoir[i]->address,
+                                                                                    &member_addr);
                 result = gossip_enqueue_to_outbound(self, buffer, encode_result, max_attempts,
-                                                    reservoir[i]->address, reservoir[i]->address_len);
+                                                    &member_addr, member_addr_len);
                 if (result < 0) return result;
             }
             break;
@@ -333,9 +1103,11 @@ static int gossip_enqueue_message(cluster_gossip_t *self,
             for (int i = 0; i < self->members.size; ++i) {
                 // Create a new envelope for each recipient.
                 // Note: all created envelopes share the same buffer.
-                cluster_member_t *member = self->members.set[i];
+                cluster_sockaddr_storage member_addr;
+                cluster_socklen_t member_addr_len = cluster_member_addr_to_sockaddr(&self->members.set[i].address,
+                                                                                    &member_addr);
                 result = gossip_enqueue_to_outbound(self, buffer, encode_result, max_attempts,
-                                                    member->address, member->address_len);
+                                                    &member_addr, member_addr_len);
                 if (result < 0) return result;
             }
             break;
@@ -361,6 +1133,7 @@ static int gossip_enqueue_welcome(cluster_gossip_t *self,
                                   cluster_socklen_t recipient_len) {
     message_welcome_t welcome_msg;
     message_header_init(&welcome_msg.header, MESSAGE_WELCOME_TYPE, 0);
+    welcome_msg.header.flags = MESSAGE_FLAG_MAX_SIZE;
     welcome_msg.hello_sequence_num = hello_sequence_num;
     welcome_msg.this_member = &self->self_address;
     return gossip_enqueue_message(self, MESSAGE_WELCOME_TYPE, &welcome_msg,
@@ -372,104 +1145,1607 @@ static int gossip_enqueue_hello(cluster_gossip_t *self,
                                 cluster_socklen_t recipient_len) {
     message_hello_t hello_msg;
     message_header_init(&hello_msg.header, MESSAGE_HELLO_TYPE, 0);
+    // Older members ignore the datagram size following the member.
+    hello_msg.header.flags = MESSAGE_FLAG_MAX_SIZE;
     hello_msg.this_member = &self->self_address;
     return gossip_enqueue_message(self, MESSAGE_HELLO_TYPE, &hello_msg,
                                   recipient, recipient_len, GOSSIP_DIRECT);
 }
 
-static int gossip_enqueue_data(cluster_gossip_t *self,
-                               const uint8_t *data,
-                               uint16_t data_size) {
-    // Update the local data version.
-    uint32_t clock_counter = ++self->data_counter;
-    vector_record_t *record = (vector_record_t*)vector_clock_set(&self->data_version, &self->self_address,
-                                              clock_counter);
-    message_data_t data_msg;
-    message_header_init(&data_msg.header, MESSAGE_DATA_TYPE, 0);
-    vector_clock_record_copy(&data_msg.data_version, record);
-    data_msg.data = (uint8_t *) data;
-    data_msg.data_size = data_size;
+static inline cluster_bool_t gossip_member_supports_plumtree(const cluster_member_t *member) {
+    return member->version >= PROTOCOL_VERSION_PLUMTREE;
+}
+
+static gossip_broadcast_tree_t *gossip_broadcast_tree_find(cluster_gossip_t *self, member_id_t root) {
+    for (uint32_t i = 0; i < self->trees_num; ++i) {
+        if (self->trees[i].root == root) return &self->trees[i];
+    }
+    return NULL;
+}
+
+static int gossip_eager_peer_find(const gossip_broadcast_tree_t *tree, const cluster_member_addr_t *address) {
+    for (uint32_t i = 0; i < tree->eager_peers_num; ++i) {
+        if (cluster_member_addr_equals(&tree->eager_peers[i], address)) return i;
+    }
+    return -1;
+}
+
+static int gossip_eager_peer_add(cluster_gossip_t *self, gossip_broadcast_tree_t *tree,
+                                 const cluster_member_addr_t *address) {
+    if (gossip_eager_peer_find(tree, address) >= 0) return CLUSTER_ERR_NONE;
+    if (tree->eager_peers_num == tree->eager_peers_capacity) {
+        uint32_t new_capacity = tree->eager_peers_capacity == 0 ? self->config.rumor_factor
+                                                                : tree->eager_peers_capacity * 2;
+        cluster_member_addr_t *new_peers = (cluster_member_addr_t *) realloc(tree->eager_peers,
+                                                                             new_capacity * sizeof(cluster_member_addr_t));
+        if (new_peers == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+        tree->eager_peers = new_peers;
+        tree->eager_peers_capacity = new_capacity;
+    }
+    tree->eager_peers[tree->eager_peers_num++] = *address;
+    return CLUSTER_ERR_NONE;
+}
+
+static void gossip_eager_peer_remove(gossip_broadcast_tree_t *tree, const cluster_member_addr_t *address) {
+    int idx = gossip_eager_peer_find(tree, address);
+    if (idx >= 0) tree->eager_peers[idx] = tree->eager_peers[--tree->eager_peers_num];
+}
+
+/* Returns the broadcast tree rooted at the given originator, creating it if
+ * necessary. A new tree starts with random eager peers, and redundant links
+ * are pruned later as duplicates arrive. When the number of trees reaches
+ * the data log size, the least recently used one is reused. */
+static gossip_broadcast_tree_t *gossip_broadcast_tree_get(cluster_gossip_t *self, member_id_t root) {
+    gossip_broadcast_tree_t *tree = gossip_broadcast_tree_find(self, root);
+    if (tree != NULL) {
+        tree->last_used_ts = cluster_time();
+        return tree;
+    }
+
+    if (self->trees_num < self->config.data_log_size) {
+        if (self->trees_num == self->trees_capacity) {
+            uint32_t new_capacity = self->trees_capacity == 0 ? 4 : self->trees_capacity * 2;
+            if (new_capacity > self->config.data_log_size) new_capacity = self->config.data_log_size;
+            gossip_broadcast_tree_t *new_trees = (gossip_broadcast_tree_t *) realloc(self->trees,
+                                                                                     new_capacity * sizeof(gossip_broadcast_tree_t));
+            if (new_trees == NULL) return NULL;
+            self->trees = new_trees;
+            self->trees_capacity = new_capacity;
+        }
+        tree = &self->trees[self->trees_num++];
+        memset(tree, 0, sizeof(gossip_broadcast_tree_t));
+    } else {
+        tree = &self->trees[0];
+        for (uint32_t i = 1; i < self->trees_num; ++i) {
+            if (self->trees[i].last_used_ts < tree->last_used_ts) tree = &self->trees[i];
+        }
+        tree->eager_peers_num = 0;
+    }
+    tree->root = root;
+    tree->last_used_ts = cluster_time();
+
+    size_t candidates_num = cluster_member_set_random_members(&self->members, self->reservoir,
+                                                              self->config.rumor_factor);
+    for (size_t i = 0; i < candidates_num; ++i) {
+        if (!gossip_member_supports_plumtree(self->reservoir[i])) continue;
+        if (gossip_eager_peer_add(self, tree, &self->reservoir[i]->address) < 0) return NULL;
+    }
+    return tree;
+}
+
+/* Enqueues the already encoded message to the given member unless it's the sender. */
+static int gossip_enqueue_encoded(cluster_gossip_t *self, const uint8_t *buffer, int buffer_size,
+                                  uint16_t max_attempts, const cluster_member_addr_t *recipient,
+                                  const cluster_member_addr_t *sender) {
+    if (sender != NULL && cluster_member_addr_equals(recipient, sender)) return CLUSTER_ERR_NONE;
+    cluster_sockaddr_storage recipient_addr;
+    cluster_socklen_t recipient_addr_len = cluster_member_addr_to_sockaddr(recipient, &recipient_addr);
+    return gossip_enqueue_to_outbound(self, buffer, buffer_size, max_attempts,
+                                      &recipient_addr, recipient_addr_len);
+}
+
+/* Disseminates the Data message along the broadcast tree: the message itself is
+ * pushed to eager peers, while a few random lazy peers only get an announcement.
+ * Members that don't take part in the tree receive the message as a rumor. */
+static int gossip_plumtree_spread(cluster_gossip_t *self, message_data_t *msg,
+                                  const cluster_member_addr_t *sender) {
+    gossip_broadcast_tree_t *tree = gossip_broadcast_tree_get(self, msg->data_version.member_id);
+    if (tree == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+
+    uint16_t max_attempts = 0;
+    uint8_t *buffer = self->output_buffer + gossip_update_output_buffer_offset(self);
+    msg->header.flags |= MESSAGE_FLAG_EAGER_PUSH;
+    int encode_result = gossip_encode_message(&self->config, MESSAGE_DATA_TYPE, msg, buffer,
+                                              gossip_member_max_size(self, NULL), &max_attempts);
+    if (encode_result < 0) return encode_result;
+    uint32_t i = 0;
+    while (i < tree->eager_peers_num) {
+        // Forget peers which have left the cluster.
+        if (cluster_member_set_find(&self->members, &tree->eager_peers[i]) == NULL) {
+            tree->eager_peers[i] = tree->eager_peers[--tree->eager_peers_num];
+            continue;
+        }
+        int result = gossip_enqueue_encoded(self, buffer, encode_result, max_attempts,
+                                            &tree->eager_peers[i], sender);
+        if (result < 0) return result;
+        ++i;
+    }
+
+    size_t candidates_num = cluster_member_set_random_members(&self->members, self->reservoir,
+                                                              self->config.rumor_factor);
+    message_ihave_t ihave_msg;
+    message_header_init(&ihave_msg.header, MESSAGE_IHAVE_TYPE, 0);
+    vector_clock_record_copy(&ihave_msg.data_version, &msg->data_version);
+    buffer = self->output_buffer + gossip_update_output_buffer_offset(self);
+    encode_result = gossip_encode_message(&self->config, MESSAGE_IHAVE_TYPE, &ihave_msg, buffer,
+                                          gossip_member_max_size(self, NULL), &max_attempts);
+    if (encode_result < 0) return encode_result;
+    cluster_bool_t has_legacy = CLUSTER_FALSE;
+    for (size_t j = 0; j < candidates_num; ++j) {
+        const cluster_member_t *member = self->reservoir[j];
+        if (!gossip_member_supports_plumtree(member)) {
+            has_legacy = CLUSTER_TRUE;
+            continue;
+        }
+        if (gossip_eager_peer_find(tree, &member->address) >= 0) continue;
+        int result = gossip_enqueue_encoded(self, buffer, encode_result, max_attempts,
+                                            &member->address, sender);
+        if (result < 0) return result;
+    }
+    if (!has_legacy) return CLUSTER_ERR_NONE;
+
+    msg->header.flags &= ~MESSAGE_FLAG_EAGER_PUSH;
+    buffer = self->output_buffer + gossip_update_output_buffer_offset(self);
+    encode_result = gossip_encode_message(&self->config, MESSAGE_DATA_TYPE, msg, buffer,
+                                          gossip_member_max_size(self, NULL), &max_attempts);
+    if (encode_result < 0) return encode_result;
+    for (size_t j = 0; j < candidates_num; ++j) {
+        if (gossip_member_supports_plumtree(self->reservoir[j])) continue;
+        int result = gossip_enqueue_encoded(self, buffer, encode_result, max_attempts,
+                                            &self->reservoir[j]->address, sender);
+        if (result < 0) return result;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+/* Sends the new Data message further. The sender is NULL
+ * for messages originated by this node. */
+static int gossip_spread_data(cluster_gossip_t *self, message_data_t *msg,
+                              const cluster_member_addr_t *sender) {
+    if (self->config.plumtree) return gossip_plumtree_spread(self, msg, sender);
+    msg->header.flags &= ~MESSAGE_FLAG_EAGER_PUSH;
+    return gossip_enqueue_message(self, MESSAGE_DATA_TYPE, msg, NULL, 0, GOSSIP_RANDOM);
+}
+
+/* Forgets announcements of Data messages which are already delivered. */
+static void gossip_missing_data_clear(cluster_gossip_t *self, const vector_record_t *data_version) {
+    uint32_t i = 0;
+    while (i < self->missing_data_num) {
+        const vector_record_t *missing = &self->missing_data[i].data_version;
+        if (missing->member_id == data_version->member_id &&
+            missing->sequence_number <= data_version->sequence_number) {
+            self->missing_data[i] = self->missing_data[--self->missing_data_num];
+            continue;
+        }
+        ++i;
+    }
+}
+
+static int gossip_enqueue_graft(cluster_gossip_t *self, const vector_record_t *data_version,
+                                const cluster_member_addr_t *recipient) {
+    message_graft_t graft_msg;
+    message_header_init(&graft_msg.header, MESSAGE_GRAFT_TYPE, 0);
+    vector_clock_record_copy(&graft_msg.data_version, data_version);
+    cluster_sockaddr_storage recipient_addr;
+    cluster_socklen_t recipient_addr_len = cluster_member_addr_to_sockaddr(recipient, &recipient_addr);
+    return gossip_enqueue_message(self, MESSAGE_GRAFT_TYPE, &graft_msg,
+                                  &recipient_addr, recipient_addr_len, GOSSIP_DIRECT);
+}
+
+/* Requests Data messages that were announced but didn't arrive in time,
+ * asking each announcer in turn. Grafted announcers become eager peers. */
+static int gossip_missing_data_tick(cluster_gossip_t *self, uint64_t current_ts) {
+    uint32_t i = 0;
+    while (i < self->missing_data_num) {
+        gossip_missing_data_t *missing = &self->missing_data[i];
+        if (missing->deadline > current_ts) {
+            ++i;
+            continue;
+        }
+        if (missing->grafted_num >= missing->announcers_num) {
+            // Out of announcers. Anti-entropy will deliver the message eventually.
+            self->missing_data[i] = self->missing_data[--self->missing_data_num];
+            continue;
+        }
+        const cluster_member_addr_t *announcer = &missing->announcers[missing->grafted_num++];
+        gossip_broadcast_tree_t *tree = gossip_broadcast_tree_get(self, missing->data_version.member_id);
+        if (tree == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+        int result = gossip_eager_peer_add(self, tree, announcer);
+        if (result < 0) return result;
+        result = gossip_enqueue_graft(self, &missing->data_version, announcer);
+        if (result < 0) return result;
+        missing->deadline = current_ts + self->config.ihave_timeout;
+        ++i;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static uint64_t gossip_missing_data_next_deadline(const cluster_gossip_t *self) {
+    uint64_t deadline = UINT64_MAX;
+    for (uint32_t i = 0; i < self->missing_data_num; ++i) {
+        if (self->missing_data[i].deadline < deadline) deadline = self->missing_data[i].deadline;
+    }
+    return deadline;
+}
+
+/* Logs the data message and advances the local version past the messages
+ * which arrived without gaps. The message is new unless it has been seen before. */
+static int gossip_data_accept(cluster_gossip_t *self, const message_data_t *msg, cluster_bool_t *is_new) {
+    // Verify whether we saw the arrived message before. The local version
+    // only covers the messages which arrived without gaps, so a newer one
+    // may have been logged already.
+    vector_clock_comp_res_t res = vector_clock_compare_with_record(&self->data_version,
+                                                                   &msg->data_version, CLUSTER_FALSE);
+    *is_new = res == VC_BEFORE && !gossip_data_log_contains(&self->data_log, &msg->data_version);
+    if (*is_new) {
+        // Add the data to our internal log.
+        int log_result = gossip_data_log(&self->data_log, msg);
+        if (log_result < 0) return log_result;
+        gossip_journal_append_data(self, msg);
+        gossip_missing_data_clear(self, &msg->data_version);
+    }
+    if (res == VC_BEFORE) {
+        // Advance the local version past the messages which arrived without gaps.
+        // Duplicates are accounted for too, as they may let a stale gap be skipped.
+        data_log_stream_t *stream = gossip_data_log_find(&self->data_log, &msg->data_version.member_id);
+        if (stream != NULL) {
+            vector_record_t delivered = {.member_id = stream->member_id,
+                                         .sequence_number = gossip_data_log_delivered(&self->data_log, stream,
+                                                                                      cluster_time())};
+            vector_clock_compare_with_record(&self->data_version, &delivered, CLUSTER_TRUE);
+        }
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static inline cluster_bool_t gossip_member_supports_fragments(const cluster_member_t *member) {
+    return member->version >= PROTOCOL_VERSION_FRAGMENTS;
+}
+
+/* Returns the largest payload which fits into a single Data message. Data
+ * messages are shared by several recipients, so every member must accept them. */
+static size_t gossip_data_max_size(const cluster_gossip_t *self) {
+    return gossip_member_max_size(self, NULL) - sizeof(message_header_t) - VECTOR_RECORD_SIZE - sizeof(uint16_t);
+}
+
+/* Returns the size of fragments sent to the member. The member requests
+ * the rest of the payload in fragments of the same size. */
+static uint16_t gossip_fragment_size(const cluster_gossip_t *self, const cluster_member_t *member) {
+    return gossip_member_max_size(self, member) - MESSAGE_DATA_FRAGMENT_OVERHEAD;
+}
+
+static uint32_t gossip_fragments_num(uint32_t total_size, uint16_t fragment_size) {
+    return total_size / fragment_size + (total_size % fragment_size != 0);
+}
+
+static void gossip_fragment_init(message_data_fragment_t *msg, const vector_record_t *data_version,
+                                 const uint8_t *data, uint32_t total_size,
+                                 uint16_t fragment_size, uint16_t fragment_index) {
+    message_header_init(&msg->header, MESSAGE_DATA_FRAGMENT_TYPE, 0);
+    vector_clock_record_copy(&msg->data_version, data_version);
+    msg->total_size = total_size;
+    msg->fragment_size = fragment_size;
+    msg->fragment_index = fragment_index;
+    uint32_t offset = (uint32_t) fragment_index * fragment_size;
+    msg->data_size = total_size - offset < fragment_size ? total_size - offset : fragment_size;
+    msg->data = (uint8_t *) data + offset;
+}
 
-    // Add the data to our internal log.
-    gossip_data_log(&self->data_log, &data_msg);
+static int gossip_enqueue_fragment(cluster_gossip_t *self, const vector_record_t *data_version,
+                                   const uint8_t *data, uint32_t total_size,
+                                   uint16_t fragment_size, uint16_t fragment_index,
+                                   const cluster_sockaddr_storage *recipient,
+                                   cluster_socklen_t recipient_len) {
+    message_data_fragment_t fragment_msg;
+    gossip_fragment_init(&fragment_msg, data_version, data, total_size, fragment_size, fragment_index);
+    // The fragment size has already been agreed on with the recipient.
+    uint16_t max_attempts = 0;
+    uint8_t *buffer = self->output_buffer + gossip_update_output_buffer_offset(self);
+    int encode_result = gossip_encode_message(&self->config, MESSAGE_DATA_FRAGMENT_TYPE, &fragment_msg,
+                                              buffer, self->config.message_max_size, &max_attempts);
+    if (encode_result < 0) return encode_result;
+    return gossip_enqueue_to_outbound(self, buffer, encode_result, max_attempts, recipient, recipient_len);
+}
+
+/* Announces the payload which doesn't fit into a single message to random
+ * members by sending them its first fragment, cut to the size each of them
+ * accepts. They pull the rest of it from this node. The sender is NULL for
+ * payloads originated by this node. */
+static int gossip_fragment_announce(cluster_gossip_t *self, const message_data_t *msg,
+                                    const cluster_member_addr_t *sender) {
+    size_t candidates_num = cluster_member_set_random_members(&self->members, self->reservoir,
+                                                              self->config.rumor_factor);
+    for (size_t i = 0; i < candidates_num; ++i) {
+        const cluster_member_t *member = self->reservoir[i];
+        if (!gossip_member_supports_fragments(member)) continue;
+        if (sender != NULL && cluster_member_addr_equals(&member->address, sender)) continue;
+        cluster_sockaddr_storage member_addr;
+        cluster_socklen_t member_addr_len = cluster_member_addr_to_sockaddr(&member->address, &member_addr);
+        int result = gossip_enqueue_fragment(self, &msg->data_version, msg->data, msg->data_size,
+                                             gossip_fragment_size(self, member), 0,
+                                             &member_addr, member_addr_len);
+        if (result < 0) return result;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static gossip_reassembly_t *gossip_reassembly_find(cluster_gossip_t *self, const vector_record_t *data_version) {
+    for (uint32_t i = 0; i < self->reassemblies_num; ++i) {
+        const vector_record_t *version = &self->reassemblies[i].data_version;
+        if (version->member_id == data_version->member_id &&
+            version->sequence_number == data_version->sequence_number) {
+            return &self->reassemblies[i];
+        }
+    }
+    return NULL;
+}
+
+static inline cluster_bool_t gossip_reassembly_has(const gossip_reassembly_t *reassembly, uint16_t fragment_index) {
+    return (reassembly->received[fragment_index / 64] & (1ULL << (fragment_index % 64))) != 0;
+}
+
+/* Removes the arrived fragment from the ones in flight. Fragments requested
+ * before it which haven't arrived yet are considered lost. */
+static void gossip_reassembly_acknowledge(gossip_reassembly_t *reassembly, uint16_t fragment_index) {
+    uint16_t pos = 0;
+    while (pos < reassembly->in_flight_num &&
+           reassembly->in_flight[(reassembly->in_flight_head + pos) % DATA_FRAGMENT_WINDOW] != fragment_index) {
+        ++pos;
+    }
+    // Fragments which weren't requested from the current source are ignored.
+    if (pos == reassembly->in_flight_num) return;
+    for (uint16_t i = 0; i < pos; ++i) {
+        uint16_t lost_index = reassembly->in_flight[(reassembly->in_flight_head + i) % DATA_FRAGMENT_WINDOW];
+        if (!gossip_reassembly_has(reassembly, lost_index)) reassembly->lost[reassembly->lost_num++] = lost_index;
+    }
+    reassembly->in_flight_head = (reassembly->in_flight_head + pos + 1) % DATA_FRAGMENT_WINDOW;
+    reassembly->in_flight_num -= pos + 1;
+}
+
+static void gossip_reassembly_remove(cluster_gossip_t *self, gossip_reassembly_t *reassembly) {
+    self->reassembly_bytes -= reassembly->total_size;
+    free(reassembly->data);
+    free(reassembly->received);
+    *reassembly = self->reassemblies[--self->reassemblies_num];
+}
+
+/* Starts reassembling the payload of the arrived fragment. The result is
+ * NULL if the payload doesn't fit into the reassembly buffers. */
+static int gossip_reassembly_start(cluster_gossip_t *self, const message_data_fragment_t *msg,
+                                   uint16_t fragments_num, uint64_t current_ts, gossip_reassembly_t **result) {
+    *result = NULL;
+    if (msg->total_size > self->config.data_reassembly_max_bytes - self->reassembly_bytes) {
+        return CLUSTER_ERR_NONE;
+    }
+    if (self->reassemblies_num == self->reassemblies_capacity) {
+        uint32_t new_capacity = self->reassemblies_capacity == 0 ? 4 : self->reassemblies_capacity * 2;
+        gossip_reassembly_t *new_reassemblies = (gossip_reassembly_t *) realloc(self->reassemblies,
+                                                                                new_capacity * sizeof(gossip_reassembly_t));
+        if (new_reassemblies == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+        self->reassemblies = new_reassemblies;
+        self->reassemblies_capacity = new_capacity;
+    }
+    uint8_t *data = (uint8_t *) malloc(msg->total_size);
+    uint64_t *received = (uint64_t *) calloc((fragments_num + 63) / 64, sizeof(uint64_t));
+    if (data == NULL || received == NULL) {
+        free(data);
+        free(received);
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    }
+
+    gossip_reassembly_t *reassembly = &self->reassemblies[self->reassemblies_num++];
+    memset(reassembly, 0, sizeof(gossip_reassembly_t));
+    vector_clock_record_copy(&reassembly->data_version, &msg->data_version);
+    reassembly->data = data;
+    reassembly->received = received;
+    reassembly->total_size = msg->total_size;
+    reassembly->fragment_size = msg->fragment_size;
+    reassembly->fragments_num = fragments_num;
+    reassembly->deadline = current_ts + DATA_FRAGMENT_TIMEOUT;
+    reassembly->last_progress_ts = current_ts;
+    self->reassembly_bytes += msg->total_size;
+    *result = reassembly;
+    return CLUSTER_ERR_NONE;
+}
+
+/* Requests the lost fragments followed by the next missing ones from the
+ * current source so that at most DATA_FRAGMENT_WINDOW of them are in flight. */
+static int gossip_reassembly_request(cluster_gossip_t *self, gossip_reassembly_t *reassembly,
+                                     uint64_t current_ts) {
+    message_fragment_request_t request_msg;
+    message_header_init(&request_msg.header, MESSAGE_FRAGMENT_REQUEST_TYPE, 0);
+    vector_clock_record_copy(&request_msg.data_version, &reassembly->data_version);
+    request_msg.fragment_size = reassembly->fragment_size;
+    request_msg.fragments_n = 0;
+    while (reassembly->in_flight_num < DATA_FRAGMENT_WINDOW &&
+           request_msg.fragments_n < MESSAGE_FRAGMENT_REQUEST_MAX) {
+        uint16_t fragment_index = 0;
+        if (reassembly->lost_num > 0) {
+            fragment_index = reassembly->lost[--reassembly->lost_num];
+        } else if (reassembly->cursor < reassembly->fragments_num) {
+            fragment_index = reassembly->cursor++;
+        } else {
+            break;
+        }
+        if (gossip_reassembly_has(reassembly, fragment_index)) continue;
+        request_msg.fragments[request_msg.fragments_n++] = fragment_index;
+        reassembly->in_flight[(reassembly->in_flight_head + reassembly->in_flight_num++) % DATA_FRAGMENT_WINDOW] =
+            fragment_index;
+    }
+    if (request_msg.fragments_n == 0) return CLUSTER_ERR_NONE;
+    reassembly->deadline = current_ts + DATA_FRAGMENT_TIMEOUT;
+
+    cluster_sockaddr_storage source_addr;
+    cluster_socklen_t source_addr_len = cluster_member_addr_to_sockaddr(&reassembly->sources[reassembly->source],
+                                                                        &source_addr);
+    return gossip_enqueue_message(self, MESSAGE_FRAGMENT_REQUEST_TYPE, &request_msg,
+                                  &source_addr, source_addr_len, GOSSIP_DIRECT);
+}
+
+/* Drops payloads which stopped receiving fragments, and requests the missing
+ * fragments of stalled ones again, this time from the next source. */
+static int gossip_reassembly_tick(cluster_gossip_t *self, uint64_t current_ts) {
+    uint32_t i = 0;
+    while (i < self->reassemblies_num) {
+        gossip_reassembly_t *reassembly = &self->reassemblies[i];
+        if (current_ts - reassembly->last_progress_ts >= self->config.data_reassembly_timeout) {
+            // The payload is announced again by anti-entropy.
+            gossip_reassembly_remove(self, reassembly);
+            continue;
+        }
+        if (reassembly->deadline <= current_ts) {
+            reassembly->source = (reassembly->source + 1) % reassembly->sources_num;
+            reassembly->cursor = 0;
+            reassembly->in_flight_num = 0;
+            reassembly->lost_num = 0;
+            int result = gossip_reassembly_request(self, reassembly, current_ts);
+            if (result < 0) return result;
+        }
+        ++i;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static uint64_t gossip_reassembly_next_deadline(const cluster_gossip_t *self) {
+    uint64_t deadline = UINT64_MAX;
+    for (uint32_t i = 0; i < self->reassemblies_num; ++i) {
+        const gossip_reassembly_t *reassembly = &self->reassemblies[i];
+        uint64_t expire_ts = reassembly->last_progress_ts + self->config.data_reassembly_timeout;
+        if (reassembly->deadline < deadline) deadline = reassembly->deadline;
+        if (expire_ts < deadline) deadline = expire_ts;
+    }
+    return deadline;
+}
+
+static void gossip_reassemblies_destroy(cluster_gossip_t *self) {
+    for (uint32_t i = 0; i < self->reassemblies_num; ++i) {
+        free(self->reassemblies[i].data);
+        free(self->reassemblies[i].received);
+    }
+    free(self->reassemblies);
+    self->reassemblies = NULL;
+    self->reassemblies_num = 0;
+    self->reassemblies_capacity = 0;
+    self->reassembly_bytes = 0;
+}
+
+static int gossip_enqueue_data(cluster_gossip_t *self,
+                               const uint8_t *data,
+                               uint32_t data_size) {
+    // Update the local data version.
+    uint32_t clock_counter = ++self->data_counter;
+    message_data_t data_msg;
+    int set_result = vector_clock_set(&self->data_version, &self->self_address,
+                                      clock_counter, &data_msg.data_version);
+    if (set_result < 0) return set_result;
+    message_header_init(&data_msg.header, MESSAGE_DATA_TYPE, 0);
+    data_msg.data = (uint8_t *) data;
+    data_msg.data_size = data_size;
+
+    // Add the data to our internal log. Without it the message could be neither
+    // resent by anti-entropy nor served as fragments, so it's not sent at all.
+    int log_result = gossip_data_log(&self->data_log, &data_msg);
+    if (log_result < 0) {
+        --self->data_counter;
+        vector_clock_set(&self->data_version, &self->self_address, self->data_counter, NULL);
+        return log_result;
+    }
+    gossip_journal_append_data(self, &data_msg);
+
+    if (data_size > gossip_data_max_size(self)) return gossip_fragment_announce(self, &data_msg, NULL);
+    return gossip_spread_data(self, &data_msg, NULL);
+}
+
+static gossip_status_peer_t *gossip_status_peer_find(cluster_gossip_t *self, const cluster_member_addr_t *address) {
+    for (uint32_t i = 0; i < self->status_peers_num; ++i) {
+        if (cluster_member_addr_equals(&self->status_peers[i].address, address)) return &self->status_peers[i];
+    }
+    return NULL;
+}
+
+/* Returns the Status state of the peer, reusing the least recently
+ * used one once GOSSIP_STATUS_PEERS peers are tracked. */
+static gossip_status_peer_t *gossip_status_peer_get(cluster_gossip_t *self, const cluster_member_addr_t *address) {
+    gossip_status_peer_t *peer = gossip_status_peer_find(self, address);
+    if (peer == NULL) {
+        if (self->status_peers_num < GOSSIP_STATUS_PEERS) {
+            if (self->status_peers_num == self->status_peers_capacity) {
+                uint32_t new_capacity = self->status_peers_capacity == 0 ? 4 : self->status_peers_capacity * 2;
+                if (new_capacity > GOSSIP_STATUS_PEERS) new_capacity = GOSSIP_STATUS_PEERS;
+                gossip_status_peer_t *new_peers = (gossip_status_peer_t *) realloc(self->status_peers,
+                                                                                   new_capacity * sizeof(gossip_status_peer_t));
+                if (new_peers == NULL) return NULL;
+                self->status_peers = new_peers;
+                self->status_peers_capacity = new_capacity;
+            }
+            peer = &self->status_peers[self->status_peers_num++];
+            memset(peer, 0, sizeof(gossip_status_peer_t));
+        } else {
+            // The clocks of the reused peer keep their records for the new one.
+            peer = &self->status_peers[0];
+            for (uint32_t i = 1; i < self->status_peers_num; ++i) {
+                if (self->status_peers[i].last_used_ts < peer->last_used_ts) peer = &self->status_peers[i];
+            }
+            peer->acked_seq = 0;
+            peer->sent_seq = 0;
+            peer->received_seq[0] = 0;
+            peer->received_seq[1] = 0;
+        }
+        peer->address = *address;
+    }
+    peer->last_used_ts = cluster_time();
+    return peer;
+}
+
+static void gossip_status_peers_destroy(cluster_gossip_t *self) {
+    for (uint32_t i = 0; i < self->status_peers_num; ++i) {
+        gossip_status_peer_t *peer = &self->status_peers[i];
+        vector_clock_destroy(&peer->acked);
+        vector_clock_destroy(&peer->sent);
+        vector_clock_destroy(&peer->received[0]);
+        vector_clock_destroy(&peer->received[1]);
+    }
+    free(self->status_peers);
+    self->status_peers = NULL;
+    self->status_peers_num = 0;
+    self->status_peers_capacity = 0;
+}
+
+/* Makes the acknowledged clock the base of further deltas to the peer. */
+static void gossip_status_peer_handle_ack(cluster_gossip_t *self, const cluster_member_addr_t *sender,
+                                          uint32_t sequence_num) {
+    gossip_status_peer_t *peer = gossip_status_peer_find(self, sender);
+    if (peer == NULL || peer->sent_seq == 0 || peer->sent_seq != sequence_num) return;
+    vector_clock_t previous = peer->acked;
+    peer->acked = peer->sent;
+    peer->sent = previous;
+    peer->acked_seq = peer->sent_seq;
+    peer->sent_seq = 0;
+}
+
+/* Remembers the clock received from the peer as the base of its future deltas. */
+static void gossip_status_peer_receive(gossip_status_peer_t *peer, uint32_t sequence_num,
+                                       const vector_clock_t *clock, int base_slot) {
+    // Retries carry a clock which has been stored already.
+    if (peer->received_seq[0] == sequence_num || peer->received_seq[1] == sequence_num) return;
+    // The sender keeps using the base of this delta until the message is acknowledged.
+    uint8_t slot = base_slot >= 0 ? 1 - base_slot : 1 - peer->received_latest;
+    if (vector_clock_copy(&peer->received[slot], clock) < 0) {
+        peer->received_seq[slot] = 0;
+        return;
+    }
+    peer->received_seq[slot] = sequence_num;
+    peer->received_latest = slot;
+}
+
+/* Enqueues the Status message to a single member. Members which support
+ * deltas get the clock encoded against the last one they have acknowledged,
+ * which shrinks idle gossip to a few bytes. */
+static int gossip_enqueue_status_to(cluster_gossip_t *self, const cluster_member_addr_t *recipient,
+                                    uint16_t flags) {
+    const cluster_member_t *member = cluster_member_set_find(&self->members, recipient);
+    gossip_status_peer_t *peer = NULL;
+    if (member != NULL && member->version >= PROTOCOL_VERSION_DELTA_STATUS) {
+        peer = gossip_status_peer_get(self, recipient);
+    }
+    cluster_sockaddr_storage recipient_addr;
+    cluster_socklen_t recipient_addr_len = cluster_member_addr_to_sockaddr(recipient, &recipient_addr);
+
+    // The message is encoded right away, so it can share the records.
+    message_status_t status_msg;
+    message_header_init(&status_msg.header, MESSAGE_STATUS_TYPE, 0);
+    status_msg.data_version = self->data_version;
+    status_msg.base = NULL;
+    status_msg.base_sequence_num = 0;
+
+    int result = CLUSTER_ERR_INVALID_MESSAGE;
+    if (peer != NULL && peer->acked_seq != 0) {
+        status_msg.header.flags = flags | MESSAGE_FLAG_STATUS_DELTA;
+        status_msg.base = &peer->acked;
+        status_msg.base_sequence_num = peer->acked_seq;
+        result = gossip_enqueue_message(self, MESSAGE_STATUS_TYPE, &status_msg,
+                                        &recipient_addr, recipient_addr_len, GOSSIP_DIRECT);
+    }
+    if (result == CLUSTER_ERR_INVALID_MESSAGE || result == CLUSTER_ERR_BUFFER_NOT_ENOUGH) {
+        // Without a base or once the delta doesn't fit the full clock is sent.
+        // When there are too many originators even the full clock doesn't fit.
+        // The status exchange is skipped rather than truncated, since a partial
+        // clock would look outdated to the recipient.
+        size_t status_size = sizeof(message_header_t) + vector_clock_encoded_size(&self->data_version);
+        if (status_size > gossip_member_max_size(self, member)) return CLUSTER_ERR_NONE;
+        status_msg.header.flags = flags;
+        result = gossip_enqueue_message(self, MESSAGE_STATUS_TYPE, &status_msg,
+                                        &recipient_addr, recipient_addr_len, GOSSIP_DIRECT);
+    }
+    if (result < 0) return result;
+
+    if (peer != NULL) {
+        // A direct message always results in a single envelope.
+        peer->sent_seq = self->sequence_num;
+        if (vector_clock_copy(&peer->sent, &self->data_version) < 0) peer->sent_seq = 0;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_enqueue_status(cluster_gossip_t *self,
+                                 const cluster_sockaddr_storage *recipient,
+                                 cluster_socklen_t recipient_len) {
+    cluster_member_addr_t recipient_addr;
+    if (recipient != NULL) {
+        int result = cluster_member_addr_from_sockaddr(&recipient_addr, recipient, recipient_len);
+        if (result < 0) return result;
+        return gossip_enqueue_status_to(self, &recipient_addr, 0);
+    }
+
+    // Each of the random members gets a clock encoded for it.
+    size_t receivers_num = cluster_member_set_random_members(&self->members, self->reservoir,
+                                                             self->config.rumor_factor);
+    for (size_t i = 0; i < receivers_num; ++i) {
+        recipient_addr = self->reservoir[i]->address;
+        int result = gossip_enqueue_status_to(self, &recipient_addr, 0);
+        if (result < 0) return result;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+/* Returns the flags of the Member List message encoding which
+ * is supported by a member with the given protocol version. */
+static uint16_t gossip_member_list_flags(uint16_t version) {
+    uint16_t flags = 0;
+    if (version >= PROTOCOL_VERSION_COMPACT_MEMBERS) flags |= MESSAGE_FLAG_COMPACT_MEMBERS;
+    if (version >= PROTOCOL_VERSION_LIVENESS) flags |= MESSAGE_FLAG_MEMBER_LIVENESS;
+    if (version >= PROTOCOL_VERSION_DATAGRAM_SIZE) flags |= MESSAGE_FLAG_MEMBER_MAX_SIZE;
+    return flags;
+}
+
+/* Returns the number of members starting from the given one which fit
+ * into a single Member List message of the given size. */
+static uint32_t gossip_member_list_pack(const cluster_member_t *members, uint32_t members_num,
+                                        uint16_t flags, size_t max_size) {
+    size_t capacity = max_size - sizeof(message_header_t) - sizeof(uint16_t);
+    size_t total_size = 0;
+    uint32_t packed = 0;
+    while (packed < members_num && packed < UINT16_MAX) {
+        total_size += message_member_list_member_size(&members[packed], flags);
+        if (total_size > capacity) break;
+        ++packed;
+    }
+    return packed;
+}
+
+static int gossip_enqueue_member_list(cluster_gossip_t *self,
+                                      cluster_member_t *members,
+                                      uint32_t members_num,
+                                      uint16_t flags,
+                                      const cluster_sockaddr_storage *recipient,
+                                      cluster_socklen_t recipient_len) {
+    message_member_list_t member_list_msg;
+    message_header_init(&member_list_msg.header, MESSAGE_MEMBER_LIST_TYPE, 0);
+    member_list_msg.header.flags = flags;
+
+    int result = CLUSTER_ERR_NONE;
+    uint32_t member_idx = 0;
+    size_t max_size = gossip_recipient_max_size(self, recipient, recipient_len);
+    while (member_idx < members_num) {
+        // The list can be pretty big, so we split it into multiple messages.
+        uint32_t to_send = gossip_member_list_pack(&members[member_idx], members_num - member_idx,
+                                                   member_list_msg.header.flags, max_size);
+        if (to_send == 0) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+
+        member_list_msg.members_n = to_send;
+        member_list_msg.members = &members[member_idx];
+        result = gossip_enqueue_message(self, MESSAGE_MEMBER_LIST_TYPE, &member_list_msg,
+                                        recipient, recipient_len, GOSSIP_DIRECT);
+        if (result < 0) return result;
+        member_idx += to_send;
+    }
+    return result;
+}
+
+/* Sends the Member List message to all known members with the protocol
+ * version within [min_version, max_version]. Members are grouped by the
+ * encoding they support and every group shares a single encoded message. */
+static int gossip_broadcast_member_list(cluster_gossip_t *self, message_member_list_t *msg,
+                                        uint16_t min_version, uint16_t max_version) {
+    static const uint16_t encodings[] = {
+        MESSAGE_FLAG_COMPACT_MEMBERS | MESSAGE_FLAG_MEMBER_LIVENESS | MESSAGE_FLAG_MEMBER_MAX_SIZE,
+        MESSAGE_FLAG_COMPACT_MEMBERS | MESSAGE_FLAG_MEMBER_LIVENESS,
+        MESSAGE_FLAG_COMPACT_MEMBERS,
+        0
+    };
+    for (int e = 0; e < sizeof(encodings) / sizeof(encodings[0]); ++e) {
+        cluster_bool_t has_recipients = CLUSTER_FALSE;
+        for (uint32_t i = 0; i < self->members.size && !has_recipients; ++i) {
+            uint16_t version = self->members.set[i].version;
+            has_recipients = version >= min_version && version <= max_version &&
+                             gossip_member_list_flags(version) == encodings[e];
+        }
+        if (!has_recipients) continue;
+
+        msg->header.flags = encodings[e];
+        uint32_t offset = gossip_update_output_buffer_offset(self);
+        uint8_t *buffer = self->output_buffer + offset;
+        uint16_t max_attempts = 0;
+        int encode_result = gossip_encode_message(&self->config, MESSAGE_MEMBER_LIST_TYPE, msg,
+                                                  buffer, gossip_member_max_size(self, NULL), &max_attempts);
+        if (encode_result < 0) return encode_result;
+
+        for (uint32_t i = 0; i < self->members.size; ++i) {
+            const cluster_member_t *member = &self->members.set[i];
+            if (member->version < min_version || member->version > max_version ||
+                gossip_member_list_flags(member->version) != encodings[e]) {
+                continue;
+            }
+            // Note: all created envelopes share the same buffer.
+            cluster_sockaddr_storage member_addr;
+            cluster_socklen_t member_addr_len = cluster_member_addr_to_sockaddr(&member->address,
+                                                                                &member_addr);
+            int result = gossip_enqueue_to_outbound(self, buffer, encode_result, max_attempts,
+                                                    &member_addr, member_addr_len);
+            if (result < 0) return result;
+        }
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static inline cluster_bool_t gossip_member_supports_piggyback(const cluster_member_t *member) {
+    return member->version >= PROTOCOL_VERSION_PIGGYBACK;
+}
+
+static uint32_t gossip_piggyback_limit(const cluster_gossip_t *self) {
+    // Every event is retransmitted mult * ceil(log10(N + 1)) times.
+    uint32_t scale = 1;
+    for (uint32_t n = self->members.size + 1; n >= 10; n /= 10) ++scale;
+    return self->config.piggyback_mult * scale;
+}
+
+/* Queues the membership event for dissemination. A newer event about the same
+ * member replaces the older one. When the buffer is full, the event that has
+ * been sent the most times is dropped. */
+static void gossip_piggyback_add(cluster_gossip_t *self, const cluster_member_t *member) {
+    gossip_piggyback_entry_t *entry = NULL;
+    for (uint32_t i = 0; i < self->piggyback_num && entry == NULL; ++i) {
+        if (cluster_member_addr_equals(&self->piggyback[i].member.address, &member->address)) {
+            entry = &self->piggyback[i];
+        }
+    }
+    if (entry == NULL && self->piggyback_num < GOSSIP_PIGGYBACK_CAPACITY) {
+        entry = &self->piggyback[self->piggyback_num++];
+    }
+    if (entry == NULL) {
+        entry = &self->piggyback[0];
+        for (uint32_t i = 1; i < self->piggyback_num; ++i) {
+            if (self->piggyback[i].transmits > entry->transmits) entry = &self->piggyback[i];
+        }
+    }
+    entry->member = *member;
+    entry->transmits = 0;
+    entry->pending = 0;
+}
+
+/* Writes as many membership events as fit into the buffer, the least sent first,
+ * and stores the indexes of the written entries. Copies in the unsent part of the
+ * batch count as sent, so that datagrams of the same batch carry different events.
+ * Returns the size of the trailer or 0 if there is nothing to piggyback. */
+static size_t gossip_piggyback_encode(cluster_gossip_t *self, uint8_t *buffer, size_t buffer_size,
+                                      uint16_t *entries, uint8_t *entries_num) {
+    *entries_num = 0;
+    if (self->piggyback_num == 0 || buffer_size <= MESSAGE_PIGGYBACK_OVERHEAD) return 0;
+
+    uint8_t *cursor = buffer + sizeof(uint8_t);
+    const uint8_t *members_end = buffer + buffer_size - sizeof(uint16_t);
+    uint8_t members_n = 0;
+    cluster_bool_t is_full = CLUSTER_FALSE;
+    uint32_t level = 0;
+    // Select entries level by level. There are only a few distinct
+    // transmission counts, so this takes a few passes at most.
+    while (!is_full && members_n < UINT8_MAX) {
+        uint32_t next_level = UINT32_MAX;
+        for (uint32_t i = 0; i < self->piggyback_num; ++i) {
+            uint32_t count = self->piggyback[i].transmits + self->piggyback[i].pending;
+            if (count >= level && count < next_level) next_level = count;
+        }
+        if (next_level == UINT32_MAX) break;
+        for (uint32_t i = 0; i < self->piggyback_num && !is_full && members_n < UINT8_MAX; ++i) {
+            const gossip_piggyback_entry_t *entry = &self->piggyback[i];
+            if (entry->transmits + entry->pending != next_level) continue;
+            int encode_result = cluster_member_compact_encode(&entry->member, cursor,
+                                                              members_end - cursor, MEMBER_ENCODE_LIVENESS);
+            if (encode_result < 0) {
+                is_full = CLUSTER_TRUE;
+                break;
+            }
+            cursor += encode_result;
+            entries[members_n++] = i;
+        }
+        level = next_level + 1;
+    }
+    if (members_n == 0) return 0;
+
+    for (uint8_t i = 0; i < members_n; ++i) ++self->piggyback[entries[i]].pending;
+    *entries_num = members_n;
+    *buffer = members_n;
+    uint16_encode(cursor - buffer, cursor);
+    cursor += sizeof(uint16_t);
+    return cursor - buffer;
+}
+
+/* Settles the events piggybacked on a datagram of the batch. Only the
+ * datagrams which have left the socket count as transmissions. */
+static void gossip_piggyback_settle(cluster_gossip_t *self, uint32_t batch_idx, cluster_bool_t is_sent) {
+    for (uint8_t i = 0; i < self->output_piggyback_num[batch_idx]; ++i) {
+        gossip_piggyback_entry_t *entry = &self->piggyback[self->output_piggyback[batch_idx][i]];
+        --entry->pending;
+        if (is_sent) ++entry->transmits;
+    }
+    self->output_piggyback_num[batch_idx] = 0;
+}
+
+/* Forgets events which have been sent enough times. Must be called
+ * only between batches, since it moves the entries. */
+static void gossip_piggyback_prune(cluster_gossip_t *self) {
+    uint32_t limit = gossip_piggyback_limit(self);
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < self->piggyback_num; ++i) {
+        if (self->piggyback[i].transmits < limit) self->piggyback[kept++] = self->piggyback[i];
+    }
+    self->piggyback_num = kept;
+}
+
+/* Notifies members about the change of the member's liveness state. */
+static int gossip_broadcast_liveness(cluster_gossip_t *self, const cluster_member_t *member) {
+    // Members that support piggybacking learn about the change along with
+    // the regular traffic. The rest get a dedicated message.
+    gossip_piggyback_add(self, member);
+
+    message_member_list_t member_list_msg;
+    message_header_init(&member_list_msg.header, MESSAGE_MEMBER_LIST_TYPE, 0);
+    member_list_msg.members = (cluster_member_t *) member;
+    member_list_msg.members_n = 1;
+    return gossip_broadcast_member_list(self, &member_list_msg,
+                                        PROTOCOL_VERSION_LIVENESS, PROTOCOL_VERSION_PIGGYBACK - 1);
+}
+
+static uint64_t gossip_suspicion_timeout(const cluster_gossip_t *self) {
+    // The timeout grows with log10 of the cluster size, so that the suspicion
+    // has enough time to reach the suspected member in larger clusters.
+    uint32_t scale = 1;
+    for (uint32_t n = self->members.size + 1; n >= 100; n /= 10) ++scale;
+    return (uint64_t) self->config.suspicion_mult * scale * self->config.probe_interval;
+}
+
+static int gossip_suspicion_start(cluster_gossip_t *self, const cluster_member_t *member, uint64_t current_ts) {
+    if (self->suspicions_num == self->suspicions_capacity) {
+        uint32_t new_capacity = self->suspicions_capacity > 0 ? self->suspicions_capacity * 2 : 8;
+        gossip_suspicion_t *new_suspicions =
+                (gossip_suspicion_t *) realloc(self->suspicions, new_capacity * sizeof(gossip_suspicion_t));
+        if (new_suspicions == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+        self->suspicions = new_suspicions;
+        self->suspicions_capacity = new_capacity;
+    }
+    gossip_suspicion_t *suspicion = &self->suspicions[self->suspicions_num++];
+    suspicion->address = member->address;
+    suspicion->uid = member->uid;
+    suspicion->incarnation = member->incarnation;
+    suspicion->deadline = current_ts + gossip_suspicion_timeout(self);
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_suspicion_tick(cluster_gossip_t *self, uint64_t current_ts) {
+    uint32_t i = 0;
+    while (i < self->suspicions_num) {
+        gossip_suspicion_t suspicion = self->suspicions[i];
+        if (suspicion.deadline > current_ts) {
+            ++i;
+            continue;
+        }
+        self->suspicions[i] = self->suspicions[--self->suspicions_num];
+
+        // The suspicion holds only if the member hasn't refuted it in the meantime.
+        cluster_member_t *member = cluster_member_set_find(&self->members, &suspicion.address);
+        if (member == NULL || member->state != MEMBER_SUSPECT ||
+            member->uid != suspicion.uid || member->incarnation != suspicion.incarnation) {
+            continue;
+        }
+        cluster_member_t dead_member = *member;
+        dead_member.state = MEMBER_DEAD;
+        log_warn("Member %s is considered dead", dead_member.username);
+        // The suspected member receives the notification as well and
+        // may still refute it.
+        int result = gossip_broadcast_liveness(self, &dead_member);
+        if (result < 0) return result;
+        cluster_member_set_update(&self->members, &dead_member);
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static uint64_t gossip_suspicion_next_deadline(const cluster_gossip_t *self) {
+    uint64_t deadline = UINT64_MAX;
+    for (uint32_t i = 0; i < self->suspicions_num; ++i) {
+        if (self->suspicions[i].deadline < deadline) deadline = self->suspicions[i].deadline;
+    }
+    return deadline;
+}
+
+/* Handles the liveness information about this node reported by others. */
+static int gossip_refute(cluster_gossip_t *self, const cluster_member_t *member) {
+    cluster_member_t *this_member = &self->self_address;
+    if (member->uid != this_member->uid || member->state == MEMBER_ALIVE ||
+        member->incarnation < this_member->incarnation) {
+        return CLUSTER_ERR_NONE;
+    }
+    // Only this node can increment its own incarnation, which
+    // supersedes any suspicion about the previous one.
+    this_member->incarnation = member->incarnation + 1;
+    return gossip_broadcast_liveness(self, this_member);
+}
+
+/* Applies the membership event received from another member. Events that
+ * have changed the local view are disseminated further if requested. */
+static void gossip_apply_member_update(cluster_gossip_t *self, const cluster_member_t *member,
+                                       cluster_bool_t disseminate, uint64_t current_ts) {
+    if (cluster_member_addr_equals(&member->address, &self->self_address.address)) {
+        gossip_refute(self, member);
+        return;
+    }
+    int update_result = cluster_member_set_update(&self->members, member);
+    if (update_result != CLUSTER_TRUE) return;
+    if (member->state == MEMBER_SUSPECT) gossip_suspicion_start(self, member, current_ts);
+    if (disseminate) gossip_piggyback_add(self, member);
+}
+
+/* Resends every logged data message the recipient's version is missing,
+ * oldest first, so that the recipient's version advances without gaps. */
+static int gossip_enqueue_data_log(cluster_gossip_t *self,
+                                   vector_clock_t *recipient_version,
+                                   const cluster_sockaddr_storage *recipient,
+                                   cluster_socklen_t recipient_len) {
+    int result = CLUSTER_ERR_NONE;
+    data_log_t *log = &self->data_log;
+    const cluster_member_t *member = cluster_member_set_find_by_addr(&self->members, recipient, recipient_len);
+    cluster_bool_t supports_fragments = member != NULL && gossip_member_supports_fragments(member);
+    for (uint32_t i = 0; i < log->size; ++i) {
+        const data_log_stream_t *stream = &log->streams[i];
+        vector_record_t version = {.member_id = stream->member_id, .sequence_number = stream->latest};
+        if (stream->latest == 0 ||
+            vector_clock_compare_with_record(recipient_version, &version, CLUSTER_FALSE) != VC_BEFORE) {
+            continue;
+        }
+        // Find the first message the recipient hasn't seen. All subsequent ones are missing too.
+        uint32_t seq = gossip_data_log_window_start(log, stream);
+        for (; seq < stream->latest; ++seq) {
+            version.sequence_number = seq;
+            if (vector_clock_compare_with_record(recipient_version, &version, CLUSTER_FALSE) == VC_BEFORE) break;
+        }
+        for (; seq <= stream->latest; ++seq) {
+            const data_log_record_t *record = gossip_data_log_record(log, stream, seq);
+            if (record == NULL) continue;
+            if (record->data_size > gossip_data_max_size(self)) {
+                // Only the first fragment is sent. The recipient pulls the rest of them.
+                if (!supports_fragments) continue;
+                version.sequence_number = seq;
+                result = gossip_enqueue_fragment(self, &version, record->data, record->data_size,
+                                                 gossip_fragment_size(self, member), 0, recipient, recipient_len);
+                if (result < 0) return result;
+                continue;
+            }
+            message_data_t data_msg;
+            result = gossip_data_log_create_message(stream, record, &data_msg);
+            if (result < 0) return result;
+
+            result = gossip_enqueue_message(self, MESSAGE_DATA_TYPE, &data_msg,
+                                            recipient, recipient_len, GOSSIP_DIRECT);
+            if (result < 0) return result;
+        }
+    }
+    return result;
+}
+
+static int gossip_enqueue_ping(cluster_gossip_t *self,
+                               const cluster_member_addr_t *recipient,
+                               uint32_t *sequence_num) {
+    cluster_sockaddr_storage recipient_addr;
+    cluster_socklen_t recipient_len = cluster_member_addr_to_sockaddr(recipient, &recipient_addr);
+    message_ping_t ping_msg;
+    message_header_init(&ping_msg.header, MESSAGE_PING_TYPE, 0);
+    int result = gossip_enqueue_message(self, MESSAGE_PING_TYPE, &ping_msg,
+                                        &recipient_addr, recipient_len, GOSSIP_DIRECT);
+    if (result < 0) return result;
+    // A direct message always results in a single envelope.
+    *sequence_num = self->sequence_num;
+    return CLUSTER_ERR_NONE;
+}
+
+static inline cluster_bool_t gossip_member_supports_probe(const cluster_member_t *member) {
+    return member->version >= PROTOCOL_VERSION_PROBE;
+}
+
+/* Starts a new round of probes over the current members in a random order. */
+static int gossip_probe_shuffle_order(cluster_gossip_t *self) {
+    gossip_probe_t *probe = &self->probe;
+    uint32_t size = self->members.size;
+    if (size > probe->order_capacity) {
+        uint32_t *new_order = (uint32_t *) realloc(probe->order, size * sizeof(uint32_t));
+        if (new_order == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+        probe->order = new_order;
+        probe->order_capacity = size;
+    }
+    for (uint32_t i = 0; i < size; ++i) {
+        uint32_t other = cluster_rng_uniform(&self->members.rng, i + 1);
+        probe->order[i] = probe->order[other];
+        probe->order[other] = i;
+    }
+    probe->order_num = size;
+    probe->order_cursor = 0;
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_probe_select_target(cluster_gossip_t *self, cluster_member_t **target) {
+    gossip_probe_t *probe = &self->probe;
+    *target = NULL;
+    // Members that joined during the round are picked up by the next one,
+    // and the indices of removed members may exceed the current size.
+    for (int rounds = 0; rounds < 2; ++rounds) {
+        while (probe->order_cursor < probe->order_num) {
+            uint32_t idx = probe->order[probe->order_cursor++];
+            if (idx >= self->members.size) continue;
+            cluster_member_t *member = &self->members.set[idx];
+            if (gossip_member_supports_probe(member)) {
+                *target = member;
+                return CLUSTER_ERR_NONE;
+            }
+        }
+        if (self->members.size == 0) return CLUSTER_ERR_NONE;
+        int result = gossip_probe_shuffle_order(self);
+        if (result < 0) return result;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_probe_start(cluster_gossip_t *self, uint64_t current_ts) {
+    gossip_probe_t *probe = &self->probe;
+    probe->next_probe_ts = current_ts + self->config.probe_interval;
+
+    cluster_member_t *target = NULL;
+    int result = gossip_probe_select_target(self, &target);
+    if (result < 0 || target == NULL) return result;
+
+    result = gossip_enqueue_ping(self, &target->address, &probe->ping_seq);
+    if (result < 0) return result;
+    probe->target = target->address;
+    probe->phase = PROBE_DIRECT;
+    probe->started_ts = current_ts;
+    probe->deadline = current_ts + self->config.probe_timeout;
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_probe_escalate(cluster_gossip_t *self) {
+    gossip_probe_t *probe = &self->probe;
+    // The target didn't respond in time. Ask some other members to probe it.
+    size_t candidates_num = cluster_member_set_random_members(&self->members, self->reservoir,
+                                                              self->config.probe_indirect_members + 1);
+    message_ping_req_t ping_req_msg;
+    message_header_init(&ping_req_msg.header, MESSAGE_PING_REQ_TYPE, 0);
+    ping_req_msg.target = probe->target;
+
+    uint16_t requested = 0;
+    for (size_t i = 0; i < candidates_num && requested < self->config.probe_indirect_members; ++i) {
+        const cluster_member_t *member = self->reservoir[i];
+        if (!gossip_member_supports_probe(member)) continue;
+        if (cluster_member_addr_equals(&member->address, &probe->target)) continue;
+
+        cluster_sockaddr_storage member_addr;
+        cluster_socklen_t member_addr_len = cluster_member_addr_to_sockaddr(&member->address, &member_addr);
+        int result = gossip_enqueue_message(self, MESSAGE_PING_REQ_TYPE, &ping_req_msg,
+                                            &member_addr, member_addr_len, GOSSIP_DIRECT);
+        if (result < 0) return result;
+        ++requested;
+    }
+
+    // Indirect probes must complete by the end of the protocol period.
+    probe->phase = PROBE_INDIRECT;
+    probe->deadline = probe->started_ts + self->config.probe_interval;
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_probe_fail(cluster_gossip_t *self, uint64_t current_ts) {
+    gossip_probe_t *probe = &self->probe;
+    probe->phase = PROBE_IDLE;
+
+    // The member didn't respond to direct and indirect probes. Suspect it
+    // first and give it a chance to refute the suspicion.
+    cluster_member_t *member = cluster_member_set_find(&self->members, &probe->target);
+    if (member == NULL || member->state != MEMBER_ALIVE) return CLUSTER_ERR_NONE;
+    member->state = MEMBER_SUSPECT;
+    log_warn("Member %s is suspected", member->username);
+
+    cluster_member_t suspect_member = *member;
+    int result = gossip_suspicion_start(self, &suspect_member, current_ts);
+    if (result < 0) return result;
+
+    if (gossip_member_supports_piggyback(&suspect_member)) {
+        // Let the suspected member know right away, so that it can refute the
+        // suspicion before it reaches it through dissemination.
+        message_member_list_t member_list_msg;
+        message_header_init(&member_list_msg.header, MESSAGE_MEMBER_LIST_TYPE, 0);
+        member_list_msg.header.flags = gossip_member_list_flags(suspect_member.version);
+        member_list_msg.members = &suspect_member;
+        member_list_msg.members_n = 1;
+        cluster_sockaddr_storage suspect_addr;
+        cluster_socklen_t suspect_addr_len = cluster_member_addr_to_sockaddr(&suspect_member.address,
+                                                                             &suspect_addr);
+        result = gossip_enqueue_message(self, MESSAGE_MEMBER_LIST_TYPE, &member_list_msg,
+                                        &suspect_addr, suspect_addr_len, GOSSIP_DIRECT);
+        if (result < 0) return result;
+    }
+    return gossip_broadcast_liveness(self, &suspect_member);
+}
+
+static int gossip_probe_handle_ack(cluster_gossip_t *self, uint32_t ack_sequence_num) {
+    gossip_probe_t *probe = &self->probe;
+    if (probe->phase != PROBE_IDLE && probe->ping_seq == ack_sequence_num) {
+        probe->phase = PROBE_IDLE;
+        return CLUSTER_ERR_NONE;
+    }
+
+    for (int i = 0; i < GOSSIP_PROBE_INDIRECT_PENDING; ++i) {
+        gossip_indirect_probe_t *indirect = &self->indirect_probes[i];
+        if (!indirect->active || indirect->ping_seq != ack_sequence_num) continue;
+
+        // Relay the response to the member that requested the probe.
+        indirect->active = CLUSTER_FALSE;
+        message_indirect_ack_t indirect_ack_msg;
+        message_header_init(&indirect_ack_msg.header, MESSAGE_INDIRECT_ACK_TYPE, 0);
+        indirect_ack_msg.ack_sequence_num = indirect->requester_seq;
+        indirect_ack_msg.target = indirect->target;
+        return gossip_enqueue_message(self, MESSAGE_INDIRECT_ACK_TYPE, &indirect_ack_msg,
+                                      &indirect->requester, indirect->requester_len, GOSSIP_DIRECT);
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_probe_tick(cluster_gossip_t *self, uint64_t current_ts) {
+    gossip_probe_t *probe = &self->probe;
+    if (probe->phase == PROBE_DIRECT && probe->deadline <= current_ts) {
+        int result = gossip_probe_escalate(self);
+        if (result < 0) return result;
+    }
+    if (probe->phase == PROBE_INDIRECT && probe->deadline <= current_ts) {
+        int result = gossip_probe_fail(self, current_ts);
+        if (result < 0) return result;
+    }
+    if (probe->phase == PROBE_IDLE && probe->next_probe_ts <= current_ts) {
+        return gossip_probe_start(self, current_ts);
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static uint64_t gossip_probe_next_event(const cluster_gossip_t *self) {
+    const gossip_probe_t *probe = &self->probe;
+    if (probe->phase != PROBE_IDLE && probe->deadline < probe->next_probe_ts) return probe->deadline;
+    return probe->next_probe_ts;
+}
+
+static int gossip_handle_ping(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+    RETURN_IF_NOT_CONNECTED(self->state);
+    message_ping_t msg;
+    int decode_result = message_ping_decode(envelope_in->buffer, envelope_in->buffer_size, &msg);
+    if (decode_result < 0) {
+        return decode_result;
+    }
+    return gossip_enqueue_ack(self, msg.header.sequence_num, envelope_in->sender, envelope_in->sender_len);
+}
+
+static int gossip_handle_ping_req(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+    RETURN_IF_NOT_CONNECTED(self->state);
+    message_ping_req_t msg;
+    int decode_result = message_ping_req_decode(envelope_in->buffer, envelope_in->buffer_size, &msg);
+    if (decode_result < 0) {
+        return decode_result;
+    }
+
+    uint64_t current_ts = cluster_time();
+    gossip_indirect_probe_t *indirect = NULL;
+    for (int i = 0; i < GOSSIP_PROBE_INDIRECT_PENDING; ++i) {
+        gossip_indirect_probe_t *candidate = &self->indirect_probes[i];
+        if (!candidate->active || candidate->expire_ts <= current_ts) {
+            indirect = candidate;
+            break;
+        }
+    }
+    // Too many probes on behalf of other members are in progress. The requester
+    // has asked several members, so it's safe to ignore this request.
+    if (indirect == NULL) return CLUSTER_ERR_NONE;
+
+    int result = gossip_enqueue_ping(self, &msg.target, &indirect->ping_seq);
+    if (result < 0) return result;
+    indirect->active = CLUSTER_TRUE;
+    indirect->target = msg.target;
+    memcpy(&indirect->requester, envelope_in->sender, envelope_in->sender_len);
+    indirect->requester_len = envelope_in->sender_len;
+    indirect->requester_seq = msg.header.sequence_num;
+    indirect->expire_ts = current_ts + self->config.probe_timeout;
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_handle_indirect_ack(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+    RETURN_IF_NOT_CONNECTED(self->state);
+    message_indirect_ack_t msg;
+    int decode_result = message_indirect_ack_decode(envelope_in->buffer, envelope_in->buffer_size, &msg);
+    if (decode_result < 0) {
+        return decode_result;
+    }
+
+    // The target responded to one of the members we've asked to probe it.
+    gossip_probe_t *probe = &self->probe;
+    if (probe->phase != PROBE_IDLE && cluster_member_addr_equals(&probe->target, &msg.target)) {
+        probe->phase = PROBE_IDLE;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static inline cluster_bool_t gossip_partial_views(const cluster_gossip_t *self) {
+    return self->config.active_view_size > 0;
+}
+
+static inline cluster_bool_t gossip_member_supports_views(const cluster_member_t *member) {
+    return member->version >= PROTOCOL_VERSION_HYPARVIEW;
+}
+
+static int gossip_enqueue_view_message(cluster_gossip_t *self, uint8_t message_type, uint16_t flags, uint8_t ttl,
+                                       cluster_member_t *members, uint8_t members_n,
+                                       const cluster_member_addr_t *recipient) {
+    message_view_t view_msg;
+    message_header_init(&view_msg.header, message_type, 0);
+    view_msg.header.flags = flags;
+    view_msg.ttl = ttl;
+    view_msg.members = members;
+    view_msg.members_n = members_n;
+    cluster_sockaddr_storage recipient_addr;
+    cluster_socklen_t recipient_addr_len = cluster_member_addr_to_sockaddr(recipient, &recipient_addr);
+    return gossip_enqueue_message(self, message_type, &view_msg,
+                                  &recipient_addr, recipient_addr_len, GOSSIP_DIRECT);
+}
+
+static int gossip_enqueue_disconnect(cluster_gossip_t *self, const cluster_member_addr_t *recipient) {
+    message_disconnect_t disconnect_msg;
+    message_header_init(&disconnect_msg.header, MESSAGE_DISCONNECT_TYPE, 0);
+    cluster_sockaddr_storage recipient_addr;
+    cluster_socklen_t recipient_addr_len = cluster_member_addr_to_sockaddr(recipient, &recipient_addr);
+    return gossip_enqueue_message(self, MESSAGE_DISCONNECT_TYPE, &disconnect_msg,
+                                  &recipient_addr, recipient_addr_len, GOSSIP_DIRECT);
+}
+
+/* Returns a random member of the view other than the given ones. */
+static cluster_member_t *gossip_view_random_member(cluster_gossip_t *self, uint8_t view,
+                                                   const cluster_member_addr_t *exclude_first,
+                                                   const cluster_member_addr_t *exclude_second) {
+    uint32_t size = self->members.size;
+    if (size == 0) return NULL;
+    uint32_t start = cluster_rng_uniform(&self->members.rng, size);
+    for (uint32_t i = 0; i < size; ++i) {
+        cluster_member_t *member = &self->members.set[(start + i) % size];
+        if (member->view != view || !gossip_member_supports_views(member)) continue;
+        if (exclude_first != NULL && cluster_member_addr_equals(&member->address, exclude_first)) continue;
+        if (exclude_second != NULL && cluster_member_addr_equals(&member->address, exclude_second)) continue;
+        return member;
+    }
+    return NULL;
+}
+
+static inline cluster_member_t *gossip_view_random_active(cluster_gossip_t *self,
+                                                          const cluster_member_addr_t *exclude_first,
+                                                          const cluster_member_addr_t *exclude_second) {
+    return gossip_view_random_member(self, MEMBER_VIEW_ACTIVE, exclude_first, exclude_second);
+}
+
+/* Moves the known member to the active view. If the view is full,
+ * a random active member is disconnected and becomes passive. */
+static int gossip_view_promote(cluster_gossip_t *self, const cluster_member_addr_t *address) {
+    const cluster_member_t *member = cluster_member_set_find(&self->members, address);
+    if (member == NULL || member->view == MEMBER_VIEW_ACTIVE) return CLUSTER_ERR_NONE;
+    if (self->members.active_num >= self->config.active_view_size) {
+        cluster_member_t *victim = gossip_view_random_active(self, address, NULL);
+        if (victim != NULL) {
+            cluster_member_addr_t victim_addr = victim->address;
+            cluster_member_set_move(&self->members, &victim_addr, MEMBER_VIEW_PASSIVE);
+            int result = gossip_enqueue_disconnect(self, &victim_addr);
+            if (result < 0) return result;
+        }
+    }
+    cluster_member_set_move(&self->members, address, MEMBER_VIEW_ACTIVE);
+    return CLUSTER_ERR_NONE;
+}
+
+/* Builds a sample of this node and both of its views for a shuffle. */
+static uint8_t gossip_view_sample(cluster_gossip_t *self, cluster_member_t *sample) {
+    uint8_t sample_n = 0;
+    sample[sample_n++] = self->self_address;
+    static const struct {
+        uint8_t view;
+        size_t size;
+    } parts[] = {{MEMBER_VIEW_ACTIVE, GOSSIP_SHUFFLE_ACTIVE}, {MEMBER_VIEW_PASSIVE, GOSSIP_SHUFFLE_PASSIVE}};
+    for (size_t p = 0; p < sizeof(parts) / sizeof(parts[0]); ++p) {
+        size_t size = parts[p].size < self->reservoir_size ? parts[p].size : self->reservoir_size;
+        size_t chosen = cluster_member_set_random_view(&self->members, parts[p].view, self->reservoir, size);
+        for (size_t i = 0; i < chosen; ++i) sample[sample_n++] = *self->reservoir[i];
+    }
+    return sample_n;
+}
+
+/* Refills the active view from the passive one, one Neighbor request at a time. */
+static int gossip_view_repair(cluster_gossip_t *self, uint64_t current_ts) {
+    if (self->members.active_num >= self->config.active_view_size) return CLUSTER_ERR_NONE;
+    if (self->last_repair_ts + self->config.tick_interval > current_ts) return CLUSTER_ERR_NONE;
+    self->last_repair_ts = current_ts;
+
+    const cluster_member_t *candidate = gossip_view_random_member(self, MEMBER_VIEW_PASSIVE, NULL, NULL);
+    if (candidate == NULL) return CLUSTER_ERR_NONE;
+    cluster_member_addr_t candidate_addr = candidate->address;
+    if (self->members.active_num > 0) {
+        return gossip_enqueue_view_message(self, MESSAGE_NEIGHBOR_TYPE, 0, 0,
+                                           &self->self_address, 1, &candidate_addr);
+    }
+
+    // A node without active peers is isolated and can't be refused. Its passive
+    // view may be stale as well, so it's refreshed directly from the candidate.
+    int result = gossip_enqueue_view_message(self, MESSAGE_NEIGHBOR_TYPE, MESSAGE_FLAG_HIGH_PRIORITY, 0,
+                                             &self->self_address, 1, &candidate_addr);
+    if (result < 0) return result;
+    cluster_member_t sample[1 + GOSSIP_SHUFFLE_ACTIVE + GOSSIP_SHUFFLE_PASSIVE];
+    uint8_t sample_n = gossip_view_sample(self, sample);
+    return gossip_enqueue_view_message(self, MESSAGE_SHUFFLE_TYPE, 0, 0, sample, sample_n, &candidate_addr);
+}
+
+/* Exchanges a sample of views with a member found by a random walk,
+ * which keeps passive views fresh and well mixed. */
+static int gossip_view_shuffle(cluster_gossip_t *self, uint64_t current_ts) {
+    if (self->last_shuffle_ts + self->config.shuffle_interval > current_ts) return CLUSTER_ERR_NONE;
+    self->last_shuffle_ts = current_ts;
+
+    const cluster_member_t *target = gossip_view_random_active(self, NULL, NULL);
+    if (target == NULL) return CLUSTER_ERR_NONE;
+    cluster_member_addr_t target_addr = target->address;
+
+    cluster_member_t sample[1 + GOSSIP_SHUFFLE_ACTIVE + GOSSIP_SHUFFLE_PASSIVE];
+    uint8_t sample_n = gossip_view_sample(self, sample);
+    return gossip_enqueue_view_message(self, MESSAGE_SHUFFLE_TYPE, 0, GOSSIP_ACTIVE_WALK_LENGTH,
+                                       sample, sample_n, &target_addr);
+}
+
+static int gossip_handle_forward_join(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+    RETURN_IF_NOT_CONNECTED(self->state);
+    message_view_t msg;
+    int decode_result = message_view_decode(envelope_in->buffer, envelope_in->buffer_size, &msg);
+    if (decode_result < 0) return decode_result;
+
+    cluster_member_t newcomer = msg.members[0];
+    message_view_destroy(&msg);
+    if (cluster_member_addr_equals(&newcomer.address, &self->self_address.address)) return CLUSTER_ERR_NONE;
+
+    cluster_member_addr_t sender;
+    int result = cluster_member_addr_from_sockaddr(&sender, envelope_in->sender, envelope_in->sender_len);
+    if (result < 0) return result;
+
+    const cluster_member_t *next_hop = NULL;
+    if (msg.ttl > 0 && self->members.active_num > 1) {
+        next_hop = gossip_view_random_active(self, &sender, &newcomer.address);
+    }
+    if (next_hop == NULL) {
+        // The walk ends here. Connect to the newcomer.
+        result = cluster_member_set_update(&self->members, &newcomer);
+        if (result < 0) return result;
+        result = gossip_view_promote(self, &newcomer.address);
+        if (result < 0) return result;
+        return gossip_enqueue_view_message(self, MESSAGE_NEIGHBOR_TYPE, MESSAGE_FLAG_HIGH_PRIORITY, 0,
+                                           &self->self_address, 1, &newcomer.address);
+    }
+    cluster_member_addr_t next_hop_addr = next_hop->address;
+    if (msg.ttl == GOSSIP_PASSIVE_WALK_LENGTH) {
+        result = cluster_member_set_update(&self->members, &newcomer);
+        if (result < 0) return result;
+    }
+    return gossip_enqueue_view_message(self, MESSAGE_FORWARD_JOIN_TYPE, 0, msg.ttl - 1,
+                                       &newcomer, 1, &next_hop_addr);
+}
+
+static int gossip_handle_neighbor(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+    RETURN_IF_NOT_CONNECTED(self->state);
+    message_view_t msg;
+    int decode_result = message_view_decode(envelope_in->buffer, envelope_in->buffer_size, &msg);
+    if (decode_result < 0) return decode_result;
+
+    cluster_member_t neighbor = msg.members[0];
+    message_view_destroy(&msg);
+
+    cluster_bool_t accepted = (msg.header.flags & MESSAGE_FLAG_NEIGHBOR_ACCEPT) != 0;
+    if (!accepted && !(msg.header.flags & MESSAGE_FLAG_HIGH_PRIORITY) &&
+        self->members.active_num >= self->config.active_view_size) {
+        return gossip_enqueue_disconnect(self, &neighbor.address);
+    }
+
+    int result = cluster_member_set_update(&self->members, &neighbor);
+    if (result < 0) return result;
+    result = gossip_view_promote(self, &neighbor.address);
+    if (result < 0 || accepted) return result;
+    return gossip_enqueue_view_message(self, MESSAGE_NEIGHBOR_TYPE, MESSAGE_FLAG_NEIGHBOR_ACCEPT, 0,
+                                       &self->self_address, 1, &neighbor.address);
+}
+
+static int gossip_handle_disconnect(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+    RETURN_IF_NOT_CONNECTED(self->state);
+    message_disconnect_t msg;
+    int decode_result = message_disconnect_decode(envelope_in->buffer, envelope_in->buffer_size, &msg);
+    if (decode_result < 0) return decode_result;
+
+    cluster_member_addr_t sender;
+    int result = cluster_member_addr_from_sockaddr(&sender, envelope_in->sender, envelope_in->sender_len);
+    if (result < 0) return result;
+    cluster_member_set_move(&self->members, &sender, MEMBER_VIEW_PASSIVE);
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_shuffle_process(cluster_gossip_t *self, const message_view_t *msg,
+                                  const message_envelope_in_t *envelope_in) {
+    const cluster_member_t *origin = &msg->members[0];
+    if (cluster_member_addr_equals(&origin->address, &self->self_address.address)) return CLUSTER_ERR_NONE;
+
+    cluster_member_addr_t sender;
+    int result = cluster_member_addr_from_sockaddr(&sender, envelope_in->sender, envelope_in->sender_len);
+    if (result < 0) return result;
+
+    if (msg->ttl > 0 && self->members.active_num > 1) {
+        const cluster_member_t *next_hop = gossip_view_random_active(self, &sender, &origin->address);
+        if (next_hop != NULL) {
+            cluster_member_addr_t next_hop_addr = next_hop->address;
+            return gossip_enqueue_view_message(self, MESSAGE_SHUFFLE_TYPE, 0, msg->ttl - 1,
+                                               msg->members, msg->members_n, &next_hop_addr);
+        }
+    }
+
+    // The walk ends here. Reply with a sample of the passive view of the same size.
+    cluster_member_t reply[1 + GOSSIP_SHUFFLE_ACTIVE + GOSSIP_SHUFFLE_PASSIVE];
+    size_t reply_size = sizeof(reply) / sizeof(reply[0]);
+    if (reply_size > msg->members_n) reply_size = msg->members_n;
+    if (reply_size > self->reservoir_size) reply_size = self->reservoir_size;
+    size_t chosen = cluster_member_set_random_view(&self->members, MEMBER_VIEW_PASSIVE,
+                                                   self->reservoir, reply_size);
+    for (size_t i = 0; i < chosen; ++i) reply[i] = *self->reservoir[i];
+    if (chosen > 0) {
+        cluster_sockaddr_storage origin_addr;
+        cluster_socklen_t origin_addr_len = cluster_member_addr_to_sockaddr(&origin->address, &origin_addr);
+        result = gossip_enqueue_member_list(self, reply, chosen, gossip_member_list_flags(origin->version),
+                                            &origin_addr, origin_addr_len);
+        if (result < 0) return result;
+    }
+
+    // Received members join the passive view.
+    uint64_t current_ts = cluster_time();
+    for (int i = 0; i < msg->members_n; ++i) {
+        gossip_apply_member_update(self, &msg->members[i], CLUSTER_FALSE, current_ts);
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_handle_shuffle(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+    RETURN_IF_NOT_CONNECTED(self->state);
+    message_view_t msg;
+    int decode_result = message_view_decode(envelope_in->buffer, envelope_in->buffer_size, &msg);
+    if (decode_result < 0) return decode_result;
+
+    int result = gossip_shuffle_process(self, &msg, envelope_in);
+    message_view_destroy(&msg);
+    return result;
+}
 
-    return gossip_enqueue_message(self, MESSAGE_DATA_TYPE, &data_msg,
-                                  NULL, 0, GOSSIP_RANDOM);
+/* Computes the digest of the member set including this node. */
+static void gossip_digest(const cluster_gossip_t *self, uint64_t *digest) {
+    cluster_member_set_digest(&self->members, digest);
+    cluster_member_digest_add(&self->self_address, digest);
 }
 
-static int gossip_enqueue_status(cluster_gossip_t *self,
+static int gossip_enqueue_digest(cluster_gossip_t *self, uint16_t flags,
                                  const cluster_sockaddr_storage *recipient,
                                  cluster_socklen_t recipient_len) {
-    message_status_t status_msg;
-    message_header_init(&status_msg.header, MESSAGE_STATUS_TYPE, 0);
-    vector_clock_copy(&status_msg.data_version, &self->data_version);
-
-    gossip_spreading_type_t spreading_type = recipient == NULL ? GOSSIP_RANDOM : GOSSIP_DIRECT;
-    return gossip_enqueue_message(self, MESSAGE_STATUS_TYPE, &status_msg,
-                                  recipient, recipient_len, spreading_type);
+    message_digest_t digest_msg;
+    message_header_init(&digest_msg.header, MESSAGE_DIGEST_TYPE, 0);
+    digest_msg.header.flags = flags;
+    gossip_digest(self, digest_msg.buckets);
+    return gossip_enqueue_message(self, MESSAGE_DIGEST_TYPE, &digest_msg,
+                                  recipient, recipient_len, GOSSIP_DIRECT);
 }
 
-#define MEMBER_LIST_SYNC_SIZE (MESSAGE_MAX_SIZE / CLUSTER_MEMBER_SIZE)
-
-static int gossip_enqueue_member_list(cluster_gossip_t *self,
-                                      const cluster_sockaddr_storage *recipient,
-                                      cluster_socklen_t recipient_len) {
-    message_member_list_t member_list_msg;
-    message_header_init(&member_list_msg.header, MESSAGE_MEMBER_LIST_TYPE, 0);
-
-    const cluster_member_set_t *members = &self->members;
-    uint32_t members_num = (members->size > MEMBER_LIST_SYNC_SIZE) ? MEMBER_LIST_SYNC_SIZE : members->size;
+/* Starts the membership synchronization with a random
+ * member which supports digests. */
+static int gossip_sync_start(cluster_gossip_t *self) {
+    uint32_t members_num = self->members.size;
     if (members_num == 0) return CLUSTER_ERR_NONE;
-
-    // TODO: get rid of the redundant copying.
-    cluster_member_t *members_to_send = (cluster_member_t *) malloc(members_num * sizeof(cluster_member_t));
-    if (members_to_send == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
-
-    int result = CLUSTER_ERR_NONE;
-    int to_send_idx = 0;
-    int member_idx = 0;
-    while (member_idx < members->size) {
-        // Send the list of all known members to a recipient.
-        // The list can be pretty big, so we split it into multiple messages.
-        while (to_send_idx < members_num && member_idx < members->size) {
-            memcpy(&members_to_send[to_send_idx], members->set[member_idx], sizeof(cluster_member_t));
-            ++to_send_idx;
-            ++member_idx;
-        }
-        if (to_send_idx > 0) {
-            member_list_msg.members_n = to_send_idx;
-            member_list_msg.members = members_to_send;
-            result = gossip_enqueue_message(self, MESSAGE_MEMBER_LIST_TYPE, &member_list_msg,
-                                            recipient, recipient_len, GOSSIP_DIRECT);
-            if (result < 0) {
-                free(members_to_send);
-                return result;
-            }
-        }
-        to_send_idx = 0;
+    uint32_t start_idx = cluster_rng_uniform(&self->members.rng, members_num);
+    for (uint32_t i = 0; i < members_num; ++i) {
+        const cluster_member_t *member = &self->members.set[(start_idx + i) % members_num];
+        if (member->version < PROTOCOL_VERSION_DIGEST) continue;
+        cluster_sockaddr_storage member_addr;
+        cluster_socklen_t member_addr_len = cluster_member_addr_to_sockaddr(&member->address, &member_addr);
+        return gossip_enqueue_digest(self, 0, &member_addr, member_addr_len);
     }
-    free(members_to_send);
-    return result;
+    return CLUSTER_ERR_NONE;
 }
 
-static int gossip_enqueue_data_log(cluster_gossip_t *self,
-                                   vector_clock_t *recipient_version,
-                                   const cluster_sockaddr_storage *recipient,
-                                   cluster_socklen_t recipient_len) {
-    int result = CLUSTER_ERR_NONE;
-    for (int i = 0; i < self->data_log.size; ++i) {
-        const data_log_record_t *record = &self->data_log.messages[i];
-        if (vector_clock_compare_with_record(recipient_version, &record->version, CLUSTER_FALSE) == VC_BEFORE) {
-            // The recipient data version is behind. Enqueue this data payload.
-            message_data_t data_msg;
-            result = gossip_data_log_create_message(record, &data_msg);
-            if (result < 0) return result;
-
-            result = gossip_enqueue_message(self, MESSAGE_DATA_TYPE, &data_msg,
-                                            recipient, recipient_len, GOSSIP_DIRECT);
-            if (result < 0) return result;
+static int gossip_handle_digest(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+    RETURN_IF_NOT_CONNECTED(self->state);
+    message_digest_t msg;
+    int decode_result = message_digest_decode(envelope_in->buffer, envelope_in->buffer_size, &msg);
+    if (decode_result < 0) return decode_result;
+
+    uint64_t digest[CLUSTER_MEMBER_DIGEST_BUCKETS];
+    gossip_digest(self, digest);
+    cluster_bool_t differs[CLUSTER_MEMBER_DIGEST_BUCKETS];
+    cluster_bool_t any_differs = CLUSTER_FALSE;
+    for (int i = 0; i < CLUSTER_MEMBER_DIGEST_BUCKETS; ++i) {
+        differs[i] = digest[i] != msg.buckets[i];
+        any_differs |= differs[i];
+    }
+    if (!any_differs) return CLUSTER_ERR_NONE;
+
+    // Push members from the buckets that differ, including this node itself.
+    cluster_member_t *members = (cluster_member_t *) malloc((self->members.size + 1) * sizeof(cluster_member_t));
+    if (members == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+    uint32_t members_num = 0;
+    for (uint32_t i = 0; i < self->members.size; ++i) {
+        if (differs[cluster_member_digest_bucket(&self->members.set[i])]) {
+            members[members_num++] = self->members.set[i];
         }
     }
+    if (differs[cluster_member_digest_bucket(&self->self_address)]) {
+        members[members_num++] = self->self_address;
+    }
+
+    // The sender supports digests and thus every member encoding up to that version.
+    const cluster_member_t *sender = cluster_member_set_find_by_addr(&self->members, envelope_in->sender,
+                                                                     envelope_in->sender_len);
+    uint16_t sender_version = sender != NULL && sender->version > PROTOCOL_VERSION_DIGEST ?
+                              sender->version : PROTOCOL_VERSION_DIGEST;
+    uint16_t flags = gossip_member_list_flags(sender_version);
+    int result = gossip_enqueue_member_list(self, members, members_num, flags,
+                                            envelope_in->sender, envelope_in->sender_len);
+    free(members);
+    if (result < 0) return result;
+
+    // Let the sender push the members this node is missing.
+    if (!(msg.header.flags & MESSAGE_FLAG_DIGEST_REPLY)) {
+        result = gossip_enqueue_digest(self, MESSAGE_FLAG_DIGEST_REPLY,
+                                       envelope_in->sender, envelope_in->sender_len);
+    }
     return result;
 }
 
@@ -485,21 +2761,40 @@ static int gossip_handle_hello(cluster_gossip_t *self, const message_envelope_in
     // Send back a Welcome message.
     gossip_enqueue_welcome(self, msg.header.sequence_num, envelope_in->sender, envelope_in->sender_len);
 
-    // Send the list of known members to a newcomer node.
-    if (self->members.size > 0) {
-        gossip_enqueue_member_list(self, envelope_in->sender, envelope_in->sender_len);
+    // Send the list of known members to a newcomer node. Newcomers that support
+    // digests pull only the members they are missing once welcomed.
+    if (self->members.size > 0 && msg.this_member->version < PROTOCOL_VERSION_DIGEST) {
+        gossip_enqueue_member_list(self, self->members.set, self->members.size,
+                                   gossip_member_list_flags(msg.this_member->version),
+                                   envelope_in->sender, envelope_in->sender_len);
     }
 
-    // Notify other nodes about a newcomer.
+    // Notify other nodes about a newcomer. Members that support piggybacking
+    // learn about it along with the regular traffic.
+    gossip_piggyback_add(self, msg.this_member);
     message_member_list_t member_list_msg;
     message_header_init(&member_list_msg.header, MESSAGE_MEMBER_LIST_TYPE, 0);
     member_list_msg.members = msg.this_member;
     member_list_msg.members_n = 1;
-    gossip_enqueue_message(self, MESSAGE_MEMBER_LIST_TYPE, &member_list_msg, NULL, 0, GOSSIP_BROADCAST);
+    gossip_broadcast_member_list(self, &member_list_msg, 0, PROTOCOL_VERSION_PIGGYBACK - 1);
 
     // Update our local storage with a new member.
     cluster_member_set_put(&self->members, msg.this_member, 1);
 
+    if (gossip_partial_views(self) && gossip_member_supports_views(msg.this_member)) {
+        // The newcomer joins the active view of this node and walks
+        // through the active views of its peers.
+        cluster_member_addr_t newcomer = msg.this_member->address;
+        gossip_view_promote(self, &newcomer);
+        for (uint32_t i = 0; i < self->members.size; ++i) {
+            cluster_member_t *member = &self->members.set[i];
+            if (member->view != MEMBER_VIEW_ACTIVE || !gossip_member_supports_views(member)) continue;
+            if (cluster_member_addr_equals(&member->address, &newcomer)) continue;
+            gossip_enqueue_view_message(self, MESSAGE_FORWARD_JOIN_TYPE, 0, GOSSIP_ACTIVE_WALK_LENGTH,
+                                        msg.this_member, 1, &member->address);
+        }
+    }
+
     message_hello_destroy(&msg);
     return CLUSTER_ERR_NONE;
 }
@@ -515,6 +2810,12 @@ static int gossip_handle_welcome(cluster_gossip_t *self, const message_envelope_
     // Now when the seed node responded we can
     // safely add it to the list of known members.
     cluster_member_set_put(&self->members, msg.this_member, 1);
+    if (gossip_partial_views(self)) gossip_view_promote(self, &msg.this_member->address);
+
+    // Pull the member list from the seed node.
+    if (msg.this_member->version >= PROTOCOL_VERSION_DIGEST) {
+        gossip_enqueue_digest(self, 0, envelope_in->sender, envelope_in->sender_len);
+    }
 
     // Remove the hello message from the outbound queue.
     message_envelope_out_t *hello_envelope =
@@ -535,7 +2836,10 @@ static int gossip_handle_member_list(cluster_gossip_t *self, const message_envel
     };
 
     // Update our local collection of members with arrived records.
-    cluster_member_set_put(&self->members, msg.members, msg.members_n);
+    uint64_t current_ts = cluster_time();
+    for (int i = 0; i < msg.members_n; ++i) {
+        gossip_apply_member_update(self, &msg.members[i], CLUSTER_FALSE, current_ts);
+    }
 
     // Send ACK message back to sender.
     gossip_enqueue_ack(self, msg.header.sequence_num, envelope_in->sender, envelope_in->sender_len);
@@ -552,23 +2856,246 @@ static int gossip_handle_data(cluster_gossip_t *self, const message_envelope_in_
         return decode_result;
     }
 
-    // Send ACK message back to sender.
-    gossip_enqueue_ack(self, msg.header.sequence_num, envelope_in->sender, envelope_in->sender_len);
+    // Send ACK message back to sender. Messages pushed along
+    // the broadcast tree are not acknowledged.
+    cluster_bool_t eager_push = (msg.header.flags & MESSAGE_FLAG_EAGER_PUSH) != 0;
+    if (!eager_push) {
+        gossip_enqueue_ack(self, msg.header.sequence_num, envelope_in->sender, envelope_in->sender_len);
+    }
 
-    // Verify whether we saw the arrived message before.
-    vector_clock_comp_res_t res = vector_clock_compare_with_record(&self->data_version,
-                                                                   &msg.data_version, CLUSTER_TRUE);
+    cluster_member_addr_t sender;
+    int addr_result = cluster_member_addr_from_sockaddr(&sender, envelope_in->sender, envelope_in->sender_len);
+    if (addr_result < 0) return addr_result;
 
-    if (res == VC_BEFORE) {
-        // Add the data to our internal log.
-        gossip_data_log(&self->data_log, &msg);
+    cluster_bool_t is_new = CLUSTER_FALSE;
+    int accept_result = gossip_data_accept(self, &msg, &is_new);
+    if (accept_result < 0) return accept_result;
 
+    if (is_new) {
         if (self->data_receiver) {
             // Invoke the data receiver callback specified by the user.
             self->data_receiver(self->data_receiver_context, self, msg.data, msg.data_size);
         }
-        // Enqueue the same message to send it to N random members later.
-        return gossip_enqueue_message(self, MESSAGE_DATA_TYPE, &msg, NULL, 0, GOSSIP_RANDOM);
+        // The link the message arrived over is a part of the broadcast tree.
+        if (eager_push) {
+            gossip_broadcast_tree_t *tree = gossip_broadcast_tree_get(self, msg.data_version.member_id);
+            if (tree == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+            int result = gossip_eager_peer_add(self, tree, &sender);
+            if (result < 0) return result;
+        }
+        // Send the same message further.
+        return gossip_spread_data(self, &msg, &sender);
+    }
+    if (eager_push) {
+        // The message has already arrived over another path, so
+        // this link is redundant.
+        gossip_broadcast_tree_t *tree = gossip_broadcast_tree_find(self, msg.data_version.member_id);
+        if (tree != NULL) gossip_eager_peer_remove(tree, &sender);
+        message_prune_t prune_msg;
+        message_header_init(&prune_msg.header, MESSAGE_PRUNE_TYPE, 0);
+        vector_clock_record_copy(&prune_msg.data_version, &msg.data_version);
+        return gossip_enqueue_message(self, MESSAGE_PRUNE_TYPE, &prune_msg,
+                                      envelope_in->sender, envelope_in->sender_len, GOSSIP_DIRECT);
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_handle_ihave(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+    RETURN_IF_NOT_CONNECTED(self->state);
+    message_ihave_t msg;
+    int decode_result = message_ihave_decode(envelope_in->buffer, envelope_in->buffer_size, &msg);
+    if (decode_result < 0) return decode_result;
+
+    vector_clock_comp_res_t res = vector_clock_compare_with_record(&self->data_version,
+                                                                   &msg.data_version, CLUSTER_FALSE);
+    if (res != VC_BEFORE || gossip_data_log_contains(&self->data_log, &msg.data_version)) return CLUSTER_ERR_NONE;
+
+    cluster_member_addr_t announcer;
+    int addr_result = cluster_member_addr_from_sockaddr(&announcer, envelope_in->sender, envelope_in->sender_len);
+    if (addr_result < 0) return addr_result;
+
+    gossip_missing_data_t *missing = NULL;
+    for (uint32_t i = 0; i < self->missing_data_num && missing == NULL; ++i) {
+        if (self->missing_data[i].data_version.member_id == msg.data_version.member_id) {
+            missing = &self->missing_data[i];
+        }
+    }
+    if (missing == NULL) {
+        // Give the eager push a chance to deliver the message first.
+        if (self->missing_data_num == GOSSIP_PLUMTREE_MISSING) return CLUSTER_ERR_NONE;
+        missing = &self->missing_data[self->missing_data_num++];
+        memset(missing, 0, sizeof(gossip_missing_data_t));
+        missing->deadline = cluster_time() + self->config.ihave_timeout;
+    }
+    if (msg.data_version.sequence_number > missing->data_version.sequence_number) {
+        vector_clock_record_copy(&missing->data_version, &msg.data_version);
+    }
+    for (uint8_t i = 0; i < missing->announcers_num; ++i) {
+        if (cluster_member_addr_equals(&missing->announcers[i], &announcer)) return CLUSTER_ERR_NONE;
+    }
+    if (missing->announcers_num < GOSSIP_PLUMTREE_ANNOUNCERS) {
+        missing->announcers[missing->announcers_num++] = announcer;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_handle_graft(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+    RETURN_IF_NOT_CONNECTED(self->state);
+    message_graft_t msg;
+    int decode_result = message_graft_decode(envelope_in->buffer, envelope_in->buffer_size, &msg);
+    if (decode_result < 0) return decode_result;
+
+    cluster_member_addr_t requester;
+    int result = cluster_member_addr_from_sockaddr(&requester, envelope_in->sender, envelope_in->sender_len);
+    if (result < 0) return result;
+    gossip_broadcast_tree_t *tree = gossip_broadcast_tree_get(self, msg.data_version.member_id);
+    if (tree == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+    result = gossip_eager_peer_add(self, tree, &requester);
+    if (result < 0) return result;
+
+    data_log_stream_t *stream = gossip_data_log_find(&self->data_log, &msg.data_version.member_id);
+    if (stream == NULL || stream->latest < msg.data_version.sequence_number) return CLUSTER_ERR_NONE;
+    // Prefer the requested message. If it's no longer logged, the latest
+    // one at least advances the requester's version.
+    const data_log_record_t *record = gossip_data_log_record(&self->data_log, stream,
+                                                             msg.data_version.sequence_number);
+    if (record == NULL) record = gossip_data_log_record(&self->data_log, stream, stream->latest);
+    if (record != NULL && record->data_size > gossip_data_max_size(self)) {
+        const cluster_member_t *member = cluster_member_set_find(&self->members, &requester);
+        if (member == NULL || !gossip_member_supports_fragments(member)) return CLUSTER_ERR_NONE;
+        vector_record_t version = {.member_id = stream->member_id, .sequence_number = record->sequence_number};
+        return gossip_enqueue_fragment(self, &version, record->data, record->data_size,
+                                       gossip_fragment_size(self, member), 0,
+                                       envelope_in->sender, envelope_in->sender_len);
+    }
+    if (record != NULL) {
+        message_data_t data_msg;
+        gossip_data_log_create_message(stream, record, &data_msg);
+        data_msg.header.flags = MESSAGE_FLAG_EAGER_PUSH;
+        return gossip_enqueue_message(self, MESSAGE_DATA_TYPE, &data_msg,
+                                      envelope_in->sender, envelope_in->sender_len, GOSSIP_DIRECT);
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_handle_prune(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+    RETURN_IF_NOT_CONNECTED(self->state);
+    message_prune_t msg;
+    int decode_result = message_prune_decode(envelope_in->buffer, envelope_in->buffer_size, &msg);
+    if (decode_result < 0) return decode_result;
+
+    cluster_member_addr_t sender;
+    int addr_result = cluster_member_addr_from_sockaddr(&sender, envelope_in->sender, envelope_in->sender_len);
+    if (addr_result < 0) return addr_result;
+    gossip_broadcast_tree_t *tree = gossip_broadcast_tree_find(self, msg.data_version.member_id);
+    if (tree != NULL) gossip_eager_peer_remove(tree, &sender);
+    return CLUSTER_ERR_NONE;
+}
+
+/* Delivers the reassembled payload and announces it further. */
+static int gossip_reassembly_complete(cluster_gossip_t *self, gossip_reassembly_t *reassembly,
+                                      const cluster_member_addr_t *sender) {
+    message_data_t data_msg;
+    message_header_init(&data_msg.header, MESSAGE_DATA_TYPE, 0);
+    vector_clock_record_copy(&data_msg.data_version, &reassembly->data_version);
+    data_msg.data = reassembly->data;
+    data_msg.data_size = reassembly->total_size;
+
+    cluster_bool_t is_new = CLUSTER_FALSE;
+    int result = gossip_data_accept(self, &data_msg, &is_new);
+    if (result == CLUSTER_ERR_NONE && is_new) {
+        if (self->data_receiver) {
+            self->data_receiver(self->data_receiver_context, self, data_msg.data, data_msg.data_size);
+        }
+        result = gossip_fragment_announce(self, &data_msg, sender);
+    }
+    gossip_reassembly_remove(self, reassembly);
+    return result;
+}
+
+static int gossip_handle_data_fragment(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+    RETURN_IF_NOT_CONNECTED(self->state);
+    message_data_fragment_t msg;
+    int decode_result = message_data_fragment_decode(envelope_in->buffer, envelope_in->buffer_size, &msg);
+    if (decode_result < 0) return decode_result;
+
+    uint32_t fragments_num = gossip_fragments_num(msg.total_size, msg.fragment_size);
+    uint32_t offset = (uint32_t) msg.fragment_index * msg.fragment_size;
+    if (msg.data_version.sequence_number == 0 || fragments_num > UINT16_MAX ||
+        msg.fragment_index >= fragments_num ||
+        msg.data_size != (msg.total_size - offset < msg.fragment_size ? msg.total_size - offset : msg.fragment_size)) {
+        return CLUSTER_ERR_INVALID_MESSAGE;
+    }
+    vector_clock_comp_res_t res = vector_clock_compare_with_record(&self->data_version,
+                                                                   &msg.data_version, CLUSTER_FALSE);
+    if (res != VC_BEFORE || gossip_data_log_contains(&self->data_log, &msg.data_version)) return CLUSTER_ERR_NONE;
+
+    cluster_member_addr_t sender;
+    int result = cluster_member_addr_from_sockaddr(&sender, envelope_in->sender, envelope_in->sender_len);
+    if (result < 0) return result;
+
+    uint64_t current_ts = cluster_time();
+    gossip_reassembly_t *reassembly = gossip_reassembly_find(self, &msg.data_version);
+    if (reassembly == NULL) {
+        result = gossip_reassembly_start(self, &msg, fragments_num, current_ts, &reassembly);
+        if (result < 0) return result;
+        // Out of room. The payload is announced again by anti-entropy.
+        if (reassembly == NULL) return CLUSTER_ERR_NONE;
+    }
+    if (msg.total_size != reassembly->total_size) return CLUSTER_ERR_INVALID_MESSAGE;
+    // A member which cut fragments at least as large as ours can also serve fragments
+    // of our size. Smaller messages of the member can't carry them.
+    if (msg.fragment_size >= reassembly->fragment_size) {
+        cluster_bool_t is_source = CLUSTER_FALSE;
+        for (uint8_t i = 0; i < reassembly->sources_num && !is_source; ++i) {
+            is_source = cluster_member_addr_equals(&reassembly->sources[i], &sender);
+        }
+        if (!is_source && reassembly->sources_num < DATA_FRAGMENT_SOURCES) {
+            reassembly->sources[reassembly->sources_num++] = sender;
+        }
+    }
+    // Fragments cut by a member with a different message size can't be combined.
+    if (msg.fragment_size != reassembly->fragment_size) return CLUSTER_ERR_NONE;
+
+    if (!gossip_reassembly_has(reassembly, msg.fragment_index)) {
+        memcpy(reassembly->data + offset, msg.data, msg.data_size);
+        reassembly->received[msg.fragment_index / 64] |= 1ULL << (msg.fragment_index % 64);
+        ++reassembly->received_num;
+        reassembly->last_progress_ts = current_ts;
+        reassembly->deadline = current_ts + DATA_FRAGMENT_TIMEOUT;
+    }
+    if (reassembly->received_num == reassembly->fragments_num) {
+        return gossip_reassembly_complete(self, reassembly, &sender);
+    }
+    gossip_reassembly_acknowledge(reassembly, msg.fragment_index);
+    // Keep the pipe to the source full without waiting for every single fragment.
+    if (reassembly->in_flight_num > DATA_FRAGMENT_WINDOW / 2 && reassembly->lost_num == 0) return CLUSTER_ERR_NONE;
+    return gossip_reassembly_request(self, reassembly, current_ts);
+}
+
+static int gossip_handle_fragment_request(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+    RETURN_IF_NOT_CONNECTED(self->state);
+    message_fragment_request_t msg;
+    int decode_result = message_fragment_request_decode(envelope_in->buffer, envelope_in->buffer_size, &msg);
+    if (decode_result < 0) return decode_result;
+    // The requested fragments must fit into messages of this node.
+    if (msg.fragment_size == 0 ||
+        msg.fragment_size > self->config.message_max_size - MESSAGE_DATA_FRAGMENT_OVERHEAD) {
+        return CLUSTER_ERR_NONE;
+    }
+
+    const data_log_stream_t *stream = gossip_data_log_find(&self->data_log, &msg.data_version.member_id);
+    if (stream == NULL) return CLUSTER_ERR_NONE;
+    const data_log_record_t *record = gossip_data_log_record(&self->data_log, stream,
+                                                             msg.data_version.sequence_number);
+    if (record == NULL) return CLUSTER_ERR_NONE;
+    uint32_t fragments_num = gossip_fragments_num(record->data_size, msg.fragment_size);
+    for (uint8_t i = 0; i < msg.fragments_n; ++i) {
+        if (msg.fragments[i] >= fragments_num) continue;
+        int result = gossip_enqueue_fragment(self, &msg.data_version, record->data, record->data_size,
+                                             msg.fragment_size, msg.fragments[i],
+                                             envelope_in->sender, envelope_in->sender_len);
+        if (result < 0) return result;
     }
     return CLUSTER_ERR_NONE;
 }
@@ -586,7 +3113,14 @@ static int gossip_handle_ack(cluster_gossip_t *self, const message_envelope_in_t
             gossip_envelope_find_by_sequence_num(&self->outbound_messages,
                                                  msg.ack_sequence_num);
     if (ack_envelope != NULL) gossip_envelope_remove(&self->outbound_messages, ack_envelope);
-    return CLUSTER_ERR_NONE;
+
+    cluster_member_addr_t sender;
+    if (cluster_member_addr_from_sockaddr(&sender, envelope_in->sender, envelope_in->sender_len) == CLUSTER_ERR_NONE) {
+        gossip_status_peer_handle_ack(self, &sender, msg.ack_sequence_num);
+    }
+
+    // The Ack might be a response to one of the probes.
+    return gossip_probe_handle_ack(self, msg.ack_sequence_num);
 }
 
 static int gossip_handle_status(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
@@ -597,11 +3131,39 @@ static int gossip_handle_status(cluster_gossip_t *self, const message_envelope_i
         return decode_result;
     }
 
+    cluster_member_addr_t sender;
+    int result = cluster_member_addr_from_sockaddr(&sender, envelope_in->sender, envelope_in->sender_len);
+    if (result < 0) {
+        message_status_destroy(&msg);
+        return result;
+    }
+    // The clock is kept even if the sender isn't known yet, since it might
+    // use this message as the base of deltas once it's acknowledged.
+    gossip_status_peer_t *peer = gossip_status_peer_get(self, &sender);
+    if (peer != NULL && (msg.header.flags & MESSAGE_FLAG_STATUS_RESYNC)) {
+        // The sender has lost the base of deltas from this node.
+        peer->acked_seq = 0;
+        peer->sent_seq = 0;
+    }
+
+    int base_slot = -1;
+    if (msg.header.flags & MESSAGE_FLAG_STATUS_DELTA) {
+        for (int i = 0; peer != NULL && i < 2; ++i) {
+            if (peer->received_seq[i] != 0 && peer->received_seq[i] == msg.base_sequence_num) base_slot = i;
+        }
+        if (base_slot < 0) {
+            // The base is unknown. Instead of acknowledging the message ask
+            // the sender for the full clock.
+            return gossip_enqueue_status_to(self, &sender, MESSAGE_FLAG_STATUS_RESYNC);
+        }
+        decode_result = message_status_delta_decode(&msg, &peer->received[base_slot]);
+        if (decode_result < 0) return decode_result;
+    }
+    if (peer != NULL) gossip_status_peer_receive(peer, msg.header.sequence_num, &msg.data_version, base_slot);
+
     // Acknowledge the arrived Status message.
     gossip_enqueue_ack(self, msg.header.sequence_num, envelope_in->sender, envelope_in->sender_len);
 
-    int result = CLUSTER_ERR_NONE;
-
     vector_clock_comp_res_t comp_res = vector_clock_compare(&self->data_version, &msg.data_version, CLUSTER_FALSE);
     switch (comp_res) {
         case VC_AFTER:
@@ -611,25 +3173,60 @@ static int gossip_handle_status(cluster_gossip_t *self, const message_envelope_i
             break;
         case VC_BEFORE:
             // This node is behind. Send back the Status message to request the data update.
-            result = gossip_enqueue_status(self, envelope_in->sender, envelope_in->sender_len);
+            result = gossip_enqueue_status_to(self, &sender, 0);
             break;
         case VC_CONFLICT:
             // The conflict occurred. Both nodes should exchange the data with each other.
             // Send the data messages from the log.
             result = gossip_enqueue_data_log(self, &msg.data_version,
                                              envelope_in->sender, envelope_in->sender_len);
-            if (result < 0) return result;
+            if (result < 0) break;
             // Request the data update.
-            result = gossip_enqueue_status(self, envelope_in->sender, envelope_in->sender_len);
+            result = gossip_enqueue_status_to(self, &sender, 0);
             break;
         default:
             break;
     }
 
+    message_status_destroy(&msg);
     return result;
 }
 
-static int gossip_handle_new_message(cluster_gossip_t *self, const message_envelope_in_t *envelope_in) {
+static int gossip_handle_piggyback(cluster_gossip_t *self, message_envelope_in_t *envelope_in) {
+    const uint8_t *members = NULL;
+    size_t members_size = 0;
+    uint8_t members_n = 0;
+    int payload_size = message_piggyback_decode(envelope_in->buffer, envelope_in->buffer_size,
+                                                &members, &members_size, &members_n);
+    if (payload_size < 0) return payload_size;
+    // The message itself is handled as if there were no trailer.
+    envelope_in->buffer_size = payload_size;
+
+    if (self->state != STATE_CONNECTED) return CLUSTER_ERR_NONE;
+    uint64_t current_ts = cluster_time();
+    const uint8_t *cursor = members;
+    const uint8_t *members_end = members + members_size;
+    for (int i = 0; i < members_n; ++i) {
+        cluster_member_t member;
+        int decode_result = cluster_member_compact_decode(cursor, members_end - cursor, &member,
+                                                          MEMBER_ENCODE_LIVENESS);
+        if (decode_result < 0) return decode_result;
+        cursor += decode_result;
+        gossip_apply_member_update(self, &member, CLUSTER_TRUE, current_ts);
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+static int gossip_handle_new_message(cluster_gossip_t *self, const message_envelope_in_t *original_envelope_in) {
+    message_envelope_in_t envelope = *original_envelope_in;
+    const message_envelope_in_t *envelope_in = &envelope;
+    int message_flags = message_flags_decode(envelope.buffer, envelope.buffer_size);
+    if (message_flags < 0) return message_flags;
+    if (message_flags & MESSAGE_FLAG_PIGGYBACK) {
+        int piggyback_result = gossip_handle_piggyback(self, &envelope);
+        if (piggyback_result < 0) return piggyback_result;
+    }
+
     int message_type = message_type_decode(envelope_in->buffer, envelope_in->buffer_size);
     int result = 0;
     switch(message_type) {
@@ -651,19 +3248,160 @@ static int gossip_handle_new_message(cluster_gossip_t *self, const message_envel
         case MESSAGE_STATUS_TYPE:
             result = gossip_handle_status(self, envelope_in);
             break;
+        case MESSAGE_PING_TYPE:
+            result = gossip_handle_ping(self, envelope_in);
+            break;
+        case MESSAGE_PING_REQ_TYPE:
+            result = gossip_handle_ping_req(self, envelope_in);
+            break;
+        case MESSAGE_INDIRECT_ACK_TYPE:
+            result = gossip_handle_indirect_ack(self, envelope_in);
+            break;
+        case MESSAGE_DIGEST_TYPE:
+            result = gossip_handle_digest(self, envelope_in);
+            break;
+        case MESSAGE_IHAVE_TYPE:
+            result = gossip_handle_ihave(self, envelope_in);
+            break;
+        case MESSAGE_GRAFT_TYPE:
+            result = gossip_handle_graft(self, envelope_in);
+            break;
+        case MESSAGE_PRUNE_TYPE:
+            result = gossip_handle_prune(self, envelope_in);
+            break;
+        case MESSAGE_FORWARD_JOIN_TYPE:
+            result = gossip_handle_forward_join(self, envelope_in);
+            break;
+        case MESSAGE_NEIGHBOR_TYPE:
+            result = gossip_handle_neighbor(self, envelope_in);
+            break;
+        case MESSAGE_SHUFFLE_TYPE:
+            result = gossip_handle_shuffle(self, envelope_in);
+            break;
+        case MESSAGE_DISCONNECT_TYPE:
+            result = gossip_handle_disconnect(self, envelope_in);
+            break;
+        case MESSAGE_DATA_FRAGMENT_TYPE:
+            result = gossip_handle_data_fragment(self, envelope_in);
+            break;
+        case MESSAGE_FRAGMENT_REQUEST_TYPE:
+            result = gossip_handle_fragment_request(self, envelope_in);
+            break;
         default:
             return CLUSTER_ERR_INVALID_MESSAGE;
     }
     return result;
 }
 
+void cluster_gossip_config_init(cluster_gossip_config_t *config) {
+    config->retry_interval = MESSAGE_RETRY_INTERVAL;
+    config->retry_attempts = MESSAGE_RETRY_ATTEMPTS;
+    config->rumor_factor = MESSAGE_RUMOR_FACTOR;
+    config->message_max_size = MESSAGE_MAX_SIZE;
+    config->max_output_messages = MAX_OUTPUT_MESSAGES;
+    config->tick_interval = GOSSIP_TICK_INTERVAL;
+    config->data_log_size = DATA_LOG_SIZE;
+    config->data_log_depth = DATA_LOG_DEPTH;
+    config->data_log_max_bytes = DATA_LOG_MAX_BYTES;
+    config->data_reassembly_max_bytes = DATA_REASSEMBLY_MAX_BYTES;
+    config->data_reassembly_timeout = DATA_REASSEMBLY_TIMEOUT;
+    config->probe_interval = GOSSIP_PROBE_INTERVAL;
+    config->probe_timeout = GOSSIP_PROBE_TIMEOUT;
+    config->probe_indirect_members = GOSSIP_PROBE_INDIRECT_MEMBERS;
+    config->suspicion_mult = GOSSIP_SUSPICION_MULT;
+    config->piggyback_mult = GOSSIP_PIGGYBACK_MULT;
+    config->sync_interval = GOSSIP_SYNC_INTERVAL;
+    config->plumtree = GOSSIP_PLUMTREE;
+    config->ihave_timeout = GOSSIP_IHAVE_TIMEOUT;
+    config->active_view_size = GOSSIP_ACTIVE_VIEW_SIZE;
+    config->passive_view_size = GOSSIP_PASSIVE_VIEW_SIZE;
+    config->shuffle_interval = GOSSIP_SHUFFLE_INTERVAL;
+    config->data_log_path = NULL;
+    config->member_snapshot_path = NULL;
+    config->member_snapshot_interval = MEMBER_SNAPSHOT_INTERVAL;
+}
+
+static int gossip_config_validate(const cluster_gossip_config_t *config) {
+    // At least a single member must fit into the Member List message.
+    size_t min_message_size = sizeof(message_header_t) + sizeof(uint16_t) + CLUSTER_MEMBER_SIZE;
+    if (config->message_max_size < min_message_size) return CLUSTER_ERR_INIT_FAILED;
+    if (config->message_max_size < MESSAGE_DIGEST_SIZE) return CLUSTER_ERR_INIT_FAILED;
+    if (config->sync_interval > INT32_MAX) return CLUSTER_ERR_INIT_FAILED;
+    if (config->ihave_timeout == 0 || config->ihave_timeout > INT32_MAX) return CLUSTER_ERR_INIT_FAILED;
+    if (config->active_view_size > 0) {
+        if (config->passive_view_size == 0) return CLUSTER_ERR_INIT_FAILED;
+        if (config->shuffle_interval == 0 || config->shuffle_interval > INT32_MAX) return CLUSTER_ERR_INIT_FAILED;
+    }
+    if (config->retry_attempts == 0 || config->rumor_factor == 0) return CLUSTER_ERR_INIT_FAILED;
+    if (config->max_output_messages == 0 || config->data_log_size == 0) return CLUSTER_ERR_INIT_FAILED;
+    if (config->data_log_depth == 0 || config->data_log_max_bytes == 0) return CLUSTER_ERR_INIT_FAILED;
+    if (config->data_reassembly_timeout == 0 || config->data_reassembly_timeout > INT32_MAX) {
+        return CLUSTER_ERR_INIT_FAILED;
+    }
+    if (config->member_snapshot_path != NULL &&
+        (config->member_snapshot_interval == 0 || config->member_snapshot_interval > INT32_MAX)) {
+        return CLUSTER_ERR_INIT_FAILED;
+    }
+    if (config->tick_interval == 0 || config->tick_interval > INT32_MAX) return CLUSTER_ERR_INIT_FAILED;
+    // The whole probe including the indirect phase must complete within a single protocol period.
+    if (config->probe_interval > INT32_MAX) return CLUSTER_ERR_INIT_FAILED;
+    if (config->probe_timeout == 0 || config->probe_timeout >= config->probe_interval) return CLUSTER_ERR_INIT_FAILED;
+    if (config->suspicion_mult == 0 || config->piggyback_mult == 0) return CLUSTER_ERR_INIT_FAILED;
+    return CLUSTER_ERR_NONE;
+}
+
+static void gossip_buffers_destroy(cluster_gossip_t *self) {
+    free(self->input_buffer);
+    free(self->output_buffer);
+    free(self->output_trailer);
+    free(self->reservoir);
+    free(self->suspicions);
+    free(self->probe.order);
+    gossip_status_peers_destroy(self);
+    for (uint32_t i = 0; i < self->trees_num; ++i) free(self->trees[i].eager_peers);
+    free(self->trees);
+    gossip_reassemblies_destroy(self);
+    gossip_data_log_destroy(&self->data_log);
+    self->input_buffer = NULL;
+    self->output_buffer = NULL;
+    self->output_trailer = NULL;
+    self->reservoir = NULL;
+}
+
+static int gossip_buffers_init(cluster_gossip_t *self) {
+    const cluster_gossip_config_t *config = &self->config;
+    self->input_buffer = (uint8_t *) malloc(MESSAGE_RECV_BATCH_SIZE * config->message_max_size);
+    self->output_buffer = (uint8_t *) malloc((size_t) config->max_output_messages * config->message_max_size);
+    self->output_trailer = (uint8_t *) malloc(MESSAGE_SEND_BATCH_SIZE * config->message_max_size);
+    // The reservoir is shared by the gossip propagation and the failure detector,
+    // which also needs to skip the probe target.
+    self->reservoir_size = config->rumor_factor;
+    if (self->reservoir_size < config->probe_indirect_members + 1) {
+        self->reservoir_size = config->probe_indirect_members + 1;
+    }
+    self->reservoir = (cluster_member_t **) malloc(self->reservoir_size * sizeof(cluster_member_t *));
+    if (self->input_buffer == NULL || self->output_buffer == NULL ||
+        self->output_trailer == NULL || self->reservoir == NULL ||
+        gossip_data_log_init(&self->data_log, config->data_log_size,
+                              config->data_log_depth, config->data_log_max_bytes) < 0) {
+        gossip_buffers_destroy(self);
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
 static int cluster_gossip_init(cluster_gossip_t *self,
                                 const cluster_addr_t *self_addr,
                                 data_receiver_t data_receiver, 
                                 void *data_receiver_context,
                                 const char *uname) {
+    if (gossip_buffers_init(self) < 0) {
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    }
+
     self->socket = cluster_socket_datagram((const cluster_sockaddr_storage *) self_addr->addr, self_addr->addr_len);
     if (self->socket < 0) {
+        gossip_buffers_destroy(self);
         return CLUSTER_ERR_INIT_FAILED;
     }
 
@@ -671,25 +3409,65 @@ static int cluster_gossip_init(cluster_gossip_t *self,
     cluster_socklen_t updated_self_addr_size = sizeof(cluster_sockaddr_storage);
     if (cluster_get_sock_name(self->socket, &updated_self_addr, &updated_self_addr_size) < 0) {
         cluster_close(self->socket);
+        gossip_buffers_destroy(self);
         return CLUSTER_ERR_INIT_FAILED;
     }
 
+    // Point each slot of the receive vector to its own input buffer.
+    for (int i = 0; i < MESSAGE_RECV_BATCH_SIZE; ++i) {
+        self->input_iov[i].iov_base = self->input_buffer + i * self->config.message_max_size;
+        self->input_iov[i].iov_len = self->config.message_max_size;
+        memset(&self->input_msgs[i], 0, sizeof(cluster_mmsghdr));
+        self->input_msgs[i].msg_hdr.msg_name = &self->input_addr[i];
+        self->input_msgs[i].msg_hdr.msg_iov = &self->input_iov[i];
+        self->input_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
     self->output_buffer_offset = 0;
+    self->output_batch_size = 0;
 
-    self->outbound_messages = (message_queue_t ) { .head = NULL, .tail = NULL };
+    if (gossip_queue_init(&self->outbound_messages, self->config.max_output_messages) < 0) {
+        cluster_close(self->socket);
+        gossip_buffers_destroy(self);
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    }
 
     self->sequence_num = 0;
     self->data_counter = 0;
     vector_clock_init(&self->data_version);
+    if (self->config.member_snapshot_path != NULL) {
+        self->member_snapshot_path = strdup(self->config.member_snapshot_path);
+    }
+    if ((self->config.member_snapshot_path != NULL && self->member_snapshot_path == NULL) ||
+        gossip_journal_open(self) < 0) {
+        free(self->member_snapshot_path);
+        gossip_journal_close(self);
+        vector_clock_destroy(&self->data_version);
+        gossip_queue_destroy(&self->outbound_messages);
+        cluster_close(self->socket);
+        gossip_buffers_destroy(self);
+        return CLUSTER_ERR_INIT_FAILED;
+    }
 
     self->state = STATE_INITIALIZED;
     cluster_member_init(&self->self_address, &updated_self_addr, updated_self_addr_size, uname, strlen(uname));
+    self->self_address.max_message_size = self->config.message_max_size;
+    // Continue the data counter restored from the journal, otherwise peers
+    // would treat new messages of this node as already seen.
+    vector_record_t self_record;
+    if (vector_clock_find_record(&self->data_version, &self->self_address, &self_record) == CLUSTER_ERR_NONE) {
+        self->data_counter = self_record.sequence_number;
+    }
     cluster_member_set_init(&self->members);
-
-    self->data_log.current_idx = 0;
-    self->data_log.size = 0;
+    if (self->config.active_view_size > 0) {
+        cluster_member_set_enable_views(&self->members, self->config.passive_view_size);
+    }
 
     self->last_gossip_ts = 0;
+    self->last_sync_ts = 0;
+    self->last_shuffle_ts = 0;
+    self->last_repair_ts = 0;
+    self->last_snapshot_ts = 0;
 
     self->data_receiver = data_receiver;
     self->data_receiver_context = data_receiver_context;
@@ -700,9 +3478,36 @@ cluster_gossip_t *cluster_gossip_create(const cluster_addr_t *self_addr,
                                           data_receiver_t data_receiver, 
                                           void *data_receiver_context,
                                           const char *uname) {
-    cluster_gossip_t *result = (cluster_gossip_t *) malloc(sizeof(cluster_gossip_t));
+    return cluster_gossip_create_ex(self_addr, data_receiver, data_receiver_context, uname, NULL);
+}
+
+cluster_gossip_t *cluster_gossip_create_ex(const cluster_addr_t *self_addr,
+                                           data_receiver_t data_receiver,
+                                           void *data_receiver_context,
+                                           const char *uname,
+                                           const cluster_gossip_config_t *config) {
+    cluster_gossip_t *result = (cluster_gossip_t *) calloc(1, sizeof(cluster_gossip_t));
     if (result == NULL) return NULL;
 
+    if (config != NULL) {
+        result->config = *config;
+    } else {
+        cluster_gossip_config_init(&result->config);
+    }
+    // Larger datagrams would be fragmented by IP, where a single lost
+    // fragment loses the whole message.
+    int datagram_size = cluster_max_datagram_size((const cluster_sockaddr_storage *) self_addr->addr);
+    if (result->config.message_max_size == 0) {
+        result->config.message_max_size = datagram_size > 0 ? datagram_size : MESSAGE_LEGACY_MAX_SIZE;
+    } else if (datagram_size > 0 && result->config.message_max_size > datagram_size) {
+        result->config.message_max_size = datagram_size;
+    }
+    if (gossip_config_validate(&result->config) < 0) {
+        free(result);
+        errno = EINVAL;
+        return NULL;
+    }
+
     int int_res = cluster_gossip_init(result, self_addr, data_receiver, data_receiver_context, uname);
     if (int_res < 0) {
         free(result);
@@ -714,9 +3519,15 @@ cluster_gossip_t *cluster_gossip_create(const cluster_addr_t *self_addr,
 int cluster_gossip_destroy(cluster_gossip_t *self) {
     cluster_close(self->socket);
 
-    gossip_envelope_clear(&self->outbound_messages);
+    gossip_queue_destroy(&self->outbound_messages);
+    // The data log is still needed to persist the final state.
+    gossip_journal_close(self);
+    if (self->member_snapshot_path != NULL && self->state == STATE_CONNECTED) gossip_member_snapshot(self);
+    free(self->member_snapshot_path);
+    gossip_buffers_destroy(self);
 
     self->state = STATE_DESTROYED;
+    vector_clock_destroy(&self->data_version);
     cluster_member_destroy(&self->self_address);
     cluster_member_set_destroy(&self->members);
 
@@ -724,6 +3535,51 @@ int cluster_gossip_destroy(cluster_gossip_t *self) {
     return CLUSTER_ERR_NONE;
 }
 
+int cluster_gossip_join_from_snapshot(cluster_gossip_t *self,
+                                      const cluster_addr_t *seed_nodes, uint16_t seed_nodes_len) {
+    if (self->state != STATE_INITIALIZED) return CLUSTER_ERR_BAD_STATE;
+    cluster_member_t *snapshot = NULL;
+    int snapshot_size = CLUSTER_ERR_NOT_FOUND;
+    if (self->member_snapshot_path != NULL) {
+        snapshot_size = cluster_member_snapshot_read(self->member_snapshot_path, &snapshot);
+    }
+    if (snapshot_size < 0 && snapshot_size != CLUSTER_ERR_NOT_FOUND && snapshot_size != CLUSTER_ERR_READ_FAILED) {
+        log_warn("Ignoring the member snapshot: %d", snapshot_size);
+    }
+    // Members from the snapshot which are gone by now are suspected
+    // and removed by the failure detector like any other member.
+    for (int i = 0; i < snapshot_size; ++i) {
+        if (cluster_member_addr_equals(&snapshot[i].address, &self->self_address.address)) continue;
+        snapshot[i].state = MEMBER_ALIVE;
+        int put_result = cluster_member_set_update(&self->members, &snapshot[i]);
+        if (put_result < 0) {
+            free(snapshot);
+            return put_result;
+        }
+    }
+    free(snapshot);
+    if (self->members.size == 0) return cluster_gossip_join(self, seed_nodes, seed_nodes_len);
+
+    for (int i = 0; i < seed_nodes_len; ++i) {
+        int result = gossip_enqueue_hello(self, (const cluster_sockaddr_storage *) seed_nodes[i].addr,
+                                          seed_nodes[i].addr_len);
+        if (result < 0) return result;
+    }
+    // Greet a few of the restored members as well in case the seed nodes are unavailable.
+    size_t greeted_num = cluster_member_set_random_view(&self->members, self->members.passive_capacity > 0 ?
+                                                        MEMBER_VIEW_PASSIVE : MEMBER_VIEW_ACTIVE,
+                                                        self->reservoir, self->config.rumor_factor);
+    for (size_t i = 0; i < greeted_num; ++i) {
+        cluster_sockaddr_storage member_addr;
+        cluster_socklen_t member_addr_len = cluster_member_addr_to_sockaddr(&self->reservoir[i]->address,
+                                                                            &member_addr);
+        int result = gossip_enqueue_hello(self, &member_addr, member_addr_len);
+        if (result < 0) return result;
+    }
+    self->state = STATE_CONNECTED;
+    return CLUSTER_ERR_NONE;
+}
+
 int cluster_gossip_join(cluster_gossip_t *self, const cluster_addr_t *seed_nodes, uint16_t seed_nodes_len) {
     if (self->state != STATE_INITIALIZED) return CLUSTER_ERR_BAD_STATE;
     if (seed_nodes == NULL || seed_nodes_len == 0) {
@@ -746,7 +3602,8 @@ int cluster_gossip_process_receive(cluster_gossip_t *self) {
     cluster_sockaddr_storage addr;
     cluster_socklen_t addr_len = sizeof(cluster_sockaddr_storage);
     // Read a new message.
-    int read_result = cluster_recv_from(self->socket, self->input_buffer, INPUT_BUFFER_SIZE, &addr, &addr_len);
+    int read_result = cluster_recv_from(self->socket, self->input_buffer, self->config.message_max_size,
+                                        &addr, &addr_len);
     if (read_result <= 0) return CLUSTER_ERR_READ_FAILED;
 
     message_envelope_in_t envelope;
@@ -758,90 +3615,302 @@ int cluster_gossip_process_receive(cluster_gossip_t *self) {
     return gossip_handle_new_message(self, &envelope);
 }
 
-int cluster_gossip_process_send(cluster_gossip_t *self) {
+int cluster_gossip_process_receive_batch(cluster_gossip_t *self, uint32_t max_msgs) {
     if (self->state != STATE_JOINING && self->state != STATE_CONNECTED) return CLUSTER_ERR_BAD_STATE;
-    message_envelope_out_t *head = self->outbound_messages.head;
-    int msg_sent = 0;
-    while (head != NULL) {
-        message_envelope_out_t *current = head;
-        head = head->next;
 
-        if (current->attempt_num >= current->max_attempts) {
-            // The message exceeded the maximum number of attempts.
+    uint32_t msg_handled = 0;
+    while (max_msgs == 0 || msg_handled < max_msgs) {
+        uint32_t batch_size = MESSAGE_RECV_BATCH_SIZE;
+        if (max_msgs != 0 && max_msgs - msg_handled < batch_size) batch_size = max_msgs - msg_handled;
 
-            if (current->max_attempts > 1) {
-                // If the number of maximum attempts is more than 1, then
-                // the message required acknowledgement but we've never received it.
-                // Remove node from the list since it's unreachable.
-                cluster_member_set_remove_by_addr(&self->members,
-                                                  &current->recipient,
-                                                  current->recipient_len);
-                // Quite often the same recipient has several messages in a row.
-                // Check whether the next message should be removed as well.
-                message_envelope_out_t *next = current->next;
-                message_envelope_out_t *to_remove = NULL;
-                while (next != NULL && memcmp(&next->recipient, &current->recipient, next->recipient_len) == 0) {
-                    to_remove = next;
-                    next = next->next;
-                    gossip_envelope_remove(&self->outbound_messages, to_remove);
-                }
-                head = next;
-            }
-            // Remove this message from the queue.
-            gossip_envelope_remove(&self->outbound_messages, current);
-            continue;
+        for (int i = 0; i < batch_size; ++i) {
+            self->input_msgs[i].msg_hdr.msg_namelen = sizeof(cluster_sockaddr_storage);
         }
+        int read_result = cluster_recv_many(self->socket, self->input_msgs, batch_size);
+        if (read_result < 0) return CLUSTER_ERR_READ_FAILED;
+
+        for (int i = 0; i < read_result; ++i) {
+            const cluster_mmsghdr *msg = &self->input_msgs[i];
+            ++msg_handled;
+            // The datagram doesn't fit into the input buffer, so it can't be a valid message.
+            if (msg->msg_hdr.msg_flags & MSG_TRUNC) continue;
+
+            message_envelope_in_t envelope;
+            envelope.buffer = self->input_iov[i].iov_base;
+            envelope.buffer_size = msg->msg_len;
+            envelope.sender = &self->input_addr[i];
+            envelope.sender_len = msg->msg_hdr.msg_namelen;
+
+            // A single malformed or unexpected message must not prevent
+            // the rest of the batch from being processed.
+            int handle_result = gossip_handle_new_message(self, &envelope);
+            if (handle_result < 0) log_warn("Failed to handle message: %d", handle_result);
+        }
+        // A short read means that the socket has been drained.
+        if (read_result < batch_size) break;
+    }
+    return msg_handled;
+}
 
-        uint64_t current_ts = cluster_time();
-        if (current->attempt_num != 0 && current->attempt_ts + MESSAGE_RETRY_INTERVAL > current_ts) {
-            // It's not yet time to retry this message.
-            continue;
+static void gossip_send_batch_add(cluster_gossip_t *self, message_envelope_out_t *envelope) {
+    uint32_t idx = self->output_batch_size++;
+
+    // All recipients of the same message share a single buffer. Each of them
+    // gets its own copy of the header with a sequence number that corresponds
+    // to the envelope, while the message body is sent directly from the
+    // shared buffer.
+    uint8_t *header = self->output_header[idx];
+    memcpy(header, envelope->buffer, sizeof(message_header_t));
+    uint32_t seq_num_n = CLUSTER_HTONL(envelope->sequence_num);
+    uint32_t offset = sizeof(message_header_t) - sizeof(uint32_t);
+    memcpy(header + offset, &seq_num_n, sizeof(uint32_t));
+
+    // Membership events are piggybacked into the spare room of the datagram.
+    size_t trailer_size = 0;
+    uint8_t *trailer = self->output_trailer + (size_t) idx * self->config.message_max_size;
+    self->output_piggyback_num[idx] = 0;
+    uint8_t message_type = envelope->buffer[PROTOCOL_ID_LENGTH];
+    if (self->piggyback_num > 0 &&
+        (message_type == MESSAGE_STATUS_TYPE || message_type == MESSAGE_DATA_TYPE ||
+         message_type == MESSAGE_ACK_TYPE)) {
+        const cluster_member_t *recipient = cluster_member_set_find_by_addr(&self->members,
+                                                                            &envelope->recipient,
+                                                                            envelope->recipient_len);
+        size_t max_size = gossip_member_max_size(self, recipient);
+        if (recipient != NULL && gossip_member_supports_piggyback(recipient) &&
+            envelope->buffer_size < max_size) {
+            trailer_size = gossip_piggyback_encode(self, trailer, max_size - envelope->buffer_size,
+                                                   self->output_piggyback[idx], &self->output_piggyback_num[idx]);
         }
+    }
+    if (trailer_size > 0) {
+        uint16_t flags = uint16_decode(header + MESSAGE_FLAGS_OFFSET);
+        uint16_encode(flags | MESSAGE_FLAG_PIGGYBACK, header + MESSAGE_FLAGS_OFFSET);
+    }
+
+    struct iovec *iov = self->output_iov[idx];
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(message_header_t);
+    iov[1].iov_base = (uint8_t *) envelope->buffer + sizeof(message_header_t);
+    iov[1].iov_len = envelope->buffer_size - sizeof(message_header_t);
+
+    iov[2].iov_base = trailer;
+    iov[2].iov_len = trailer_size;
 
-        // Update the sequence number in the buffer in order to correspond to
-        // a sequence number stored in envelope. This approach violates
-        // the protocol interface but prevents copying of the whole
-        // buffer each time when a single message has multiple recipients.
-        uint32_t seq_num_n = CLUSTER_HTONL(current->sequence_num);
-        uint32_t offset = sizeof(message_header_t) - sizeof(uint32_t);
-        uint8_t *seq_num_buf = (uint8_t *) current->buffer + offset;
-        memcpy(seq_num_buf, &seq_num_n, sizeof(uint32_t));
+    cluster_mmsghdr *msg = &self->output_msgs[idx];
+    memset(msg, 0, sizeof(cluster_mmsghdr));
+    msg->msg_hdr.msg_name = &envelope->recipient;
+    msg->msg_hdr.msg_namelen = envelope->recipient_len;
+    msg->msg_hdr.msg_iov = iov;
+    msg->msg_hdr.msg_iovlen = trailer_size > 0 ? 3 : 2;
 
-        int write_result = cluster_send_to(self->socket, current->buffer, current->buffer_size,
-                                      &current->recipient, current->recipient_len);
+    self->output_batch[idx] = envelope;
+}
+
+static void gossip_envelope_attempted(cluster_gossip_t *self, message_envelope_out_t *envelope,
+                                      uint64_t current_ts) {
+    message_queue_t *queue = &self->outbound_messages;
+    envelope->attempt_ts = current_ts;
+    ++envelope->attempt_num;
+    if (envelope->max_attempts <= 1) {
+        // The message must be sent only once. Remove it immediately.
+        gossip_envelope_remove(queue, envelope);
+    } else {
+        // The heap never shrinks, so there is always room for a timer
+        // that has just been taken out of it.
+        cluster_timer_heap_schedule(&queue->due, &envelope->retry_timer,
+                                    current_ts + self->config.retry_interval);
+    }
+}
 
+/* Sends the batch and returns the number of sent datagrams. is_blocked is
+ * set if the socket buffer is full and the rest of the batch has to wait. */
+static int gossip_send_batch_flush(cluster_gossip_t *self, uint64_t current_ts, cluster_bool_t *is_blocked) {
+    uint32_t batch_size = self->output_batch_size;
+    *is_blocked = CLUSTER_FALSE;
+    if (batch_size == 0) return 0;
+    self->output_batch_size = 0;
+
+    message_queue_t *queue = &self->outbound_messages;
+    uint32_t next = 0;
+    int sent = 0;
+    while (next < batch_size) {
+        int write_result = cluster_send_many(self->socket, &self->output_msgs[next], batch_size - next);
+        if (write_result == 0) {
+            *is_blocked = CLUSTER_TRUE;
+            break;
+        }
         if (write_result < 0) {
-            printf("error : %s", strerror(errno));
-            return CLUSTER_ERR_WRITE_FAILED;
+            // The first datagram has failed for good, e.g. it's too large or its
+            // recipient is unreachable. The attempt is counted, so that the
+            // envelope expires eventually instead of holding up the others.
+            log_error("Failed to send a message: %s", strerror(errno));
+            gossip_piggyback_settle(self, next, CLUSTER_FALSE);
+            gossip_envelope_attempted(self, self->output_batch[next++], current_ts);
+            continue;
+        }
+        // Only the envelopes that actually left the socket are updated.
+        for (int i = 0; i < write_result; ++i) {
+            gossip_piggyback_settle(self, next, CLUSTER_TRUE);
+            gossip_envelope_attempted(self, self->output_batch[next++], current_ts);
+        }
+        sent += write_result;
+    }
+    // The rest keep their attempt counters and deadlines and will be
+    // picked up by the next call.
+    for (uint32_t i = next; i < batch_size; ++i) {
+        gossip_piggyback_settle(self, i, CLUSTER_FALSE);
+        message_envelope_out_t *envelope = self->output_batch[i];
+        cluster_timer_heap_schedule(&queue->due, &envelope->retry_timer, envelope->retry_timer.deadline);
+    }
+    gossip_piggyback_prune(self);
+    return sent;
+}
+
+static void gossip_envelope_expire(cluster_gossip_t *self, message_envelope_out_t *envelope) {
+    const cluster_member_t *recipient = cluster_member_set_find_by_addr(&self->members,
+                                                                         &envelope->recipient,
+                                                                         envelope->recipient_len);
+    if (recipient != NULL && recipient->version >= PROTOCOL_VERSION_PROBE) {
+        // Whether the member is alive is decided by the failure detector.
+        // A single lossy message must not evict a healthy member.
+        gossip_envelope_remove(&self->outbound_messages, envelope);
+        return;
+    }
+    if (envelope->max_attempts > 1) {
+        // If the number of maximum attempts is more than 1, then
+        // the message required acknowledgement but we've never received it.
+        // Remove node from the list since it's unreachable.
+        cluster_member_set_remove_by_addr(&self->members,
+                                          &envelope->recipient,
+                                          envelope->recipient_len);
+        // Quite often the same recipient has several messages in a row.
+        // Check whether the next message should be removed as well.
+        // Envelopes that are waiting in the send batch are left alone.
+        message_envelope_out_t *next = envelope->next;
+        message_envelope_out_t *to_remove = NULL;
+        while (next != NULL && memcmp(&next->recipient, &envelope->recipient, next->recipient_len) == 0) {
+            to_remove = next;
+            next = next->next;
+            if (cluster_timer_is_scheduled(&to_remove->retry_timer)) {
+                gossip_envelope_remove(&self->outbound_messages, to_remove);
+            }
         }
-        current->attempt_ts = current_ts;
-        ++current->attempt_num;
-        ++msg_sent;
-        if (current->max_attempts <= 1) {
-            // The message must be sent only once. Remove it immediately.
-            gossip_envelope_remove(&self->outbound_messages, current);
+    }
+    // Remove this message from the queue.
+    gossip_envelope_remove(&self->outbound_messages, envelope);
+}
+
+int cluster_gossip_process_send(cluster_gossip_t *self) {
+    if (self->state != STATE_JOINING && self->state != STATE_CONNECTED) return CLUSTER_ERR_BAD_STATE;
+    uint64_t current_ts = cluster_time();
+    int msg_sent = 0;
+    cluster_bool_t is_blocked = CLUSTER_FALSE;
+    cluster_timer_t *timer = NULL;
+    // Only visit envelopes which are due. Everything else stays in the heap.
+    while ((timer = cluster_timer_heap_pop_expired(&self->outbound_messages.due, current_ts)) != NULL) {
+        message_envelope_out_t *current = (message_envelope_out_t *) timer->data;
+
+        if (current->attempt_num >= current->max_attempts) {
+            // The message exceeded the maximum number of attempts.
+            gossip_envelope_expire(self, current);
+            continue;
         }
+
+        gossip_send_batch_add(self, current);
+        if (self->output_batch_size < MESSAGE_SEND_BATCH_SIZE) continue;
+
+        msg_sent += gossip_send_batch_flush(self, current_ts, &is_blocked);
+        // The socket buffer is full. Try again next time.
+        if (is_blocked) return msg_sent;
     }
-    return msg_sent;
+
+    return msg_sent + gossip_send_batch_flush(self, current_ts, &is_blocked);
 }
 
 int cluster_gossip_send_data(cluster_gossip_t *self, const uint8_t *data, uint32_t data_size) {
     RETURN_IF_NOT_CONNECTED(self->state);
+    // Larger payloads are sent as fragments, which recipients have to reassemble.
+    if (data_size > gossip_data_max_size(self) &&
+        (data_size > self->config.data_reassembly_max_bytes ||
+         gossip_fragments_num(data_size, gossip_fragment_size(self, NULL)) > UINT16_MAX)) {
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    }
     return gossip_enqueue_data(self, data, data_size);
 }
 
+static int gossip_next_retry_timeout(cluster_gossip_t *self, uint64_t current_ts, int timeout) {
+    // Wake up earlier if some of the outbound messages are due before the next tick.
+    cluster_timer_t *timer = cluster_timer_heap_peek(&self->outbound_messages.due);
+    if (timer == NULL) return timeout;
+    if (timer->deadline <= current_ts) return 0;
+    uint64_t retry_timeout = timer->deadline - current_ts;
+    return retry_timeout < timeout ? retry_timeout : timeout;
+}
+
 int cluster_gossip_tick(cluster_gossip_t *self) {
-    if (self->state != STATE_CONNECTED) return GOSSIP_TICK_INTERVAL;
-    uint64_t next_gossip_ts = self->last_gossip_ts + GOSSIP_TICK_INTERVAL;
     uint64_t current_ts = cluster_time();
-    if (next_gossip_ts > current_ts) {
-        return next_gossip_ts - current_ts;
+    if (self->state != STATE_CONNECTED) {
+        return gossip_next_retry_timeout(self, current_ts, self->config.tick_interval);
+    }
+    int probe_result = gossip_probe_tick(self, current_ts);
+    if (probe_result < 0) return probe_result;
+    int suspicion_result = gossip_suspicion_tick(self, current_ts);
+    if (suspicion_result < 0) return suspicion_result;
+    int missing_result = gossip_missing_data_tick(self, current_ts);
+    if (missing_result < 0) return missing_result;
+    int reassembly_result = gossip_reassembly_tick(self, current_ts);
+    if (reassembly_result < 0) return reassembly_result;
+    if (gossip_partial_views(self)) {
+        int view_result = gossip_view_repair(self, current_ts);
+        if (view_result < 0) return view_result;
+        view_result = gossip_view_shuffle(self, current_ts);
+        if (view_result < 0) return view_result;
+    }
+
+    uint64_t next_gossip_ts = self->last_gossip_ts + self->config.tick_interval;
+    if (next_gossip_ts <= current_ts) {
+        int enqueue_result = gossip_enqueue_status(self, NULL, 0);
+        if (enqueue_result < 0) return enqueue_result;
+        int journal_result = gossip_journal_tick(self);
+        if (journal_result < 0) log_warn("Failed to persist the data log: %d", journal_result);
+        if (self->member_snapshot_path != NULL &&
+            self->last_snapshot_ts + self->config.member_snapshot_interval <= current_ts) {
+            gossip_member_snapshot(self);
+            self->last_snapshot_ts = current_ts;
+        }
+        self->last_gossip_ts = current_ts;
+        next_gossip_ts = current_ts + self->config.tick_interval;
+    }
+
+    // Partial views differ by design, so there is nothing to reconcile.
+    uint64_t next_sync_ts = UINT64_MAX;
+    if (self->config.sync_interval > 0 && !gossip_partial_views(self)) {
+        next_sync_ts = self->last_sync_ts + self->config.sync_interval;
+        if (next_sync_ts <= current_ts) {
+            int sync_result = gossip_sync_start(self);
+            if (sync_result < 0) return sync_result;
+            self->last_sync_ts = current_ts;
+            next_sync_ts = current_ts + self->config.sync_interval;
+        }
     }
-    int enqueue_result = gossip_enqueue_status(self, NULL, 0);
-    if (enqueue_result < 0) return enqueue_result;
-    self->last_gossip_ts = current_ts;
 
-    return GOSSIP_TICK_INTERVAL;
+    // Wake up for whichever comes first: the next gossip round or the next probe event.
+    uint64_t next_event_ts = gossip_probe_next_event(self);
+    uint64_t next_suspicion_ts = gossip_suspicion_next_deadline(self);
+    if (next_event_ts > next_suspicion_ts) next_event_ts = next_suspicion_ts;
+    if (next_event_ts > next_gossip_ts) next_event_ts = next_gossip_ts;
+    if (next_event_ts > next_sync_ts) next_event_ts = next_sync_ts;
+    uint64_t next_missing_ts = gossip_missing_data_next_deadline(self);
+    if (next_event_ts > next_missing_ts) next_event_ts = next_missing_ts;
+    uint64_t next_reassembly_ts = gossip_reassembly_next_deadline(self);
+    if (next_event_ts > next_reassembly_ts) next_event_ts = next_reassembly_ts;
+    if (gossip_partial_views(self)) {
+        uint64_t next_shuffle_ts = self->last_shuffle_ts + self->config.shuffle_interval;
+        if (next_event_ts > next_shuffle_ts) next_event_ts = next_shuffle_ts;
+    }
+    int timeout = next_event_ts > current_ts ? next_event_ts - current_ts : 0;
+    return gossip_next_retry_timeout(self, current_ts, timeout);
 }
 
 cluster_gossip_state_t cluster_gossip_state(cluster_gossip_t *self) {
@@ -854,4 +3923,13 @@ cluster_socket_fd cluster_gossip_socket_fd(cluster_gossip_t *self) {
 
 cluster_member_set_t *cluster_gossip_member_list(cluster_gossip_t *self) {
     return &self->members;
+}
+
+int cluster_gossip_stats(cluster_gossip_t *self, cluster_gossip_stats_t *stats) {
+    const cluster_pool_t *pool = &self->outbound_messages.pool;
+    stats->envelope_allocs = pool->alloc_count;
+    stats->envelope_frees = pool->free_count;
+    stats->envelope_pool_grows = pool->grow_count;
+    stats->envelope_pool_capacity = pool->chunks_num * pool->chunk_capacity;
+    return CLUSTER_ERR_NONE;
 }
\ No newline at end of file
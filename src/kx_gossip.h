@@ -47,6 +47,45 @@ typedef enum cluster_gossip_state {
 typedef void (*data_receiver_t)(void *context, cluster_gossip_t *gossip,
                                 const uint8_t *buffer, size_t buffer_size);
 
+/**
+ * Runtime parameters of a gossip instance. The defaults are taken
+ * from the corresponding compile-time macros in kx_config.h.
+ */
+typedef struct cluster_gossip_config {
+    uint32_t retry_interval;        /**< interval in milliseconds between retry attempts. */
+    uint16_t retry_attempts;        /**< maximum number of attempts to deliver a message. */
+    uint16_t rumor_factor;          /**< number of members used for further gossip propagation. */
+    uint16_t message_max_size;      /**< maximum size of a message including a protocol overhead, 0 for the interface MTU. */
+    uint32_t max_output_messages;   /**< maximum number of unique messages in the outbound queue. */
+    uint32_t tick_interval;         /**< interval in milliseconds between Gossip tick events. */
+    uint32_t data_log_size;         /**< number of originators whose data messages are kept for anti-entropy. */
+    uint32_t data_log_depth;        /**< number of recent data messages kept per originator. */
+    uint32_t data_log_max_bytes;    /**< maximum total size in bytes of the logged data payloads. */
+    uint32_t data_reassembly_max_bytes; /**< maximum total size in bytes of the data payloads being reassembled. */
+    uint32_t data_reassembly_timeout;   /**< time in milliseconds after which an incomplete data payload is dropped. */
+    uint32_t probe_interval;        /**< interval in milliseconds between failure detector probes. */
+    uint32_t probe_timeout;         /**< time in milliseconds a probed member is given to respond. */
+    uint16_t probe_indirect_members;/**< number of members asked to probe an unresponsive member. */
+    uint16_t suspicion_mult;        /**< suspicion timeout in probe intervals per log10 of the cluster size. */
+    uint32_t sync_interval;         /**< interval in milliseconds between membership digest exchanges, 0 disables them. */
+    uint16_t piggyback_mult;        /**< retransmissions of a membership event per log10 of the cluster size. */
+    uint8_t plumtree;               /**< disseminate data along the epidemic broadcast tree if non-zero. */
+    uint32_t ihave_timeout;         /**< time in milliseconds to wait for an announced data message before grafting. */
+    uint16_t active_view_size;      /**< size of the active view, 0 keeps the full member set instead of partial views. */
+    uint16_t passive_view_size;     /**< size of the passive view used to repair the active one. */
+    uint32_t shuffle_interval;      /**< interval in milliseconds between passive view shuffles. */
+    const char *data_log_path;      /**< file persisting the data log and the data version across restarts, NULL disables it. */
+    const char *member_snapshot_path;   /**< file the member set is periodically saved to, NULL disables it. */
+    uint32_t member_snapshot_interval;  /**< interval in milliseconds between member set snapshots. */
+} cluster_gossip_config_t;
+
+typedef struct cluster_gossip_stats {
+    uint64_t envelope_allocs;           /**< outbound envelopes taken from the pool. */
+    uint64_t envelope_frees;            /**< outbound envelopes returned to the pool. */
+    uint64_t envelope_pool_grows;       /**< times the pool requested memory from the system allocator. */
+    uint32_t envelope_pool_capacity;    /**< number of envelopes the pool currently holds. */
+} cluster_gossip_stats_t;
+
 typedef struct cluster_addr {
     const cluster_sockaddr *addr;   /**< pointer to the address instance. */
     socklen_t addr_len;             /**< size of the address. */
@@ -72,6 +111,36 @@ cluster_gossip_t *cluster_gossip_create(const cluster_addr_t *self_addr,
                                           void *data_receiver_context,
                                           const char *uname);
 
+/**
+ * Fills in the configuration with the default values.
+ *
+ * @param config a configuration to initialize.
+ * @return Void.
+ */
+void cluster_gossip_config_init(cluster_gossip_config_t *config);
+
+/**
+ * Creates a new gossip descriptor instance with the given configuration.
+ * All internal buffers are sized according to the configuration. The message
+ * size is capped by the MTU of the interface the node is bound to. Members
+ * advertise their message sizes to each other, and larger messages are only
+ * sent to members that accept them.
+ *
+ * @param self_addr the address of the current node.
+ * @param data_receiver a data receiver callback.
+ * @param data_receiver_context an arbitrary context that is always passed to
+ *                              a data_receiver callback.
+ * @param uname cluster node name
+ * @param config the gossip parameters. If NULL, the defaults are used.
+ * @return a new gossip descriptor instance or NULL if the configuration
+ *         is invalid or the initialization failed.
+ */
+cluster_gossip_t *cluster_gossip_create_ex(const cluster_addr_t *self_addr,
+                                           data_receiver_t data_receiver,
+                                           void *data_receiver_context,
+                                           const char *uname,
+                                           const cluster_gossip_config_t *config);
+
 /**
  * Destroys a gossip descriptor instance.
  *
@@ -91,6 +160,23 @@ int cluster_gossip_destroy(cluster_gossip_t *self);
 int cluster_gossip_join(cluster_gossip_t *self,
                          const cluster_addr_t *seed_nodes, uint16_t seed_nodes_len);
 
+/**
+ * Joins the gossip cluster using the members saved in the snapshot file
+ * configured with member_snapshot_path. The node starts gossiping with
+ * them right away and doesn't wait for the seed nodes to respond. Stale
+ * members are detected later on by the failure detector. Both the seed
+ * nodes and a few members from the snapshot are greeted in order to
+ * announce the node and refresh its member set.
+ * Falls back to cluster_gossip_join() if the snapshot is missing or invalid.
+ *
+ * @param self a gossip descriptor instance.
+ * @param seed_nodes a list of seed node addresses.
+ * @param seed_nodes_len a size of the list.
+ * @return zero on success or negative value if the operation failed.
+ */
+int cluster_gossip_join_from_snapshot(cluster_gossip_t *self,
+                                      const cluster_addr_t *seed_nodes, uint16_t seed_nodes_len);
+
 /**
  * Suggests Pittacus to read a next message from the socket.
  * Only one message will be read.
@@ -100,6 +186,19 @@ int cluster_gossip_join(cluster_gossip_t *self,
  */
 int cluster_gossip_process_receive(cluster_gossip_t *self);
 
+/**
+ * Suggests Pittacus to drain the socket. Datagrams are read in batches
+ * of up to MESSAGE_RECV_BATCH_SIZE messages per system call until there
+ * is nothing left to read or the limit is reached.
+ *
+ * @param self a gossip descriptor instance.
+ * @param max_msgs the maximum number of messages to read. Zero means
+ *                 no limit.
+ * @return a number of processed messages or negative value if
+ *         the operation failed.
+ */
+int cluster_gossip_process_receive_batch(cluster_gossip_t *self, uint32_t max_msgs);
+
 /**
  * Suggests Pittacus to write existing outbound messages to the socket.
  * All available messages will be written to the socket.
@@ -115,10 +214,15 @@ int cluster_gossip_process_send(cluster_gossip_t *self);
  * point. The message is added to a queue of outbound messages
  * and will be sent to a cluster during the next cluster_gossip_process_send()
  * invocation.
+ * A payload which doesn't fit into a single message is announced to
+ * random members with its first fragment. Each member pulls the rest
+ * of the fragments from the members which announced the payload to it,
+ * and announces the payload further once it's reassembled. Members
+ * running an older protocol version don't receive such payloads.
  *
  * @param self a gossip descriptor instance.
  * @param data a payload.
- * @param data_size a payload size.
+ * @param data_size a payload size up to data_reassembly_max_bytes.
  * @return zero on success or negative value if the operation failed.
  */
 int cluster_gossip_send_data(cluster_gossip_t *self, const uint8_t *data, uint32_t data_size);
@@ -131,7 +235,9 @@ int cluster_gossip_send_data(cluster_gossip_t *self, const uint8_t *data, uint32
  *
  * @param self a gossip descriptor instance.
  * @return a time interval in milliseconds when the next gossip
- *         tick should happen, or negative value if the error occurred.
+ *         tick should happen or one of the outbound messages is due
+ *         for (re)delivery, whichever comes first, or negative value
+ *         if the error occurred.
  */
 int cluster_gossip_tick(cluster_gossip_t *self);
 
@@ -159,6 +265,17 @@ cluster_socket_fd cluster_gossip_socket_fd(cluster_gossip_t *self);
  */
 cluster_member_set_t *cluster_gossip_member_list(cluster_gossip_t *self);
 
+/**
+ * Retrieves the allocation counters of this gossip instance. In the
+ * steady state envelope_pool_grows doesn't change, which means that
+ * sending messages doesn't touch the system allocator.
+ *
+ * @param self  a gossip descriptor instance.
+ * @param stats the structure to fill in.
+ * @return zero on success or negative value if the operation failed.
+ */
+int cluster_gossip_stats(cluster_gossip_t *self, cluster_gossip_stats_t *stats);
+
 #ifdef  __cplusplus
 }
 #endif
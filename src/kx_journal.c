@@ -0,0 +1,195 @@
+/*
+ * Copyright 2023-2023 yanruibinghxu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kx_config.h"
+
+static const uint8_t JOURNAL_MAGIC[4] = {'K', 'X', 'J', 'L'};
+static const uint32_t JOURNAL_VERSION = 1;
+#define JOURNAL_HEADER_SIZE 8
+#define JOURNAL_INITIAL_SIZE (64 * 1024)
+
+static const char JOURNAL_COMPACT_SUFFIX[] = ".compact";
+
+/* Returns the size of the record at the offset or zero if it's incomplete or corrupted. */
+static size_t cluster_journal_record_size(const cluster_journal_t *journal, size_t offset) {
+    if (journal->map_size - offset < CLUSTER_JOURNAL_FRAME_SIZE) return 0;
+    const uint8_t *frame = journal->map + offset;
+    uint32_t content_size = uint32_decode(frame);
+    // The content holds at least the type of the record.
+    if (content_size == 0 || content_size > journal->map_size - offset - CLUSTER_JOURNAL_FRAME_SIZE + 1) return 0;
+    uint32_t crc = uint32_decode(frame + 4);
+    if (cluster_crc32(0, frame + 8, content_size) != crc) return 0;
+    return CLUSTER_JOURNAL_FRAME_SIZE - 1 + content_size;
+}
+
+static int cluster_journal_map(cluster_journal_t *journal, size_t size) {
+    if (ftruncate(journal->fd, size) < 0) return CLUSTER_ERR_WRITE_FAILED;
+    uint8_t *map = NULL;
+    if (journal->map == NULL) {
+        map = (uint8_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, journal->fd, 0);
+    } else {
+        map = (uint8_t *) mremap(journal->map, journal->map_size, size, MREMAP_MAYMOVE);
+    }
+    if (map == MAP_FAILED) return CLUSTER_ERR_WRITE_FAILED;
+    journal->map = map;
+    journal->map_size = size;
+    return CLUSTER_ERR_NONE;
+}
+
+static int cluster_journal_create(cluster_journal_t *journal, const char *path, int flags) {
+    journal->map = NULL;
+    journal->map_size = 0;
+    journal->tail = JOURNAL_HEADER_SIZE;
+    journal->path = strdup(path);
+    if (journal->path == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+    journal->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | flags, 0644);
+    if (journal->fd < 0) {
+        free(journal->path);
+        journal->path = NULL;
+        return CLUSTER_ERR_INIT_FAILED;
+    }
+
+    struct stat file_stat;
+    int result = fstat(journal->fd, &file_stat) < 0 ? CLUSTER_ERR_INIT_FAILED : CLUSTER_ERR_NONE;
+    cluster_bool_t is_new = result == CLUSTER_ERR_NONE && file_stat.st_size == 0;
+    if (result == CLUSTER_ERR_NONE) {
+        size_t size = is_new ? JOURNAL_INITIAL_SIZE : (size_t) file_stat.st_size;
+        if (size < JOURNAL_HEADER_SIZE) {
+            result = CLUSTER_ERR_INIT_FAILED;
+        } else {
+            result = cluster_journal_map(journal, size);
+        }
+    }
+    if (result == CLUSTER_ERR_NONE) {
+        if (is_new) {
+            memcpy(journal->map, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+            uint32_encode(JOURNAL_VERSION, journal->map + sizeof(JOURNAL_MAGIC));
+        } else if (memcmp(journal->map, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0 ||
+                   uint32_decode(journal->map + sizeof(JOURNAL_MAGIC)) != JOURNAL_VERSION) {
+            // Never overwrite a file which doesn't look like a journal.
+            result = CLUSTER_ERR_INIT_FAILED;
+        }
+    }
+    if (result < 0) {
+        cluster_journal_close(journal);
+        return result;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+int cluster_journal_open(cluster_journal_t *journal, const char *path) {
+    int result = cluster_journal_create(journal, path, 0);
+    if (result < 0) return result;
+
+    size_t record_size = 0;
+    while ((record_size = cluster_journal_record_size(journal, journal->tail)) > 0) {
+        journal->tail += record_size;
+    }
+    // Wipe the remains of a torn append, so that they can't be
+    // mistaken for valid records once new ones are appended.
+    memset(journal->map + journal->tail, 0, journal->map_size - journal->tail);
+    return CLUSTER_ERR_NONE;
+}
+
+void cluster_journal_close(cluster_journal_t *journal) {
+    if (journal->map != NULL) {
+        msync(journal->map, journal->map_size, MS_SYNC);
+        munmap(journal->map, journal->map_size);
+    }
+    if (journal->fd >= 0) close(journal->fd);
+    free(journal->path);
+    journal->map = NULL;
+    journal->map_size = 0;
+    journal->fd = -1;
+    journal->path = NULL;
+}
+
+int cluster_journal_replay(const cluster_journal_t *journal,
+                           cluster_journal_visitor_t visitor, void *context) {
+    size_t offset = JOURNAL_HEADER_SIZE;
+    while (offset < journal->tail) {
+        const uint8_t *frame = journal->map + offset;
+        uint32_t content_size = uint32_decode(frame);
+        int result = visitor(context, frame[8], frame + CLUSTER_JOURNAL_FRAME_SIZE, content_size - 1);
+        if (result < 0) return result;
+        offset += CLUSTER_JOURNAL_FRAME_SIZE - 1 + content_size;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+int cluster_journal_append(cluster_journal_t *journal, uint8_t type,
+                           const uint8_t *header, size_t header_size,
+                           const uint8_t *body, size_t body_size) {
+    size_t record_size = CLUSTER_JOURNAL_FRAME_SIZE + header_size + body_size;
+    if (record_size > UINT32_MAX) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    if (journal->map_size - journal->tail < record_size) {
+        size_t new_size = journal->map_size < JOURNAL_INITIAL_SIZE ? JOURNAL_INITIAL_SIZE : journal->map_size * 2;
+        while (new_size - journal->tail < record_size) new_size *= 2;
+        int map_result = cluster_journal_map(journal, new_size);
+        if (map_result < 0) return map_result;
+    }
+
+    uint8_t *frame = journal->map + journal->tail;
+    frame[8] = type;
+    if (header_size > 0) memcpy(frame + CLUSTER_JOURNAL_FRAME_SIZE, header, header_size);
+    if (body_size > 0) memcpy(frame + CLUSTER_JOURNAL_FRAME_SIZE + header_size, body, body_size);
+    uint32_t content_size = record_size - CLUSTER_JOURNAL_FRAME_SIZE + 1;
+    uint32_encode(cluster_crc32(0, frame + 8, content_size), frame + 4);
+    uint32_encode(content_size, frame);
+    journal->tail += record_size;
+    return CLUSTER_ERR_NONE;
+}
+
+int cluster_journal_sync(cluster_journal_t *journal) {
+    if (msync(journal->map, journal->map_size, MS_ASYNC) < 0) return CLUSTER_ERR_WRITE_FAILED;
+    return CLUSTER_ERR_NONE;
+}
+
+int cluster_journal_compact_begin(const cluster_journal_t *journal, cluster_journal_t *result) {
+    size_t path_size = strlen(journal->path) + sizeof(JOURNAL_COMPACT_SUFFIX);
+    char *path = (char *) malloc(path_size);
+    if (path == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+    snprintf(path, path_size, "%s%s", journal->path, JOURNAL_COMPACT_SUFFIX);
+    // Leftovers of an interrupted compaction are discarded.
+    int create_result = cluster_journal_create(result, path, O_TRUNC);
+    free(path);
+    return create_result;
+}
+
+int cluster_journal_compact_end(cluster_journal_t *journal, cluster_journal_t *compacted) {
+    // The compacted file is shrunk to its content and must reach
+    // the disk before it replaces the original one.
+    int result = cluster_journal_map(compacted, compacted->tail);
+    if (result == CLUSTER_ERR_NONE &&
+        (msync(compacted->map, compacted->map_size, MS_SYNC) < 0 || fsync(compacted->fd) < 0 ||
+         rename(compacted->path, journal->path) < 0)) {
+        result = CLUSTER_ERR_WRITE_FAILED;
+    }
+    if (result < 0) {
+        unlink(compacted->path);
+        cluster_journal_close(compacted);
+        return result;
+    }
+
+    char *path = journal->path;
+    journal->path = NULL;
+    cluster_journal_close(journal);
+    free(compacted->path);
+    *journal = *compacted;
+    journal->path = path;
+    return CLUSTER_ERR_NONE;
+}
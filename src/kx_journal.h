@@ -0,0 +1,105 @@
+/*
+ * Copyright 2023-2023 yanruibinghxu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __CLUSTER_JOURNAL_H__
+#define __CLUSTER_JOURNAL_H__
+
+#include "kx_config.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* The size of the record frame: the size and CRC-32 of the content,
+ * followed by the record type. */
+#define CLUSTER_JOURNAL_FRAME_SIZE 9
+
+/**
+ * An append-only file of typed records which is mapped into memory.
+ * Each record is framed by its size and a CRC-32 of its content, so
+ * a record torn by a crash is detected and cut off when the file
+ * is opened. The journal never rewrites records in place; obsolete
+ * ones are dropped by compaction, which writes the live records into
+ * a new file and atomically replaces the old one.
+ */
+struct cluster_journal {
+    int fd;                 /**< descriptor of the journal file. */
+    uint8_t *map;           /**< the mapped file. */
+    size_t map_size;        /**< size of the file and of its mapping. */
+    size_t tail;            /**< offset past the last valid record. */
+    char *path;             /**< path of the journal file. */
+};
+
+/**
+ * Invoked for each valid record during a replay.
+ *
+ * @return zero to continue or a negative value to stop the replay.
+ */
+typedef int (*cluster_journal_visitor_t)(void *context, uint8_t type,
+                                         const uint8_t *payload, size_t payload_size);
+
+/**
+ * Opens the journal file, creating it if it doesn't exist. Records
+ * following the first invalid one are discarded.
+ *
+ * @return zero on success or CLUSTER_ERR_INIT_FAILED if the file can't
+ *         be mapped or isn't a journal.
+ */
+int cluster_journal_open(cluster_journal_t *journal, const char *path);
+void cluster_journal_close(cluster_journal_t *journal);
+
+/**
+ * Passes all valid records to the visitor in the order they were appended.
+ *
+ * @return zero or the negative result of the visitor.
+ */
+int cluster_journal_replay(const cluster_journal_t *journal,
+                           cluster_journal_visitor_t visitor, void *context);
+
+/**
+ * Appends a record whose payload is the concatenation of the
+ * header and the body. Either of them may be empty.
+ *
+ * @return zero on success or CLUSTER_ERR_WRITE_FAILED if the file
+ *         couldn't be extended.
+ */
+int cluster_journal_append(cluster_journal_t *journal, uint8_t type,
+                           const uint8_t *header, size_t header_size,
+                           const uint8_t *body, size_t body_size);
+
+/**
+ * Schedules the write back of the appended records without waiting for it.
+ */
+int cluster_journal_sync(cluster_journal_t *journal);
+
+/**
+ * Starts the compaction by creating an empty journal next to the given one.
+ * The live records should be appended to the result, which then replaces
+ * the original journal with cluster_journal_compact_end().
+ */
+int cluster_journal_compact_begin(const cluster_journal_t *journal, cluster_journal_t *result);
+
+/**
+ * Flushes the compacted journal to disk and moves it over the original
+ * one, which is closed. On failure the compacted journal is discarded and
+ * the original one is kept.
+ */
+int cluster_journal_compact_end(cluster_journal_t *journal, cluster_journal_t *compacted);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
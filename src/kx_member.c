@@ -18,72 +18,116 @@
 
 #define UNUSED(A) (void)(A)
 
-/* The member timeout response time is defined as 15 seconds. 
- * If it exceeds this duration, the member is considered 
- * disconnected and can be removed. */
-#define TIMEOUTMILLISECONDS 15*1000UL
-
 static const uint32_t MEMBERS_INITIAL_CAPACITY = 32;
 static const uint8_t MEMBERS_EXTENSION_FACTOR = 2;
 static const double MEMBERS_LOAD_FACTOR = 0.75;
 
+int cluster_member_addr_from_sockaddr(cluster_member_addr_t *result,
+                                      const cluster_sockaddr_storage *address,
+                                      cluster_socklen_t address_len) {
+    memset(result, 0, sizeof(cluster_member_addr_t));
+    if (address->ss_family == AF_INET && address_len >= sizeof(cluster_sockaddr_in)) {
+        const cluster_sockaddr_in *addr_in = (const cluster_sockaddr_in *) address;
+        result->family = AF_INET;
+        result->port = addr_in->sin_port;
+        memcpy(result->addr, &addr_in->sin_addr, sizeof(addr_in->sin_addr));
+    } else if (address->ss_family == AF_INET6 && address_len >= sizeof(cluster_sockaddr_in6)) {
+        const cluster_sockaddr_in6 *addr_in6 = (const cluster_sockaddr_in6 *) address;
+        result->family = AF_INET6;
+        result->port = addr_in6->sin6_port;
+        memcpy(result->addr, &addr_in6->sin6_addr, sizeof(addr_in6->sin6_addr));
+    } else {
+        return CLUSTER_ERR_INVALID_MESSAGE;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+cluster_socklen_t cluster_member_addr_to_sockaddr(const cluster_member_addr_t *address,
+                                                  cluster_sockaddr_storage *result) {
+    memset(result, 0, sizeof(cluster_sockaddr_storage));
+    if (address->family == AF_INET6) {
+        cluster_sockaddr_in6 *addr_in6 = (cluster_sockaddr_in6 *) result;
+        addr_in6->sin6_family = AF_INET6;
+        addr_in6->sin6_port = address->port;
+        memcpy(&addr_in6->sin6_addr, address->addr, sizeof(addr_in6->sin6_addr));
+        return sizeof(cluster_sockaddr_in6);
+    }
+    cluster_sockaddr_in *addr_in = (cluster_sockaddr_in *) result;
+    addr_in->sin_family = AF_INET;
+    addr_in->sin_port = address->port;
+    memcpy(&addr_in->sin_addr, address->addr, sizeof(addr_in->sin_addr));
+    return sizeof(cluster_sockaddr_in);
+}
+
+cluster_bool_t cluster_member_addr_equals(const cluster_member_addr_t *first,
+                                          const cluster_member_addr_t *second) {
+    return memcmp(first, second, sizeof(cluster_member_addr_t)) == 0;
+}
+
 int cluster_member_init(cluster_member_t *result, const cluster_sockaddr_storage *address, 
                         cluster_socklen_t address_len, const char *uname, uint16_t uname_len) {
     UNUSED(uname_len);
 
     result->uid = cluster_time() / 1000;
     result->version = PROTOCOL_VERSION;
-    result->address_len = address_len;
-    result->address = (cluster_sockaddr_storage *) malloc(address_len);
-    if (result->address == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
-    memcpy(result->address, address, address_len);
+    result->state = MEMBER_ALIVE;
+    result->incarnation = 0;
+    result->max_message_size = 0;
+    int addr_result = cluster_member_addr_from_sockaddr(&result->address, address, address_len);
+    if (addr_result < 0) return addr_result;
     strncpy(result->username, uname, sizeof(result->username)-1);
     result->username[sizeof(result->username)-1] = '\0';
     return CLUSTER_ERR_NONE;
 }
 
-static int cluster_member_copy(cluster_member_t *dst, cluster_member_t *src) {
-    dst->uid = src->uid;
-    dst->version = src->version;
-    dst->address_len = src->address_len;
-    dst->address = (cluster_sockaddr_storage *) malloc(src->address_len);
-    if (dst->address == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
-    memcpy(dst->address, src->address, src->address_len);
-    strncpy(dst->username, src->username, sizeof(dst->username)-1);
-    dst->username[sizeof(src->username)-1] = '\0';
-
-    return CLUSTER_ERR_NONE;
-}
-
 int cluster_member_equals(cluster_member_t *first, cluster_member_t *second) {
     return first->uid == second->uid &&
             first->version == second->version &&
-            first->address_len == second->address_len &&
-            memcmp(first->address, second->address, first->address_len) == 0;
+            cluster_member_addr_equals(&first->address, &second->address);
 }
 
 void cluster_member_destroy(cluster_member_t *result) {
-    free(result->address);
+    // Members don't own any external resources.
+    UNUSED(result);
 }
 
+/* The legacy wire format carries the raw socket address. */
+#define CLUSTER_MEMBER_WIRE_HEADER_SIZE (sizeof(((cluster_member_t *) 0)->username) + \
+                                         sizeof(uint16_t) + 2 * sizeof(uint32_t))
+
 int cluster_member_decode(const uint8_t *buffer, size_t buffer_size, cluster_member_t *member) {
-    if (buffer_size < 2 * sizeof(uint32_t) + sizeof(uint16_t)) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    if (buffer_size < CLUSTER_MEMBER_WIRE_HEADER_SIZE) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
     const uint8_t *cursor = buffer;
     memcpy(member->username, cursor, sizeof(member->username));
+    member->username[sizeof(member->username)-1] = '\0';
     cursor += sizeof(member->username);
     member->version = uint16_decode(cursor);
     cursor += sizeof(uint16_t);
     member->uid = uint32_decode(cursor);
     cursor += sizeof(uint32_t);
-    member->address_len = uint32_decode(cursor);
+    // The legacy encoding carries no liveness information.
+    member->state = MEMBER_ALIVE;
+    member->incarnation = 0;
+    member->max_message_size = 0;
+    uint32_t address_len = uint32_decode(cursor);
     cursor += sizeof(uint32_t);
-    member->address = (cluster_sockaddr_storage *) cursor;
-    cursor += member->address_len;
+    if (address_len > sizeof(cluster_sockaddr_storage) ||
+        address_len > buffer_size - CLUSTER_MEMBER_WIRE_HEADER_SIZE) {
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    }
+    cluster_sockaddr_storage address;
+    memset(&address, 0, sizeof(address));
+    memcpy(&address, cursor, address_len);
+    int addr_result = cluster_member_addr_from_sockaddr(&member->address, &address, address_len);
+    if (addr_result < 0) return addr_result;
+    cursor += address_len;
     return cursor - buffer;
 }
 
 int cluster_member_encode(const cluster_member_t *member, uint8_t *buffer, size_t buffer_size) {
-    if (buffer_size < sizeof(member->username) + 2 * sizeof(uint32_t) + sizeof(uint16_t) + member->address_len) {
+    cluster_sockaddr_storage address;
+    cluster_socklen_t address_len = cluster_member_addr_to_sockaddr(&member->address, &address);
+    if (buffer_size < CLUSTER_MEMBER_WIRE_HEADER_SIZE + address_len) {
         return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
     }
     uint8_t *cursor = buffer;
@@ -93,153 +137,656 @@ int cluster_member_encode(const cluster_member_t *member, uint8_t *buffer, size_
     cursor += sizeof(uint16_t);
     uint32_encode(member->uid, cursor);
     cursor += sizeof(uint32_t);
-    uint32_encode(member->address_len, cursor);
+    uint32_encode(address_len, cursor);
     cursor += sizeof(uint32_t);
-    memcpy(cursor, member->address, member->address_len);
-    cursor += member->address_len;
+    memcpy(cursor, &address, address_len);
+    cursor += address_len;
+    return cursor - buffer;
+}
+
+size_t cluster_member_encoded_size(const cluster_member_t *member) {
+    return CLUSTER_MEMBER_WIRE_HEADER_SIZE +
+           (member->address.family == AF_INET6 ? sizeof(cluster_sockaddr_in6) : sizeof(cluster_sockaddr_in));
+}
+
+/* The compact address encoding:
+ *   tag (1 byte): the address family in the low 2 bits, the rest is
+ *   available for flags of the enclosing record.
+ *   address (4 or 16 bytes), port (2 bytes, network byte order). */
+#define MEMBER_TAG_FAMILY_MASK  0x03
+#define MEMBER_TAG_INET         0x01
+#define MEMBER_TAG_INET6        0x02
+
+static inline size_t cluster_member_compact_addr_size(const cluster_member_addr_t *address) {
+    return address->family == AF_INET6 ? 16 : 4;
+}
+
+size_t cluster_member_addr_size(const cluster_member_addr_t *address) {
+    return sizeof(uint8_t) + cluster_member_compact_addr_size(address) + sizeof(uint16_t);
+}
+
+int cluster_member_addr_encode(const cluster_member_addr_t *address, uint8_t *buffer, size_t buffer_size) {
+    size_t addr_size = cluster_member_compact_addr_size(address);
+    if (buffer_size < sizeof(uint8_t) + addr_size + sizeof(uint16_t)) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    uint8_t *cursor = buffer;
+    *cursor = address->family == AF_INET6 ? MEMBER_TAG_INET6 : MEMBER_TAG_INET;
+    cursor += sizeof(uint8_t);
+    memcpy(cursor, address->addr, addr_size);
+    cursor += addr_size;
+    memcpy(cursor, &address->port, sizeof(uint16_t));
+    cursor += sizeof(uint16_t);
+    return cursor - buffer;
+}
+
+int cluster_member_addr_decode(const uint8_t *buffer, size_t buffer_size, cluster_member_addr_t *address) {
+    if (buffer_size < sizeof(uint8_t)) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    const uint8_t *cursor = buffer;
+    memset(address, 0, sizeof(cluster_member_addr_t));
+    switch (*cursor & MEMBER_TAG_FAMILY_MASK) {
+        case MEMBER_TAG_INET:
+            address->family = AF_INET;
+            break;
+        case MEMBER_TAG_INET6:
+            address->family = AF_INET6;
+            break;
+        default:
+            return CLUSTER_ERR_INVALID_MESSAGE;
+    }
+    cursor += sizeof(uint8_t);
+
+    size_t addr_size = cluster_member_compact_addr_size(address);
+    if (buffer_size - sizeof(uint8_t) < addr_size + sizeof(uint16_t)) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    memcpy(address->addr, cursor, addr_size);
+    cursor += addr_size;
+    memcpy(&address->port, cursor, sizeof(uint16_t));
+    cursor += sizeof(uint16_t);
     return cursor - buffer;
 }
 
+/* The compact member encoding:
+ *   address (see above), version (varint), uid (varint),
+ *   [incarnation (varint)], [max message size (varint)],
+ *   username length (1 byte) followed by the username bytes.
+ * With MEMBER_ENCODE_LIVENESS the state is stored in the address tag
+ * and the incarnation follows the uid. With MEMBER_ENCODE_MAX_SIZE the
+ * largest datagram the member accepts precedes the username. */
+#define MEMBER_TAG_STATE_SHIFT  2
+#define MEMBER_TAG_STATE_MASK   0x0C
+static inline size_t cluster_member_username_len(const cluster_member_t *member) {
+    return strnlen(member->username, sizeof(member->username) - 1);
+}
+
+size_t cluster_member_compact_size(const cluster_member_t *member, int options) {
+    return cluster_member_addr_size(&member->address)
+           + varint_size(member->version)
+           + varint_size(member->uid)
+           + ((options & MEMBER_ENCODE_LIVENESS) ? varint_size(member->incarnation) : 0)
+           + ((options & MEMBER_ENCODE_MAX_SIZE) ? varint_size(member->max_message_size) : 0)
+           + sizeof(uint8_t)
+           + cluster_member_username_len(member);
+}
+
+int cluster_member_compact_encode(const cluster_member_t *member, uint8_t *buffer, size_t buffer_size, int options) {
+    if (buffer_size < cluster_member_compact_size(member, options)) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    uint8_t *cursor = buffer;
+    const uint8_t *buffer_end = buffer + buffer_size;
+    cursor += cluster_member_addr_encode(&member->address, cursor, buffer_end - cursor);
+    if (options & MEMBER_ENCODE_LIVENESS) {
+        *buffer |= (member->state << MEMBER_TAG_STATE_SHIFT) & MEMBER_TAG_STATE_MASK;
+    }
+    cursor += varint_encode(member->version, cursor, buffer_end - cursor);
+    cursor += varint_encode(member->uid, cursor, buffer_end - cursor);
+    if (options & MEMBER_ENCODE_LIVENESS) {
+        cursor += varint_encode(member->incarnation, cursor, buffer_end - cursor);
+    }
+    if (options & MEMBER_ENCODE_MAX_SIZE) {
+        cursor += varint_encode(member->max_message_size, cursor, buffer_end - cursor);
+    }
+    uint8_t username_len = cluster_member_username_len(member);
+    *cursor = username_len;
+    cursor += sizeof(uint8_t);
+    memcpy(cursor, member->username, username_len);
+    cursor += username_len;
+    return cursor - buffer;
+}
+
+int cluster_member_compact_decode(const uint8_t *buffer, size_t buffer_size, cluster_member_t *member, int options) {
+    const uint8_t *cursor = buffer;
+    const uint8_t *buffer_end = buffer + buffer_size;
+
+    int decode_result = cluster_member_addr_decode(cursor, buffer_end - cursor, &member->address);
+    if (decode_result < 0) return decode_result;
+    cursor += decode_result;
+
+    uint32_t value = 0;
+    decode_result = varint_decode(cursor, buffer_end - cursor, &value);
+    if (decode_result < 0) return decode_result;
+    member->version = value;
+    cursor += decode_result;
+
+    decode_result = varint_decode(cursor, buffer_end - cursor, &value);
+    if (decode_result < 0) return decode_result;
+    member->uid = value;
+    cursor += decode_result;
+
+    member->state = MEMBER_ALIVE;
+    member->incarnation = 0;
+    if (options & MEMBER_ENCODE_LIVENESS) {
+        member->state = (*buffer & MEMBER_TAG_STATE_MASK) >> MEMBER_TAG_STATE_SHIFT;
+        if (member->state > MEMBER_DEAD) return CLUSTER_ERR_INVALID_MESSAGE;
+        decode_result = varint_decode(cursor, buffer_end - cursor, &value);
+        if (decode_result < 0) return decode_result;
+        member->incarnation = value;
+        cursor += decode_result;
+    }
+
+    member->max_message_size = 0;
+    if (options & MEMBER_ENCODE_MAX_SIZE) {
+        decode_result = varint_decode(cursor, buffer_end - cursor, &value);
+        if (decode_result < 0) return decode_result;
+        if (value > UINT16_MAX) return CLUSTER_ERR_INVALID_MESSAGE;
+        member->max_message_size = value;
+        cursor += decode_result;
+    }
+
+    if (cursor >= buffer_end) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    uint8_t username_len = *cursor;
+    cursor += sizeof(uint8_t);
+    if (username_len >= sizeof(member->username) || buffer_end - cursor < username_len) {
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    }
+    memset(member->username, 0, sizeof(member->username));
+    memcpy(member->username, cursor, username_len);
+    cursor += username_len;
+    return cursor - buffer;
+}
+#define MEMBERS_INDEX_EMPTY UINT32_MAX
+
+static inline uint32_t cluster_member_addr_hash(const cluster_member_addr_t *addr) {
+    // FNV-1a over the compact address.
+    const uint8_t *bytes = (const uint8_t *) addr;
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < sizeof(cluster_member_addr_t); ++i) {
+        hash ^= bytes[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static void cluster_member_index_insert(uint32_t *index, uint32_t index_capacity,
+                                        const cluster_member_t *member, uint32_t position) {
+    uint32_t mask = index_capacity - 1;
+    uint32_t slot = cluster_member_addr_hash(&member->address) & mask;
+    while (index[slot] != MEMBERS_INDEX_EMPTY) slot = (slot + 1) & mask;
+    index[slot] = position;
+}
+
+/* Returns the index slot which refers to the member with the given
+ * address or the first empty slot of the probe sequence. */
+static uint32_t cluster_member_index_lookup(const cluster_member_set_t *members,
+                                            const cluster_member_addr_t *addr) {
+    uint32_t mask = members->index_capacity - 1;
+    uint32_t slot = cluster_member_addr_hash(addr) & mask;
+    while (members->index[slot] != MEMBERS_INDEX_EMPTY) {
+        if (cluster_member_addr_equals(&members->set[members->index[slot]].address, addr)) break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static void cluster_member_index_delete(cluster_member_set_t *members, uint32_t slot) {
+    uint32_t mask = members->index_capacity - 1;
+    members->index[slot] = MEMBERS_INDEX_EMPTY;
+
+    // Shift back the following entries of the same cluster so that
+    // lookups never stop at the freed slot.
+    uint32_t next = slot;
+    while (1) {
+        next = (next + 1) & mask;
+        uint32_t position = members->index[next];
+        if (position == MEMBERS_INDEX_EMPTY) break;
+        uint32_t home = cluster_member_addr_hash(&members->set[position].address) & mask;
+        cluster_bool_t stays = (slot <= next) ? (slot < home && home <= next)
+                                              : (slot < home || home <= next);
+        if (!stays) {
+            members->index[slot] = position;
+            members->index[next] = MEMBERS_INDEX_EMPTY;
+            slot = next;
+        }
+    }
+}
+
 static cluster_member_set_t *cluster_member_set_extend(cluster_member_set_t *members, 
                                                         uint32_t required_size) 
 {
-    uint32_t new_capacity = members->capacity;
-    while (required_size >= new_capacity * MEMBERS_LOAD_FACTOR) new_capacity *= MEMBERS_EXTENSION_FACTOR;
+    if (required_size > members->capacity) {
+        uint32_t new_capacity = members->capacity;
+        while (required_size > new_capacity) new_capacity *= MEMBERS_EXTENSION_FACTOR;
 
-    cluster_member_t **new_member_set = (cluster_member_t **) calloc(new_capacity, sizeof(cluster_member_t *));
-    if (new_member_set == NULL) return NULL;
+        cluster_member_t *new_member_set =
+                (cluster_member_t *) realloc(members->set, new_capacity * sizeof(cluster_member_t));
+        if (new_member_set == NULL) return NULL;
+        members->capacity = new_capacity;
+        members->set = new_member_set;
+    }
 
-    for (int i = 0; i < members->size; ++i) {
-        if (members->set[i] != NULL) {
-            new_member_set[i] = members->set[i];
+    if (required_size >= members->index_capacity * MEMBERS_LOAD_FACTOR) {
+        uint32_t new_index_capacity = members->index_capacity;
+        while (required_size >= new_index_capacity * MEMBERS_LOAD_FACTOR) {
+            new_index_capacity *= MEMBERS_EXTENSION_FACTOR;
+        }
+
+        uint32_t *new_index = (uint32_t *) malloc(new_index_capacity * sizeof(uint32_t));
+        if (new_index == NULL) return NULL;
+        memset(new_index, 0xFF, new_index_capacity * sizeof(uint32_t));
+
+        for (uint32_t i = 0; i < members->size; ++i) {
+            cluster_member_index_insert(new_index, new_index_capacity, &members->set[i], i);
         }
+        free(members->index);
+        members->index_capacity = new_index_capacity;
+        members->index = new_index;
     }
-    free(members->set);
-    members->capacity = new_capacity;
-    members->set = new_member_set;
     return members;
 }
 
 int cluster_member_set_init(cluster_member_set_t *members) {
     uint32_t capacity = MEMBERS_INITIAL_CAPACITY;
 
-    cluster_member_t **member_set = (cluster_member_t **) calloc(capacity, sizeof(cluster_member_t *));
+    cluster_member_t *member_set = (cluster_member_t *) malloc(capacity * sizeof(cluster_member_t));
     if (member_set == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
 
+    // The index capacity must stay a power of 2.
+    uint32_t index_capacity = MEMBERS_INITIAL_CAPACITY * MEMBERS_EXTENSION_FACTOR;
+    uint32_t *index = (uint32_t *) malloc(index_capacity * sizeof(uint32_t));
+    if (index == NULL) {
+        free(member_set);
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    }
+    memset(index, 0xFF, index_capacity * sizeof(uint32_t));
+
     members->size = 0;
     members->capacity = capacity;
     members->set = member_set;
+    members->index_capacity = index_capacity;
+    members->index = index;
+    members->active_num = 0;
+    members->passive_capacity = 0;
+    cluster_rng_seed(&members->rng, ((uint64_t) cluster_random() << 32) ^ cluster_time());
     return CLUSTER_ERR_NONE;
 }
 
-int cluster_member_set_put(cluster_member_set_t *members, cluster_member_t *new_members, size_t new_members_size) {
-    uint32_t new_size = members->size + new_members_size;
-    // increase the capacity of the set if the new size is >= 0.75 of the current capacity.
-    if (new_size >= members->capacity * MEMBERS_LOAD_FACTOR) {
-        if (cluster_member_set_extend(members, new_size) == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+/* Returns true if the arrived liveness information about the same
+ * instance of the member supersedes the one we have. */
+static cluster_bool_t cluster_member_state_overrides(const cluster_member_t *update,
+                                                     const cluster_member_t *existing) {
+    switch (update->state) {
+        case MEMBER_ALIVE:
+            return update->incarnation > existing->incarnation;
+        case MEMBER_SUSPECT:
+            return update->incarnation > existing->incarnation ||
+                   (update->incarnation == existing->incarnation && existing->state == MEMBER_ALIVE);
+        case MEMBER_DEAD:
+            return update->incarnation >= existing->incarnation;
+        default:
+            return CLUSTER_FALSE;
     }
+}
 
-    for (cluster_member_t *current = new_members; current < new_members + new_members_size; ++current) {
-        cluster_bool_t exists = CLUSTER_FALSE;
-        for (int i = 0; i < members->size; ++i) {
-            if (cluster_member_equals(members->set[i], current)) {
-                exists = CLUSTER_TRUE;
-                break;
-            }
+static void cluster_member_set_remove_at(cluster_member_set_t *members, uint32_t slot);
+
+/* Makes room in the full passive view by removing a random passive member. */
+static void cluster_member_set_evict_passive(cluster_member_set_t *members) {
+    uint32_t passive_num = members->size - members->active_num;
+    if (passive_num == 0 || passive_num < members->passive_capacity) return;
+    uint32_t victim = cluster_rng_uniform(&members->rng, passive_num);
+    for (uint32_t i = 0; i < members->size; ++i) {
+        if (members->set[i].view != MEMBER_VIEW_PASSIVE) continue;
+        if (victim-- == 0) {
+            cluster_member_set_remove_at(members, cluster_member_index_lookup(members, &members->set[i].address));
+            return;
         }
-        if (!exists) {
-            // New member.
-            cluster_member_t *new_member = (cluster_member_t *) malloc(sizeof(cluster_member_t));
-            if (new_member == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
-
-            cluster_member_copy(new_member, current);
-            members->set[members->size] = new_member;
-            ++members->size;
+    }
+}
+
+/* Merges the member into the set. The set must have a room for one more member.
+ * Returns true if the set has been changed. */
+static cluster_bool_t cluster_member_set_merge(cluster_member_set_t *members, const cluster_member_t *update) {
+    uint32_t slot = cluster_member_index_lookup(members, &update->address);
+    if (members->index[slot] == MEMBERS_INDEX_EMPTY) {
+        // Members that are known to be dead are not added back.
+        if (update->state == MEMBER_DEAD) return CLUSTER_FALSE;
+        if (members->passive_capacity > 0) {
+            cluster_member_set_evict_passive(members);
+            // The eviction might have shifted the index.
+            slot = cluster_member_index_lookup(members, &update->address);
         }
+        cluster_member_t *new_member = &members->set[members->size];
+        memcpy(new_member, update, sizeof(cluster_member_t));
+        new_member->username[sizeof(new_member->username)-1] = '\0';
+        new_member->view = members->passive_capacity > 0 ? MEMBER_VIEW_PASSIVE : MEMBER_VIEW_ACTIVE;
+        if (new_member->view == MEMBER_VIEW_ACTIVE) ++members->active_num;
+        members->index[slot] = members->size;
+        ++members->size;
+        return CLUSTER_TRUE;
     }
-    return CLUSTER_ERR_NONE;
+
+    cluster_member_t *existing = &members->set[members->index[slot]];
+    if (update->uid != existing->uid) {
+        // A different instance of the node on the same address. The one
+        // that has been started later wins.
+        if (update->uid < existing->uid) return CLUSTER_FALSE;
+    } else {
+        // The datagram size of the same instance never changes, so it's
+        // learned regardless of the liveness information.
+        if (update->max_message_size != 0) existing->max_message_size = update->max_message_size;
+        if (!cluster_member_state_overrides(update, existing)) return CLUSTER_FALSE;
+    }
+
+    if (update->state == MEMBER_DEAD) {
+        cluster_member_set_remove_at(members, slot);
+    } else {
+        uint8_t view = existing->view;
+        uint16_t max_message_size = update->uid == existing->uid && update->max_message_size == 0 ?
+                                    existing->max_message_size : update->max_message_size;
+        memcpy(existing, update, sizeof(cluster_member_t));
+        existing->username[sizeof(existing->username)-1] = '\0';
+        existing->view = view;
+        existing->max_message_size = max_message_size;
+    }
+    return CLUSTER_TRUE;
 }
 
-static void cluster_member_set_item_destroy(cluster_member_t *member) {
-    if (member != NULL) {
-        cluster_member_destroy(member);
-        free(member);
+int cluster_member_set_put(cluster_member_set_t *members, cluster_member_t *new_members, size_t new_members_size) {
+    uint32_t new_size = members->size + new_members_size;
+    if (cluster_member_set_extend(members, new_size) == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+
+    for (cluster_member_t *current = new_members; current < new_members + new_members_size; ++current) {
+        cluster_member_set_merge(members, current);
     }
+    return CLUSTER_ERR_NONE;
+}
+
+int cluster_member_set_update(cluster_member_set_t *members, const cluster_member_t *update) {
+    if (cluster_member_set_extend(members, members->size + 1) == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+    return cluster_member_set_merge(members, update);
 }
 
 void cluster_member_set_destroy(cluster_member_set_t *members) {
     for (int i = 0; i < members->size; ++i) {
-        cluster_member_set_item_destroy(members->set[i]);
+        cluster_member_destroy(&members->set[i]);
     }
     free(members->set);
+    free(members->index);
 }
 
-static void cluster_member_set_shift(cluster_member_set_t *members, uint32_t idx) {
-    for (int i = idx; i < members->size - 1; ++i) {
-        members->set[i] = members->set[i + 1];
+/* Removes the member referenced by the given index slot. The last member
+ * of the set takes its place, so the set stays dense. */
+static void cluster_member_set_remove_at(cluster_member_set_t *members, uint32_t slot) {
+    uint32_t position = members->index[slot];
+    cluster_member_index_delete(members, slot);
+    if (members->set[position].view == MEMBER_VIEW_ACTIVE) --members->active_num;
+    cluster_member_destroy(&members->set[position]);
+
+    uint32_t last = members->size - 1;
+    if (position != last) {
+        uint32_t moved_slot = cluster_member_index_lookup(members, &members->set[last].address);
+        members->index[moved_slot] = position;
+        members->set[position] = members->set[last];
     }
     --members->size;
 }
 
 int cluster_member_set_remove(cluster_member_set_t *members, cluster_member_t *member) {
-    for (int i = 0; i < members->size; ++i) {
-        if (members->set[i] == member) {
-            cluster_member_set_item_destroy(member);
-            cluster_member_set_shift(members, i);
-            return CLUSTER_TRUE;
-        }
+    uint32_t slot = cluster_member_index_lookup(members, &member->address);
+    if (members->index[slot] == MEMBERS_INDEX_EMPTY || &members->set[members->index[slot]] != member) {
+        return CLUSTER_FALSE;
     }
-    return CLUSTER_FALSE;
+    cluster_member_set_remove_at(members, slot);
+    return CLUSTER_TRUE;
+}
+
+cluster_member_t *cluster_member_set_find(cluster_member_set_t *members,
+                                          const cluster_member_addr_t *addr) {
+    uint32_t slot = cluster_member_index_lookup(members, addr);
+    if (members->index[slot] == MEMBERS_INDEX_EMPTY) return NULL;
+    return &members->set[members->index[slot]];
 }
 
 cluster_member_t *cluster_member_set_find_by_addr(cluster_member_set_t *members,
                                                   const cluster_sockaddr_storage *addr,
                                                   cluster_socklen_t addr_size) {
-    for (int i = 0; i < members->size; ++i) {
-        if (memcmp(members->set[i]->address, addr, addr_size) == 0) return members->set[i];
-    }
-    return NULL;
+    cluster_member_addr_t member_addr;
+    if (cluster_member_addr_from_sockaddr(&member_addr, addr, addr_size) < 0) return NULL;
+    uint32_t slot = cluster_member_index_lookup(members, &member_addr);
+    if (members->index[slot] == MEMBERS_INDEX_EMPTY) return NULL;
+    return &members->set[members->index[slot]];
 }
 
 int cluster_member_set_remove_by_addr(cluster_member_set_t *members,
                                       const cluster_sockaddr_storage *addr,
                                       cluster_socklen_t addr_size) {
-    for (int i = 0; i < members->size; ++i) {
-        if (memcmp(members->set[i]->address, addr, addr_size) == 0) {
-            cluster_member_set_item_destroy(members->set[i]);
-            cluster_member_set_shift(members, i);
-            return CLUSTER_TRUE;
+    cluster_member_addr_t member_addr;
+    if (cluster_member_addr_from_sockaddr(&member_addr, addr, addr_size) < 0) return CLUSTER_FALSE;
+    uint32_t slot = cluster_member_index_lookup(members, &member_addr);
+    if (members->index[slot] == MEMBERS_INDEX_EMPTY) return CLUSTER_FALSE;
+    cluster_member_set_remove_at(members, slot);
+    return CLUSTER_TRUE;
+}
+
+#define MEMBER_DIGEST_FNV_OFFSET 14695981039346656037ULL
+#define MEMBER_DIGEST_FNV_PRIME  1099511628211ULL
+
+static inline uint64_t cluster_member_digest_mix(uint64_t hash, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        hash ^= (value >> (i * 8)) & 0xFF;
+        hash *= MEMBER_DIGEST_FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t cluster_member_digest_addr_hash(const cluster_member_addr_t *addr) {
+    // Unlike the index hash, the digest must be the same on every host,
+    // so the family and the port are mixed in as values, not as raw bytes.
+    size_t addr_len = (addr->family == AF_INET6) ? 16 : 4;
+    uint64_t hash = MEMBER_DIGEST_FNV_OFFSET;
+    hash = cluster_member_digest_mix(hash, (uint32_t) addr_len);
+    for (size_t i = 0; i < addr_len; ++i) {
+        hash ^= addr->addr[i];
+        hash *= MEMBER_DIGEST_FNV_PRIME;
+    }
+    return cluster_member_digest_mix(hash, CLUSTER_NTOHS(addr->port));
+}
+
+uint32_t cluster_member_digest_bucket(const cluster_member_t *member) {
+    return (uint32_t) (cluster_member_digest_addr_hash(&member->address) % CLUSTER_MEMBER_DIGEST_BUCKETS);
+}
+
+void cluster_member_digest_add(const cluster_member_t *member, uint64_t *digest) {
+    uint64_t addr_hash = cluster_member_digest_addr_hash(&member->address);
+    uint64_t hash = cluster_member_digest_mix(addr_hash, member->uid);
+    hash = cluster_member_digest_mix(hash, member->incarnation);
+    // Final avalanche, so that XOR of similar records doesn't cancel out.
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    digest[addr_hash % CLUSTER_MEMBER_DIGEST_BUCKETS] ^= hash;
+}
+
+void cluster_member_set_digest(const cluster_member_set_t *members, uint64_t *digest) {
+    memset(digest, 0, CLUSTER_MEMBER_DIGEST_BUCKETS * sizeof(uint64_t));
+    for (uint32_t i = 0; i < members->size; ++i) {
+        cluster_member_digest_add(&members->set[i], digest);
+    }
+}
+
+void cluster_member_set_enable_views(cluster_member_set_t *members, uint32_t passive_capacity) {
+    members->passive_capacity = passive_capacity;
+}
+
+int cluster_member_set_move(cluster_member_set_t *members, const cluster_member_addr_t *addr, uint8_t view) {
+    cluster_member_t *member = cluster_member_set_find(members, addr);
+    if (member == NULL || member->view == view) return CLUSTER_FALSE;
+    member->view = view;
+    if (view == MEMBER_VIEW_ACTIVE) {
+        ++members->active_num;
+    } else {
+        --members->active_num;
+    }
+    return CLUSTER_TRUE;
+}
+
+size_t cluster_member_set_random_view(cluster_member_set_t *members, uint8_t view,
+                                      cluster_member_t **reservoir, size_t reservoir_size) {
+    // The reservoir sampling over members of the view only.
+    size_t seen = 0;
+    for (uint32_t i = 0; i < members->size; ++i) {
+        if (members->set[i].view != view) continue;
+        if (seen < reservoir_size) {
+            reservoir[seen] = &members->set[i];
+        } else {
+            size_t random_idx = cluster_rng_uniform(&members->rng, seen + 1);
+            if (random_idx < reservoir_size) reservoir[random_idx] = &members->set[i];
         }
+        ++seen;
     }
-    return CLUSTER_FALSE;
+    return seen < reservoir_size ? seen : reservoir_size;
 }
 
 size_t cluster_member_set_random_members(cluster_member_set_t *members,
                                          cluster_member_t **reservoir, size_t reservoir_size) {
-    // Randomly choosing the specified number of elements using the
-    // reservoir sampling algorithm.
-    if (members->size == 0) return 0;
-    size_t actual_reservoir_size = (members->size > reservoir_size) ? reservoir_size : members->size;
-
-    size_t reservoir_idx = 0;
-    size_t member_idx = 0;
-
-    // Fill in the reservoir with first set elements.
-    while (reservoir_idx < actual_reservoir_size) {
-        reservoir[reservoir_idx] = members->set[member_idx];
-        ++member_idx;
-        ++reservoir_idx;
-    }
-
-    // Randomly replace reservoir's elements with items from the member's set.
-    if (actual_reservoir_size < members->size) {
-        for (; member_idx < members->size; ++member_idx) {
-            size_t random_idx = cluster_random() % (member_idx + 1);
-            if (random_idx < actual_reservoir_size) {
-                reservoir[random_idx] = members->set[member_idx];
+    if (members->active_num < members->size) {
+        return cluster_member_set_random_view(members, MEMBER_VIEW_ACTIVE, reservoir, reservoir_size);
+    }
+    if (members->size == 0 || reservoir_size == 0) return 0;
+    uint32_t size = members->size;
+    uint32_t chosen_num = (size > reservoir_size) ? (uint32_t) reservoir_size : size;
+
+    // Floyd's algorithm picks distinct members with a single random
+    // number per chosen member. The chosen ones are few, so they are
+    // simply scanned for duplicates.
+    for (uint32_t j = size - chosen_num, idx = 0; j < size; ++j, ++idx) {
+        cluster_member_t *candidate = &members->set[cluster_rng_uniform(&members->rng, j + 1)];
+        for (uint32_t i = 0; i < idx; ++i) {
+            if (reservoir[i] == candidate) {
+                candidate = &members->set[j];
+                break;
             }
         }
+        reservoir[idx] = candidate;
     }
 
-    return actual_reservoir_size;
-}
\ No newline at end of file
+    // The subset is random but its order is not, while callers
+    // often take the first suitable member.
+    for (uint32_t i = chosen_num - 1; i > 0; --i) {
+        uint32_t other = cluster_rng_uniform(&members->rng, i + 1);
+        cluster_member_t *tmp = reservoir[i];
+        reservoir[i] = reservoir[other];
+        reservoir[other] = tmp;
+    }
+    return chosen_num;
+}
+
+/* The snapshot file starts with the magic, the format version, the number
+ * of members and the CRC-32 of the members that follow in the compact
+ * encoding including their liveness. */
+static const uint8_t MEMBER_SNAPSHOT_MAGIC[4] = {'K', 'X', 'M', 'S'};
+static const uint32_t MEMBER_SNAPSHOT_VERSION = 1;
+#define MEMBER_SNAPSHOT_HEADER_SIZE (sizeof(MEMBER_SNAPSHOT_MAGIC) + 3 * sizeof(uint32_t))
+
+int cluster_member_snapshot_write(const cluster_member_set_t *members, const char *path) {
+    size_t size = MEMBER_SNAPSHOT_HEADER_SIZE;
+    for (uint32_t i = 0; i < members->size; ++i) {
+        if (members->set[i].state == MEMBER_DEAD) continue;
+        size += cluster_member_compact_size(&members->set[i], MEMBER_ENCODE_LIVENESS);
+    }
+    uint8_t *buffer = (uint8_t *) malloc(size);
+    if (buffer == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+
+    uint8_t *cursor = buffer + MEMBER_SNAPSHOT_HEADER_SIZE;
+    uint32_t members_num = 0;
+    for (uint32_t i = 0; i < members->size; ++i) {
+        if (members->set[i].state == MEMBER_DEAD) continue;
+        cursor += cluster_member_compact_encode(&members->set[i], cursor, buffer + size - cursor,
+                                                MEMBER_ENCODE_LIVENESS);
+        ++members_num;
+    }
+    memcpy(buffer, MEMBER_SNAPSHOT_MAGIC, sizeof(MEMBER_SNAPSHOT_MAGIC));
+    uint32_encode(MEMBER_SNAPSHOT_VERSION, buffer + 4);
+    uint32_encode(members_num, buffer + 8);
+    uint32_encode(cluster_crc32(0, buffer + MEMBER_SNAPSHOT_HEADER_SIZE, size - MEMBER_SNAPSHOT_HEADER_SIZE),
+                  buffer + 12);
+
+    // Write a temporary file next to the snapshot and move it into place.
+    size_t tmp_path_size = strlen(path) + sizeof(".tmp");
+    char *tmp_path = (char *) malloc(tmp_path_size);
+    if (tmp_path == NULL) {
+        free(buffer);
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    }
+    snprintf(tmp_path, tmp_path_size, "%s.tmp", path);
+    int result = CLUSTER_ERR_WRITE_FAILED;
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        if (write(fd, buffer, size) == (ssize_t) size && fsync(fd) == 0) result = CLUSTER_ERR_NONE;
+        if (close(fd) < 0) result = CLUSTER_ERR_WRITE_FAILED;
+        if (result == CLUSTER_ERR_NONE && rename(tmp_path, path) < 0) result = CLUSTER_ERR_WRITE_FAILED;
+        if (result < 0) unlink(tmp_path);
+    }
+    free(tmp_path);
+    free(buffer);
+    return result;
+}
+
+int cluster_member_snapshot_read(const char *path, cluster_member_t **result) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return CLUSTER_ERR_READ_FAILED;
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) size = ftell(file);
+    uint8_t *buffer = size > 0 ? (uint8_t *) malloc(size) : NULL;
+    int read_result = CLUSTER_ERR_READ_FAILED;
+    if (buffer != NULL && fseek(file, 0, SEEK_SET) == 0 && fread(buffer, 1, size, file) == (size_t) size) {
+        read_result = CLUSTER_ERR_NONE;
+    }
+    fclose(file);
+    if (read_result < 0) {
+        free(buffer);
+        return read_result;
+    }
+
+    if (size < (long) MEMBER_SNAPSHOT_HEADER_SIZE) {
+        free(buffer);
+        return CLUSTER_ERR_INVALID_MESSAGE;
+    }
+    uint32_t members_num = uint32_decode(buffer + 8);
+    if (memcmp(buffer, MEMBER_SNAPSHOT_MAGIC, sizeof(MEMBER_SNAPSHOT_MAGIC)) != 0 ||
+        uint32_decode(buffer + 4) != MEMBER_SNAPSHOT_VERSION ||
+        uint32_decode(buffer + 12) != cluster_crc32(0, buffer + MEMBER_SNAPSHOT_HEADER_SIZE,
+                                                    size - MEMBER_SNAPSHOT_HEADER_SIZE) ||
+        members_num > (size_t) size) {
+        free(buffer);
+        return CLUSTER_ERR_INVALID_MESSAGE;
+    }
+
+    cluster_member_t *members = (cluster_member_t *) calloc(members_num > 0 ? members_num : 1,
+                                                            sizeof(cluster_member_t));
+    if (members == NULL) {
+        free(buffer);
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    }
+    const uint8_t *cursor = buffer + MEMBER_SNAPSHOT_HEADER_SIZE;
+    const uint8_t *buffer_end = buffer + size;
+    for (uint32_t i = 0; i < members_num; ++i) {
+        int decode_result = cluster_member_compact_decode(cursor, buffer_end - cursor, &members[i],
+                                                          MEMBER_ENCODE_LIVENESS);
+        if (decode_result < 0) {
+            free(members);
+            free(buffer);
+            return CLUSTER_ERR_INVALID_MESSAGE;
+        }
+        cursor += decode_result;
+    }
+    free(buffer);
+    *result = members;
+    return members_num;
+}
@@ -23,18 +23,68 @@
 extern "C" {
 #endif
 
+/* Compact representation of an IPv4 or IPv6 member address. */
+struct cluster_member_addr {
+    uint16_t family;    /* AF_INET or AF_INET6 */
+    uint16_t port;      /* in network byte order */
+    uint8_t addr[16];   /* IPv4 address occupies the first 4 bytes */
+};
+
+/* Liveness state of a member. */
+#define MEMBER_ALIVE    0x00
+#define MEMBER_SUSPECT  0x01
+#define MEMBER_DEAD     0x02
+
+/* The view of the partial membership a member belongs to. Without
+ * partial views all members are active. */
+#define MEMBER_VIEW_ACTIVE  0x00
+#define MEMBER_VIEW_PASSIVE 0x01
+
+/* Options of the compact member encoding. */
+#define MEMBER_ENCODE_LIVENESS  0x01    /* include the state and the incarnation */
+#define MEMBER_ENCODE_MAX_SIZE  0x02    /* include the largest datagram the member accepts */
+
+/* The number of buckets the membership digest consists of. Members are
+ * assigned to buckets by their address, and only the members of buckets
+ * whose digests differ are exchanged. */
+#ifndef CLUSTER_MEMBER_DIGEST_BUCKETS
+#define CLUSTER_MEMBER_DIGEST_BUCKETS 32
+#endif
+
 struct cluster_member {
     char username[32];
     uint16_t version;
     uint32_t uid;
-    cluster_socklen_t address_len;
-    cluster_sockaddr_storage *address;
+    uint8_t state;
+    /* Only the member itself increments its incarnation
+     * in order to refute a suspicion. */
+    uint32_t incarnation;
+    cluster_member_addr_t address;
+    /* The largest datagram the member accepts, zero
+     * if it hasn't been advertised yet. */
+    uint16_t max_message_size;
+    /* Local to this node, never encoded. */
+    uint8_t view;
 };
 
 struct cluster_member_set {
-    cluster_member_t **set;
+    /* Members are stored contiguously in the first 'size' entries.
+     * Pointers into the set are invalidated by any put or remove. */
+    cluster_member_t *set;
     uint32_t size;
     uint32_t capacity;
+    /* Open addressing (linear probing) index of positions in 'set'
+     * keyed by the member's address. */
+    uint32_t *index;
+    uint32_t index_capacity;
+    /* The number of members in the active view. */
+    uint32_t active_num;
+    /* With partial views enabled, new members join the passive view and
+     * push out a random passive member once it's full. 0 keeps all
+     * members active. */
+    uint32_t passive_capacity;
+    /* Drives the random sampling of members. */
+    cluster_rng_t rng;
 };
 
 int cluster_member_init(cluster_member_t *result, 
@@ -42,22 +92,95 @@ int cluster_member_init(cluster_member_t *result,
                         cluster_socklen_t address_len,
                         const char *uname,
                         uint16_t uname_len);
+int cluster_member_addr_from_sockaddr(cluster_member_addr_t *result,
+                                      const cluster_sockaddr_storage *address,
+                                      cluster_socklen_t address_len);
+cluster_socklen_t cluster_member_addr_to_sockaddr(const cluster_member_addr_t *address,
+                                                  cluster_sockaddr_storage *result);
+cluster_bool_t cluster_member_addr_equals(const cluster_member_addr_t *first,
+                                          const cluster_member_addr_t *second);
+size_t cluster_member_addr_size(const cluster_member_addr_t *address);
+int cluster_member_addr_encode(const cluster_member_addr_t *address, uint8_t *buffer, size_t buffer_size);
+int cluster_member_addr_decode(const uint8_t *buffer, size_t buffer_size, cluster_member_addr_t *address);
 int cluster_member_equals(cluster_member_t *first, cluster_member_t *second);
 void cluster_member_destroy(cluster_member_t *result);
 int cluster_member_decode(const uint8_t *buffer, size_t buffer_size, cluster_member_t *member);
 int cluster_member_encode(const cluster_member_t *member, uint8_t *buffer, size_t buffer_size);
+size_t cluster_member_encoded_size(const cluster_member_t *member);
+int cluster_member_compact_decode(const uint8_t *buffer, size_t buffer_size, cluster_member_t *member, int options);
+int cluster_member_compact_encode(const cluster_member_t *member, uint8_t *buffer, size_t buffer_size, int options);
+size_t cluster_member_compact_size(const cluster_member_t *member, int options);
 int cluster_member_set_init(cluster_member_set_t *members);
 int cluster_member_set_put(cluster_member_set_t *members, cluster_member_t *new_members, size_t new_members_size);
+int cluster_member_set_update(cluster_member_set_t *members, const cluster_member_t *update);
 int cluster_member_set_remove(cluster_member_set_t *members, cluster_member_t *member);
+cluster_member_t *cluster_member_set_find(cluster_member_set_t *members,
+                                          const cluster_member_addr_t *addr);
 cluster_member_t *cluster_member_set_find_by_addr(cluster_member_set_t *members,
                                                   const cluster_sockaddr_storage *addr,
                                                   cluster_socklen_t addr_size);
 int cluster_member_set_remove_by_addr(cluster_member_set_t *members,
                                       const cluster_sockaddr_storage *addr,
                                       cluster_socklen_t addr_size);
+/**
+ * Returns the digest bucket of the member. Buckets depend on
+ * the member's address only.
+ */
+uint32_t cluster_member_digest_bucket(const cluster_member_t *member);
+/**
+ * Adds the member's (uid, address, incarnation) to its digest bucket.
+ * Adding the same member twice removes it from the digest.
+ */
+void cluster_member_digest_add(const cluster_member_t *member, uint64_t *digest);
+/**
+ * Computes the membership digest of the set. The digest
+ * consists of CLUSTER_MEMBER_DIGEST_BUCKETS values.
+ */
+void cluster_member_set_digest(const cluster_member_set_t *members, uint64_t *digest);
+/**
+ * Enables partial views: from now on new members join the passive
+ * view which holds at most passive_capacity members.
+ */
+void cluster_member_set_enable_views(cluster_member_set_t *members, uint32_t passive_capacity);
+/**
+ * Moves the member to the given view.
+ *
+ * @return CLUSTER_TRUE if the view has been changed, CLUSTER_FALSE
+ *         if the member is unknown or already belongs to the view.
+ */
+int cluster_member_set_move(cluster_member_set_t *members, const cluster_member_addr_t *addr, uint8_t view);
+/**
+ * Randomly chooses up to reservoir_size members of the given view.
+ *
+ * @return the number of chosen members.
+ */
+size_t cluster_member_set_random_view(cluster_member_set_t *members, uint8_t view,
+                                      cluster_member_t **reservoir, size_t reservoir_size);
+/**
+ * Randomly chooses up to reservoir_size members of the active view,
+ * which spans all members unless partial views are enabled. Without
+ * partial views it takes O(reservoir_size) time regardless of the
+ * size of the set.
+ */
 size_t cluster_member_set_random_members(cluster_member_set_t *members,
                                          cluster_member_t **reservoir, size_t reservoir_size);
 void cluster_member_set_destroy(cluster_member_set_t *members);
+/**
+ * Writes the members which aren't known to be dead into the snapshot
+ * file. The file is replaced atomically, so a crash leaves either the
+ * previous snapshot or the new one.
+ *
+ * @return zero on success or CLUSTER_ERR_WRITE_FAILED.
+ */
+int cluster_member_snapshot_write(const cluster_member_set_t *members, const char *path);
+/**
+ * Reads the members stored in the snapshot file. The returned array
+ * should be released with free().
+ *
+ * @return the number of members, CLUSTER_ERR_READ_FAILED if the file
+ *         can't be read or CLUSTER_ERR_INVALID_MESSAGE if it's corrupted.
+ */
+int cluster_member_snapshot_read(const char *path, cluster_member_t **result);
 
 #ifdef  __cplusplus
 }
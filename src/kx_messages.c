@@ -27,6 +27,33 @@ int message_type_decode(const uint8_t *buffer, size_t buffer_size) {
     return *(buffer + PROTOCOL_ID_LENGTH);
 }
 
+int message_flags_decode(const uint8_t *buffer, size_t buffer_size) {
+    if (buffer_size < sizeof(message_header_t)) {
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    }
+    return uint16_decode(buffer + MESSAGE_FLAGS_OFFSET);
+}
+
+/* Locates the piggybacked members at the end of the message.
+ * Returns the size of the message without the trailer. */
+int message_piggyback_decode(const uint8_t *buffer, size_t buffer_size,
+                             const uint8_t **members, size_t *members_size, uint8_t *members_n) {
+    if (buffer_size < sizeof(message_header_t) + MESSAGE_PIGGYBACK_OVERHEAD) {
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    }
+    const uint8_t *buffer_end = buffer + buffer_size;
+    uint16_t trailer_size = uint16_decode(buffer_end - sizeof(uint16_t));
+    if (trailer_size < sizeof(uint8_t) ||
+        trailer_size > buffer_size - sizeof(message_header_t) - sizeof(uint16_t)) {
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    }
+    const uint8_t *trailer = buffer_end - sizeof(uint16_t) - trailer_size;
+    *members_n = *trailer;
+    *members = trailer + sizeof(uint8_t);
+    *members_size = trailer_size - sizeof(uint8_t);
+    return trailer - buffer;
+}
+
 static int message_is_payload_valid(const uint8_t *buffer, size_t buffer_size, uint8_t type) {
     return message_type_decode(buffer, buffer_size) == type &&
             memcmp(buffer, PROTOCOL_ID, PROTOCOL_ID_LENGTH) == 0;
@@ -35,7 +62,7 @@ static int message_is_payload_valid(const uint8_t *buffer, size_t buffer_size, u
 void message_header_init(message_header_t *header, uint8_t message_type, uint32_t sequence_number) {
     memcpy(header->protocol_id, PROTOCOL_ID, PROTOCOL_ID_LENGTH);
     header->message_type = message_type;
-    header->reserved = 0;
+    header->flags = 0;
     header->sequence_num = sequence_number;
 }
 
@@ -47,7 +74,7 @@ static int message_header_encode(const message_header_t *msg, uint8_t *buffer, s
     *cursor = msg->message_type;
     cursor += sizeof(uint8_t);
 
-    uint16_encode(msg->reserved, cursor);
+    uint16_encode(msg->flags, cursor);
     cursor += sizeof(uint16_t);
 
     uint32_encode(msg->sequence_num, cursor);
@@ -64,19 +91,37 @@ static int message_header_decode(const uint8_t *buffer, size_t buffer_size, mess
     result->message_type = *cursor;
     cursor += sizeof(uint8_t);
 
-    result->reserved = uint16_decode(cursor);
+    result->flags = uint16_decode(cursor);
     cursor += sizeof(uint16_t);
 
     result->sequence_num = uint32_decode(cursor);
     return sizeof(struct message_header);
 }
 
+/* With MESSAGE_FLAG_MAX_SIZE the member in Hello and Welcome messages is
+ * followed by the largest datagram its sender accepts. */
+static inline size_t message_max_size_size(uint16_t flags) {
+    return (flags & MESSAGE_FLAG_MAX_SIZE) ? sizeof(uint16_t) : 0;
+}
+
+static size_t message_max_size_encode(uint16_t flags, const cluster_member_t *member, uint8_t *buffer) {
+    if (!(flags & MESSAGE_FLAG_MAX_SIZE)) return 0;
+    uint16_encode(member->max_message_size, buffer);
+    return sizeof(uint16_t);
+}
+
+static int message_max_size_decode(const uint8_t *buffer, size_t buffer_size, uint16_t flags,
+                                   cluster_member_t *member) {
+    if (!(flags & MESSAGE_FLAG_MAX_SIZE)) return 0;
+    if (buffer_size < sizeof(uint16_t)) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    member->max_message_size = uint16_decode(buffer);
+    return sizeof(uint16_t);
+}
+
 int message_hello_decode(const uint8_t *buffer, size_t buffer_size, message_hello_t *result) {
     RETURN_IF_INVALID_PAYLOAD(MESSAGE_HELLO_TYPE, CLUSTER_ERR_INVALID_MESSAGE);
 
-    size_t min_size = sizeof(message_header_t) 
-                     + sizeof(cluster_member_t)
-                     - sizeof(cluster_sockaddr_storage *);
+    size_t min_size = sizeof(message_header_t);
     if (buffer_size < min_size) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
 
     message_header_decode(buffer, buffer_size, &result->header);
@@ -87,15 +132,24 @@ int message_hello_decode(const uint8_t *buffer, size_t buffer_size, message_hell
     int member_bytes = cluster_member_decode(buffer + sizeof(message_header_t),
                                              buffer_size - sizeof(message_header_t),
                                              result->this_member);
-    if (member_bytes < 0) return member_bytes;
-    return sizeof(message_header_t) + member_bytes;
+    if (member_bytes < 0) {
+        free(result->this_member);
+        return member_bytes;
+    }
+    int max_size_bytes = message_max_size_decode(buffer + sizeof(message_header_t) + member_bytes,
+                                                 buffer_size - sizeof(message_header_t) - member_bytes,
+                                                 result->header.flags, result->this_member);
+    if (max_size_bytes < 0) {
+        free(result->this_member);
+        return max_size_bytes;
+    }
+    return sizeof(message_header_t) + member_bytes + max_size_bytes;
 }
 
 int message_hello_encode(const message_hello_t *msg, uint8_t *buffer, size_t buffer_size) {
     size_t expected_size = sizeof(message_header_t) 
-                          + sizeof(cluster_member_t)
-                          - sizeof(cluster_sockaddr_storage *)
-                          + msg->this_member->address_len;
+                          + cluster_member_encoded_size(msg->this_member)
+                          + message_max_size_size(msg->header.flags);
     if (buffer_size < expected_size)
         return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
     
@@ -105,6 +159,7 @@ int message_hello_encode(const message_hello_t *msg, uint8_t *buffer, size_t buf
     uint8_t *cursor = buffer + encode_result;
     const uint8_t *buffer_end = buffer + buffer_size;
     cursor += cluster_member_encode(msg->this_member, cursor, buffer_end - cursor);
+    cursor += message_max_size_encode(msg->header.flags, msg->this_member, cursor);
 
     return cursor - buffer;
 }
@@ -117,9 +172,7 @@ int message_welcome_decode(const uint8_t *buffer, size_t buffer_size, message_we
     RETURN_IF_INVALID_PAYLOAD(MESSAGE_WELCOME_TYPE, CLUSTER_ERR_INVALID_MESSAGE);
 
     size_t min_size = sizeof(message_header_t)
-                     + sizeof(uint32_t)
-                     + sizeof(cluster_member_t)
-                     - sizeof(cluster_sockaddr_storage *);
+                     + sizeof(uint32_t);
     if (buffer_size < min_size)
         return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
     
@@ -136,7 +189,18 @@ int message_welcome_decode(const uint8_t *buffer, size_t buffer_size, message_we
         return CLUSTER_ERR_ALLOCATION_FAILED;
     
     decode_result = cluster_member_decode(cursor, buffer_end - cursor, result->this_member);
-    if (decode_result < 0) return decode_result;
+    if (decode_result < 0) {
+        free(result->this_member);
+        return decode_result;
+    }
+    cursor += decode_result;
+
+    decode_result = message_max_size_decode(cursor, buffer_end - cursor, result->header.flags,
+                                            result->this_member);
+    if (decode_result < 0) {
+        free(result->this_member);
+        return decode_result;
+    }
     cursor += decode_result;
 
     return cursor - buffer;
@@ -145,9 +209,8 @@ int message_welcome_decode(const uint8_t *buffer, size_t buffer_size, message_we
 int message_welcome_encode(const message_welcome_t *msg, uint8_t *buffer, size_t buffer_size) {
     size_t expected_size = sizeof(message_header_t) 
                           + sizeof(uint32_t) 
-                          + sizeof(cluster_member_t) 
-                          - sizeof(cluster_sockaddr_storage *)
-                          + msg->this_member->address_len;
+                          + cluster_member_encoded_size(msg->this_member)
+                          + message_max_size_size(msg->header.flags);
     if (buffer_size < expected_size) 
         return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
     int encode_result = message_header_encode(&msg->header, buffer, buffer_size);
@@ -158,6 +221,7 @@ int message_welcome_encode(const message_welcome_t *msg, uint8_t *buffer, size_t
 
     const uint8_t *buffer_end = buffer + buffer_size;
     cursor += cluster_member_encode(msg->this_member, cursor, buffer_end - cursor);
+    cursor += message_max_size_encode(msg->header.flags, msg->this_member, cursor);
 
     return cursor - buffer;
 }
@@ -198,6 +262,7 @@ int message_data_decode(const uint8_t *buffer, size_t buffer_size, message_data_
 }
 
 int message_data_encode(const message_data_t *msg, uint8_t *buffer, size_t buffer_size) {
+    if (msg->data_size > UINT16_MAX) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
     size_t min_size = sizeof(message_header_t) 
                      + VECTOR_RECORD_SIZE
                      + sizeof(uint16_t)
@@ -225,6 +290,11 @@ int message_data_encode(const message_data_t *msg, uint8_t *buffer, size_t buffe
     return cursor - buffer;
 }
 
+static int message_member_options(uint16_t flags) {
+    return ((flags & MESSAGE_FLAG_MEMBER_LIVENESS) ? MEMBER_ENCODE_LIVENESS : 0) |
+           ((flags & MESSAGE_FLAG_MEMBER_MAX_SIZE) ? MEMBER_ENCODE_MAX_SIZE : 0);
+}
+
 int message_member_list_decode(const uint8_t *buffer, size_t buffer_size, message_member_list_t *result) {
     RETURN_IF_INVALID_PAYLOAD(MESSAGE_MEMBER_LIST_TYPE, CLUSTER_ERR_INVALID_MESSAGE);
 
@@ -245,17 +315,34 @@ int message_member_list_decode(const uint8_t *buffer, size_t buffer_size, messag
     if (result->members == NULL)
         return CLUSTER_ERR_ALLOCATION_FAILED;
     
+    cluster_bool_t compact = (result->header.flags & MESSAGE_FLAG_COMPACT_MEMBERS) != 0;
+    int options = message_member_options(result->header.flags);
     for (int i = 0; i < result->members_n; ++i) {
-        decode_result = cluster_member_decode(cursor, buffer_end - cursor, &result->members[i]);
-        if (decode_result < 0) return decode_result;
+        if (compact) {
+            decode_result = cluster_member_compact_decode(cursor, buffer_end - cursor, &result->members[i],
+                                                          options);
+        } else {
+            decode_result = cluster_member_decode(cursor, buffer_end - cursor, &result->members[i]);
+        }
+        if (decode_result < 0) {
+            free(result->members);
+            return decode_result;
+        }
         cursor += decode_result;
     }
     return cursor - buffer;
 }
 
+size_t message_member_list_member_size(const cluster_member_t *member, uint16_t flags) {
+    if (flags & MESSAGE_FLAG_COMPACT_MEMBERS) return cluster_member_compact_size(member, message_member_options(flags));
+    return cluster_member_encoded_size(member);
+}
+
 int message_member_list_encode(const message_member_list_t *msg, uint8_t *buffer, size_t buffer_size) {
-    uint32_t expected_size = sizeof(message_header_t) + sizeof(uint16_t);
-    expected_size += msg->members_n * CLUSTER_MEMBER_SIZE;
+    size_t expected_size = sizeof(message_header_t) + sizeof(uint16_t);
+    for (int i = 0; i < msg->members_n; ++i) {
+        expected_size += message_member_list_member_size(&msg->members[i], msg->header.flags);
+    }
     if (buffer_size < expected_size)
         return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
 
@@ -267,8 +354,14 @@ int message_member_list_encode(const message_member_list_t *msg, uint8_t *buffer
     cursor += sizeof(uint16_t);
 
     const uint8_t *buffer_end = buffer + buffer_size;
+    cluster_bool_t compact = (msg->header.flags & MESSAGE_FLAG_COMPACT_MEMBERS) != 0;
+    int options = message_member_options(msg->header.flags);
     for (int i = 0; i < msg->members_n; ++i) {
-        cursor += cluster_member_encode(&msg->members[i], cursor, buffer_end - cursor);
+        if (compact) {
+            cursor += cluster_member_compact_encode(&msg->members[i], cursor, buffer_end - cursor, options);
+        } else {
+            cursor += cluster_member_encode(&msg->members[i], cursor, buffer_end - cursor);
+        }
     }
     return cursor - buffer;
 }
@@ -319,6 +412,20 @@ int message_status_decode(const uint8_t *buffer, size_t buffer_size, message_sta
         return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
     cursor += sizeof(message_header_t);
 
+    result->base = NULL;
+    if (result->header.flags & MESSAGE_FLAG_STATUS_DELTA) {
+        if (buffer_end - cursor < sizeof(uint32_t)) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+        result->base_sequence_num = uint32_decode(cursor);
+        cursor += sizeof(uint32_t);
+        result->delta = cursor;
+        result->delta_size = buffer_end - cursor;
+        vector_clock_init(&result->data_version);
+        return buffer_size;
+    }
+
+    result->base_sequence_num = 0;
+    result->delta = NULL;
+    result->delta_size = 0;
     int decode_result = vector_clock_decode(cursor, buffer_end - cursor, &result->data_version);
     if (decode_result < 0) return decode_result;
     cursor += decode_result;
@@ -326,10 +433,14 @@ int message_status_decode(const uint8_t *buffer, size_t buffer_size, message_sta
     return cursor - buffer;
 }
 
+int message_status_delta_decode(message_status_t *msg, const vector_clock_t *base) {
+    return vector_clock_delta_decode(msg->delta, msg->delta_size, base, &msg->data_version);
+}
+
 int message_status_encode(const message_status_t *msg, uint8_t *buffer, size_t buffer_size) {
-    uint32_t expected_size = sizeof(message_header_t) 
-                            + sizeof(uint16_t) 
-                            + msg->data_version.size * VECTOR_RECORD_SIZE;
+    cluster_bool_t delta = (msg->header.flags & MESSAGE_FLAG_STATUS_DELTA) != 0;
+    uint32_t expected_size = sizeof(message_header_t)
+                             + (delta ? sizeof(uint32_t) : vector_clock_encoded_size(&msg->data_version));
     if (buffer_size < expected_size) 
         return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
 
@@ -339,9 +450,358 @@ int message_status_encode(const message_status_t *msg, uint8_t *buffer, size_t b
     uint8_t *cursor = buffer + encode_result;
     uint8_t *buffer_end = buffer + buffer_size;
 
-    encode_result = vector_clock_encode(&msg->data_version, cursor, buffer_end - cursor);
+    if (delta) {
+        uint32_encode(msg->base_sequence_num, cursor);
+        cursor += sizeof(uint32_t);
+        encode_result = vector_clock_delta_encode(&msg->data_version, msg->base, cursor, buffer_end - cursor);
+    } else {
+        encode_result = vector_clock_encode(&msg->data_version, cursor, buffer_end - cursor);
+    }
+    if (encode_result < 0) return encode_result;
+    cursor += encode_result;
+
+    return cursor - buffer;
+}
+
+void message_status_destroy(const message_status_t *msg) {
+    free(msg->data_version.ids);
+}
+
+int message_ping_decode(const uint8_t *buffer, size_t buffer_size, message_ping_t *result) {
+    RETURN_IF_INVALID_PAYLOAD(MESSAGE_PING_TYPE, CLUSTER_ERR_INVALID_MESSAGE);
+    return message_header_decode(buffer, buffer_size, &result->header);
+}
+
+int message_ping_encode(const message_ping_t *msg, uint8_t *buffer, size_t buffer_size) {
+    return message_header_encode(&msg->header, buffer, buffer_size);
+}
+
+int message_ping_req_decode(const uint8_t *buffer, size_t buffer_size, message_ping_req_t *result) {
+    RETURN_IF_INVALID_PAYLOAD(MESSAGE_PING_REQ_TYPE, CLUSTER_ERR_INVALID_MESSAGE);
+
+    const uint8_t *cursor = buffer;
+    const uint8_t *buffer_end = buffer + buffer_size;
+
+    int decode_result = message_header_decode(cursor, buffer_size, &result->header);
+    if (decode_result < 0) return decode_result;
+    cursor += decode_result;
+
+    decode_result = cluster_member_addr_decode(cursor, buffer_end - cursor, &result->target);
+    if (decode_result < 0) return decode_result;
+    cursor += decode_result;
+
+    return cursor - buffer;
+}
+
+int message_ping_req_encode(const message_ping_req_t *msg, uint8_t *buffer, size_t buffer_size) {
+    const uint8_t *buffer_end = buffer + buffer_size;
+
+    int encode_result = message_header_encode(&msg->header, buffer, buffer_size);
+    if (encode_result < 0) return encode_result;
+    uint8_t *cursor = buffer + encode_result;
+
+    encode_result = cluster_member_addr_encode(&msg->target, cursor, buffer_end - cursor);
     if (encode_result < 0) return encode_result;
     cursor += encode_result;
 
     return cursor - buffer;
-}
\ No newline at end of file
+}
+
+int message_indirect_ack_decode(const uint8_t *buffer, size_t buffer_size, message_indirect_ack_t *result) {
+    RETURN_IF_INVALID_PAYLOAD(MESSAGE_INDIRECT_ACK_TYPE, CLUSTER_ERR_INVALID_MESSAGE);
+    if (buffer_size < sizeof(message_header_t) + sizeof(uint32_t))
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+
+    const uint8_t *cursor = buffer;
+    const uint8_t *buffer_end = buffer + buffer_size;
+
+    int decode_result = message_header_decode(cursor, buffer_size, &result->header);
+    if (decode_result < 0) return decode_result;
+    cursor += decode_result;
+
+    result->ack_sequence_num = uint32_decode(cursor);
+    cursor += sizeof(uint32_t);
+
+    decode_result = cluster_member_addr_decode(cursor, buffer_end - cursor, &result->target);
+    if (decode_result < 0) return decode_result;
+    cursor += decode_result;
+
+    return cursor - buffer;
+}
+
+int message_indirect_ack_encode(const message_indirect_ack_t *msg, uint8_t *buffer, size_t buffer_size) {
+    if (buffer_size < sizeof(message_header_t) + sizeof(uint32_t))
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    const uint8_t *buffer_end = buffer + buffer_size;
+
+    int encode_result = message_header_encode(&msg->header, buffer, buffer_size);
+    if (encode_result < 0) return encode_result;
+    uint8_t *cursor = buffer + encode_result;
+
+    uint32_encode(msg->ack_sequence_num, cursor);
+    cursor += sizeof(uint32_t);
+
+    encode_result = cluster_member_addr_encode(&msg->target, cursor, buffer_end - cursor);
+    if (encode_result < 0) return encode_result;
+    cursor += encode_result;
+
+    return cursor - buffer;
+}
+
+int message_digest_decode(const uint8_t *buffer, size_t buffer_size, message_digest_t *result) {
+    RETURN_IF_INVALID_PAYLOAD(MESSAGE_DIGEST_TYPE, CLUSTER_ERR_INVALID_MESSAGE);
+    if (buffer_size < sizeof(message_header_t) + sizeof(uint8_t))
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+
+    const uint8_t *cursor = buffer;
+    const uint8_t *buffer_end = buffer + buffer_size;
+
+    int decode_result = message_header_decode(cursor, buffer_size, &result->header);
+    if (decode_result < 0) return decode_result;
+    cursor += decode_result;
+
+    uint8_t buckets_n = *cursor++;
+    // Both sides must split members into the same buckets.
+    if (buckets_n != CLUSTER_MEMBER_DIGEST_BUCKETS) return CLUSTER_ERR_INVALID_MESSAGE;
+    if ((size_t) (buffer_end - cursor) < buckets_n * sizeof(uint64_t))
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    for (int i = 0; i < buckets_n; ++i) {
+        result->buckets[i] = uint64_decode(cursor);
+        cursor += sizeof(uint64_t);
+    }
+
+    return cursor - buffer;
+}
+
+int message_digest_encode(const message_digest_t *msg, uint8_t *buffer, size_t buffer_size) {
+    if (buffer_size < MESSAGE_DIGEST_SIZE)
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+
+    int encode_result = message_header_encode(&msg->header, buffer, buffer_size);
+    if (encode_result < 0) return encode_result;
+    uint8_t *cursor = buffer + encode_result;
+
+    *cursor++ = CLUSTER_MEMBER_DIGEST_BUCKETS;
+    for (int i = 0; i < CLUSTER_MEMBER_DIGEST_BUCKETS; ++i) {
+        uint64_encode(msg->buckets[i], cursor);
+        cursor += sizeof(uint64_t);
+    }
+
+    return cursor - buffer;
+}
+
+static int message_data_announcement_decode(const uint8_t *buffer, size_t buffer_size,
+                                            message_header_t *header, vector_record_t *data_version) {
+    const uint8_t *cursor = buffer;
+    const uint8_t *buffer_end = buffer + buffer_size;
+
+    int decode_result = message_header_decode(cursor, buffer_size, header);
+    if (decode_result < 0) return decode_result;
+    cursor += decode_result;
+
+    decode_result = vector_clock_record_decode(cursor, buffer_end - cursor, data_version);
+    if (decode_result < 0) return decode_result;
+    cursor += decode_result;
+
+    return cursor - buffer;
+}
+
+static int message_data_announcement_encode(const message_header_t *header, const vector_record_t *data_version,
+                                            uint8_t *buffer, size_t buffer_size) {
+    const uint8_t *buffer_end = buffer + buffer_size;
+
+    int encode_result = message_header_encode(header, buffer, buffer_size);
+    if (encode_result < 0) return encode_result;
+    uint8_t *cursor = buffer + encode_result;
+
+    encode_result = vector_clock_record_encode(data_version, cursor, buffer_end - cursor);
+    if (encode_result < 0) return encode_result;
+    cursor += encode_result;
+
+    return cursor - buffer;
+}
+
+int message_ihave_decode(const uint8_t *buffer, size_t buffer_size, message_ihave_t *result) {
+    RETURN_IF_INVALID_PAYLOAD(MESSAGE_IHAVE_TYPE, CLUSTER_ERR_INVALID_MESSAGE);
+    return message_data_announcement_decode(buffer, buffer_size, &result->header, &result->data_version);
+}
+
+int message_ihave_encode(const message_ihave_t *msg, uint8_t *buffer, size_t buffer_size) {
+    return message_data_announcement_encode(&msg->header, &msg->data_version, buffer, buffer_size);
+}
+
+int message_graft_decode(const uint8_t *buffer, size_t buffer_size, message_graft_t *result) {
+    RETURN_IF_INVALID_PAYLOAD(MESSAGE_GRAFT_TYPE, CLUSTER_ERR_INVALID_MESSAGE);
+    return message_data_announcement_decode(buffer, buffer_size, &result->header, &result->data_version);
+}
+
+int message_graft_encode(const message_graft_t *msg, uint8_t *buffer, size_t buffer_size) {
+    return message_data_announcement_encode(&msg->header, &msg->data_version, buffer, buffer_size);
+}
+
+int message_prune_decode(const uint8_t *buffer, size_t buffer_size, message_prune_t *result) {
+    RETURN_IF_INVALID_PAYLOAD(MESSAGE_PRUNE_TYPE, CLUSTER_ERR_INVALID_MESSAGE);
+    return message_data_announcement_decode(buffer, buffer_size, &result->header, &result->data_version);
+}
+
+int message_prune_encode(const message_prune_t *msg, uint8_t *buffer, size_t buffer_size) {
+    return message_data_announcement_encode(&msg->header, &msg->data_version, buffer, buffer_size);
+}
+
+int message_view_decode(const uint8_t *buffer, size_t buffer_size, message_view_t *result) {
+    int message_type = message_type_decode(buffer, buffer_size);
+    if (message_type != MESSAGE_FORWARD_JOIN_TYPE && message_type != MESSAGE_NEIGHBOR_TYPE &&
+        message_type != MESSAGE_SHUFFLE_TYPE) {
+        return CLUSTER_ERR_INVALID_MESSAGE;
+    }
+    RETURN_IF_INVALID_PAYLOAD(message_type, CLUSTER_ERR_INVALID_MESSAGE);
+    if (buffer_size < sizeof(message_header_t) + 2 * sizeof(uint8_t))
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+
+    const uint8_t *cursor = buffer;
+    const uint8_t *buffer_end = buffer + buffer_size;
+
+    int decode_result = message_header_decode(cursor, buffer_size, &result->header);
+    if (decode_result < 0) return decode_result;
+    cursor += decode_result;
+
+    result->ttl = *cursor++;
+    result->members_n = *cursor++;
+    // Every message carries at least the member it's about.
+    if (result->members_n == 0) return CLUSTER_ERR_INVALID_MESSAGE;
+
+    result->members = (cluster_member_t *) malloc(result->members_n * sizeof(cluster_member_t));
+    if (result->members == NULL)
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    for (int i = 0; i < result->members_n; ++i) {
+        decode_result = cluster_member_compact_decode(cursor, buffer_end - cursor, &result->members[i],
+                                                      MEMBER_ENCODE_LIVENESS);
+        if (decode_result < 0) {
+            free(result->members);
+            return decode_result;
+        }
+        cursor += decode_result;
+    }
+    return cursor - buffer;
+}
+
+int message_view_encode(const message_view_t *msg, uint8_t *buffer, size_t buffer_size) {
+    if (buffer_size < sizeof(message_header_t) + 2 * sizeof(uint8_t))
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    const uint8_t *buffer_end = buffer + buffer_size;
+
+    int encode_result = message_header_encode(&msg->header, buffer, buffer_size);
+    if (encode_result < 0) return encode_result;
+    uint8_t *cursor = buffer + encode_result;
+
+    *cursor++ = msg->ttl;
+    *cursor++ = msg->members_n;
+    for (int i = 0; i < msg->members_n; ++i) {
+        encode_result = cluster_member_compact_encode(&msg->members[i], cursor, buffer_end - cursor,
+                                                      MEMBER_ENCODE_LIVENESS);
+        if (encode_result < 0) return encode_result;
+        cursor += encode_result;
+    }
+    return cursor - buffer;
+}
+
+void message_view_destroy(const message_view_t *msg) {
+    free(msg->members);
+}
+
+int message_disconnect_decode(const uint8_t *buffer, size_t buffer_size, message_disconnect_t *result) {
+    RETURN_IF_INVALID_PAYLOAD(MESSAGE_DISCONNECT_TYPE, CLUSTER_ERR_INVALID_MESSAGE);
+    return message_header_decode(buffer, buffer_size, &result->header);
+}
+
+int message_disconnect_encode(const message_disconnect_t *msg, uint8_t *buffer, size_t buffer_size) {
+    return message_header_encode(&msg->header, buffer, buffer_size);
+}
+
+int message_data_fragment_decode(const uint8_t *buffer, size_t buffer_size, message_data_fragment_t *result) {
+    RETURN_IF_INVALID_PAYLOAD(MESSAGE_DATA_FRAGMENT_TYPE, CLUSTER_ERR_INVALID_MESSAGE);
+    if (buffer_size < MESSAGE_DATA_FRAGMENT_OVERHEAD) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+
+    int decode_result = message_data_announcement_decode(buffer, buffer_size,
+                                                         &result->header, &result->data_version);
+    if (decode_result < 0) return decode_result;
+    const uint8_t *cursor = buffer + decode_result;
+
+    result->total_size = uint32_decode(cursor);
+    cursor += sizeof(uint32_t);
+    result->fragment_size = uint16_decode(cursor);
+    cursor += sizeof(uint16_t);
+    result->fragment_index = uint16_decode(cursor);
+    cursor += sizeof(uint16_t);
+
+    size_t data_size = buffer_size - MESSAGE_DATA_FRAGMENT_OVERHEAD;
+    if (data_size == 0 || data_size > result->fragment_size) return CLUSTER_ERR_INVALID_MESSAGE;
+    result->data_size = data_size;
+    result->data = (uint8_t *) cursor;
+    return buffer_size;
+}
+
+int message_data_fragment_encode(const message_data_fragment_t *msg, uint8_t *buffer, size_t buffer_size) {
+    if (buffer_size < MESSAGE_DATA_FRAGMENT_OVERHEAD + msg->data_size)
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+
+    int encode_result = message_data_announcement_encode(&msg->header, &msg->data_version, buffer, buffer_size);
+    if (encode_result < 0) return encode_result;
+    uint8_t *cursor = buffer + encode_result;
+
+    uint32_encode(msg->total_size, cursor);
+    cursor += sizeof(uint32_t);
+    uint16_encode(msg->fragment_size, cursor);
+    cursor += sizeof(uint16_t);
+    uint16_encode(msg->fragment_index, cursor);
+    cursor += sizeof(uint16_t);
+
+    memcpy(cursor, msg->data, msg->data_size);
+    cursor += msg->data_size;
+    return cursor - buffer;
+}
+
+int message_fragment_request_decode(const uint8_t *buffer, size_t buffer_size, message_fragment_request_t *result) {
+    RETURN_IF_INVALID_PAYLOAD(MESSAGE_FRAGMENT_REQUEST_TYPE, CLUSTER_ERR_INVALID_MESSAGE);
+    int decode_result = message_data_announcement_decode(buffer, buffer_size,
+                                                         &result->header, &result->data_version);
+    if (decode_result < 0) return decode_result;
+    const uint8_t *cursor = buffer + decode_result;
+    const uint8_t *buffer_end = buffer + buffer_size;
+
+    if ((size_t) (buffer_end - cursor) < sizeof(uint16_t) + sizeof(uint8_t)) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    result->fragment_size = uint16_decode(cursor);
+    cursor += sizeof(uint16_t);
+    result->fragments_n = *cursor;
+    cursor += sizeof(uint8_t);
+
+    if (result->fragments_n > MESSAGE_FRAGMENT_REQUEST_MAX) return CLUSTER_ERR_INVALID_MESSAGE;
+    if ((size_t) (buffer_end - cursor) != result->fragments_n * sizeof(uint16_t)) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    for (uint8_t i = 0; i < result->fragments_n; ++i) {
+        result->fragments[i] = uint16_decode(cursor);
+        cursor += sizeof(uint16_t);
+    }
+    return cursor - buffer;
+}
+
+int message_fragment_request_encode(const message_fragment_request_t *msg, uint8_t *buffer, size_t buffer_size) {
+    size_t expected_size = sizeof(message_header_t) + VECTOR_RECORD_SIZE
+                           + sizeof(uint16_t) + sizeof(uint8_t)
+                           + msg->fragments_n * sizeof(uint16_t);
+    if (msg->fragments_n > MESSAGE_FRAGMENT_REQUEST_MAX || buffer_size < expected_size)
+        return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+
+    int encode_result = message_data_announcement_encode(&msg->header, &msg->data_version, buffer, buffer_size);
+    if (encode_result < 0) return encode_result;
+    uint8_t *cursor = buffer + encode_result;
+
+    uint16_encode(msg->fragment_size, cursor);
+    cursor += sizeof(uint16_t);
+    *cursor = msg->fragments_n;
+    cursor += sizeof(uint8_t);
+    for (uint8_t i = 0; i < msg->fragments_n; ++i) {
+        uint16_encode(msg->fragments[i], cursor);
+        cursor += sizeof(uint16_t);
+    }
+    return cursor - buffer;
+}
@@ -30,11 +30,65 @@ extern "C" {
 #define MESSAGE_ACK_TYPE            0x04
 #define MESSAGE_DATA_TYPE           0x05
 #define MESSAGE_STATUS_TYPE         0x06
+#define MESSAGE_PING_TYPE           0x07
+#define MESSAGE_PING_REQ_TYPE       0x08
+#define MESSAGE_INDIRECT_ACK_TYPE   0x09
+#define MESSAGE_DIGEST_TYPE         0x0A
+#define MESSAGE_IHAVE_TYPE          0x0B
+#define MESSAGE_GRAFT_TYPE          0x0C
+#define MESSAGE_PRUNE_TYPE          0x0D
+#define MESSAGE_FORWARD_JOIN_TYPE   0x0E
+#define MESSAGE_NEIGHBOR_TYPE       0x0F
+#define MESSAGE_SHUFFLE_TYPE        0x10
+#define MESSAGE_DISCONNECT_TYPE     0x11
+#define MESSAGE_DATA_FRAGMENT_TYPE  0x12
+#define MESSAGE_FRAGMENT_REQUEST_TYPE 0x13
+
+/* Members in the Member List message use the compact encoding. */
+#define MESSAGE_FLAG_COMPACT_MEMBERS 0x0001
+/* Compact members carry their liveness state and incarnation. */
+#define MESSAGE_FLAG_MEMBER_LIVENESS 0x0002
+/* The message is followed by the piggyback trailer:
+ *   members count (1 byte), members (the compact encoding with liveness),
+ *   trailer size excluding this field (2 bytes). */
+#define MESSAGE_FLAG_PIGGYBACK       0x0004
+/* The Digest message is a response to another digest and must not be
+ * answered with a digest again. */
+#define MESSAGE_FLAG_DIGEST_REPLY    0x0008
+/* The Data message is pushed along the broadcast tree. It's not
+ * acknowledged, and a duplicate prunes the link it came over. */
+#define MESSAGE_FLAG_EAGER_PUSH      0x0010
+/* The Neighbor request must be accepted, since the sender has no active peers. */
+#define MESSAGE_FLAG_HIGH_PRIORITY   0x0020
+/* The Neighbor message accepts the request of the recipient. */
+#define MESSAGE_FLAG_NEIGHBOR_ACCEPT 0x0040
+/* The Status message carries the sequence number (4 bytes) of an earlier
+ * Status message of the same sender followed by the clock encoded as
+ * a delta against the clock of that message. */
+#define MESSAGE_FLAG_STATUS_DELTA    0x0080
+/* The sender of the Status message no longer has the base of the deltas
+ * it receives from the recipient, so the recipient must send a full clock. */
+#define MESSAGE_FLAG_STATUS_RESYNC   0x0100
+/* The member in the Hello or Welcome message is followed by the largest
+ * datagram (2 bytes) its sender accepts. */
+#define MESSAGE_FLAG_MAX_SIZE        0x0200
+/* Compact members carry the largest datagram they accept. */
+#define MESSAGE_FLAG_MEMBER_MAX_SIZE 0x0400
+
+#define MESSAGE_FLAGS_OFFSET         (PROTOCOL_ID_LENGTH + sizeof(uint8_t))
+#define MESSAGE_PIGGYBACK_OVERHEAD   (sizeof(uint8_t) + sizeof(uint16_t))
+#define MESSAGE_DIGEST_SIZE          (sizeof(message_header_t) + sizeof(uint8_t) + \
+                                      CLUSTER_MEMBER_DIGEST_BUCKETS * sizeof(uint64_t))
+/* The maximum number of fragments in the Fragment Request message. */
+#define MESSAGE_FRAGMENT_REQUEST_MAX 32
+/* Everything in the Data Fragment message except the fragment itself. */
+#define MESSAGE_DATA_FRAGMENT_OVERHEAD (sizeof(message_header_t) + VECTOR_RECORD_SIZE + \
+                                        sizeof(uint32_t) + 2 * sizeof(uint16_t))
 
 struct message_header {
     char protocol_id[PROTOCOL_ID_LENGTH];
     uint8_t message_type;
-    uint16_t reserved;
+    uint16_t flags;
     uint32_t sequence_num;
 };
 
@@ -63,32 +117,159 @@ struct message_ack {
 struct message_data {
     message_header_t header;
     vector_record_t data_version;
+    /* Payloads which don't fit into a single message are only
+     * sent as fragments. */
+    uint32_t data_size;
+    uint8_t *data;
+};
+
+/* A fragment of a data payload which doesn't fit into a single message.
+ * The payload of total_size bytes is cut into fragment_size chunks, the
+ * last one being shorter, so that any member holding the whole payload
+ * can reproduce any of its fragments. The data size follows from the
+ * size of the message. */
+struct message_data_fragment {
+    message_header_t header;
+    vector_record_t data_version;
+    uint32_t total_size;
+    uint16_t fragment_size;
+    uint16_t fragment_index;
     uint16_t data_size;
     uint8_t *data;
 };
 
+/* Requests the listed fragments of a data payload from the recipient,
+ * which has announced the payload with one of its fragments. */
+struct message_fragment_request {
+    message_header_t header;
+    vector_record_t data_version;
+    uint16_t fragment_size;
+    uint8_t fragments_n;
+    uint16_t fragments[MESSAGE_FRAGMENT_REQUEST_MAX];
+};
+
 struct message_status {
     message_header_t header;
     vector_clock_t data_version;
+    /* With MESSAGE_FLAG_STATUS_DELTA only. */
+    uint32_t base_sequence_num;
+    /* The base clock of the delta to encode. */
+    const vector_clock_t *base;
+    /* The decoded delta is resolved by message_status_delta_decode()
+     * once the base is known. */
+    const uint8_t *delta;
+    size_t delta_size;
+};
+
+/* A direct probe. It's answered with the Ack message. */
+struct message_ping {
+    message_header_t header;
+};
+
+/* A request to probe the target on behalf of the sender. */
+struct message_ping_req {
+    message_header_t header;
+    cluster_member_addr_t target;
+};
+
+/* Relays the target's response back to the sender of the Ping-Req. */
+struct message_indirect_ack {
+    message_header_t header;
+    uint32_t ack_sequence_num;
+    cluster_member_addr_t target;
+};
+
+/* The membership digest. The recipient responds with its
+ * members from the buckets whose digests differ. */
+struct message_digest {
+    message_header_t header;
+    uint64_t buckets[CLUSTER_MEMBER_DIGEST_BUCKETS];
+};
+
+/* Announces a Data message to a lazy peer of the broadcast tree. */
+struct message_ihave {
+    message_header_t header;
+    vector_record_t data_version;
+};
+
+/* Requests a missing Data message and adds the link to the broadcast tree. */
+struct message_graft {
+    message_header_t header;
+    vector_record_t data_version;
+};
+
+/* Removes the link from the broadcast tree of the
+ * originator of the given Data message. */
+struct message_prune {
+    message_header_t header;
+    vector_record_t data_version;
+};
+
+/* Partial view maintenance. Members use the compact encoding with liveness.
+ *   Forward Join: the newcomer walking through active views.
+ *   Neighbor: the sender asking to join the recipient's active view.
+ *   Shuffle: the sender followed by a sample of its views. */
+struct message_view {
+    message_header_t header;
+    uint8_t ttl;
+    uint8_t members_n;
+    cluster_member_t *members;
+};
+
+/* Removes the sender from the recipient's active view. */
+struct message_disconnect {
+    message_header_t header;
 };
 
 void message_header_init(message_header_t *header, uint8_t message_type, uint32_t sequence_number);
 int message_type_decode(const uint8_t *buffer, size_t buffer_size);
+int message_flags_decode(const uint8_t *buffer, size_t buffer_size);
+int message_piggyback_decode(const uint8_t *buffer, size_t buffer_size,
+                             const uint8_t **members, size_t *members_size, uint8_t *members_n);
 int message_hello_decode(const uint8_t *buffer, size_t buffer_size, message_hello_t *result);
 int message_welcome_decode(const uint8_t *buffer, size_t buffer_size, message_welcome_t *result);
 int message_data_decode(const uint8_t *buffer, size_t buffer_size, message_data_t *result);
 int message_member_list_decode(const uint8_t *buffer, size_t buffer_size, message_member_list_t *result);
 int message_ack_decode(const uint8_t *buffer, size_t buffer_size, message_ack_t *result);
 int message_status_decode(const uint8_t *buffer, size_t buffer_size, message_status_t *result);
+/**
+ * Restores the clock of the delta Status message from the base clock.
+ */
+int message_status_delta_decode(message_status_t *msg, const vector_clock_t *base);
+int message_ping_decode(const uint8_t *buffer, size_t buffer_size, message_ping_t *result);
+int message_ping_req_decode(const uint8_t *buffer, size_t buffer_size, message_ping_req_t *result);
+int message_indirect_ack_decode(const uint8_t *buffer, size_t buffer_size, message_indirect_ack_t *result);
+int message_digest_decode(const uint8_t *buffer, size_t buffer_size, message_digest_t *result);
+int message_ihave_decode(const uint8_t *buffer, size_t buffer_size, message_ihave_t *result);
+int message_graft_decode(const uint8_t *buffer, size_t buffer_size, message_graft_t *result);
+int message_prune_decode(const uint8_t *buffer, size_t buffer_size, message_prune_t *result);
+int message_view_decode(const uint8_t *buffer, size_t buffer_size, message_view_t *result);
+int message_disconnect_decode(const uint8_t *buffer, size_t buffer_size, message_disconnect_t *result);
+int message_data_fragment_decode(const uint8_t *buffer, size_t buffer_size, message_data_fragment_t *result);
+int message_fragment_request_decode(const uint8_t *buffer, size_t buffer_size, message_fragment_request_t *result);
+void message_view_destroy(const message_view_t *msg);
 void message_hello_destroy(const message_hello_t *msg);
 void message_welcome_destroy(const message_welcome_t *msg);
 void message_member_list_destroy(const message_member_list_t *msg);
+void message_status_destroy(const message_status_t *msg);
 int message_hello_encode(const message_hello_t *msg, uint8_t *buffer, size_t buffer_size);
 int message_welcome_encode(const message_welcome_t *msg, uint8_t *buffer, size_t buffer_size);
 int message_data_encode(const message_data_t *msg, uint8_t *buffer, size_t buffer_size);
+size_t message_member_list_member_size(const cluster_member_t *member, uint16_t flags);
 int message_member_list_encode(const message_member_list_t *msg, uint8_t *buffer, size_t buffer_size);
 int message_ack_encode(const message_ack_t *msg, uint8_t *buffer, size_t buffer_size);
 int message_status_encode(const message_status_t *msg, uint8_t *buffer, size_t buffer_size);
+int message_ping_encode(const message_ping_t *msg, uint8_t *buffer, size_t buffer_size);
+int message_ping_req_encode(const message_ping_req_t *msg, uint8_t *buffer, size_t buffer_size);
+int message_indirect_ack_encode(const message_indirect_ack_t *msg, uint8_t *buffer, size_t buffer_size);
+int message_digest_encode(const message_digest_t *msg, uint8_t *buffer, size_t buffer_size);
+int message_ihave_encode(const message_ihave_t *msg, uint8_t *buffer, size_t buffer_size);
+int message_graft_encode(const message_graft_t *msg, uint8_t *buffer, size_t buffer_size);
+int message_prune_encode(const message_prune_t *msg, uint8_t *buffer, size_t buffer_size);
+int message_view_encode(const message_view_t *msg, uint8_t *buffer, size_t buffer_size);
+int message_disconnect_encode(const message_disconnect_t *msg, uint8_t *buffer, size_t buffer_size);
+int message_data_fragment_encode(const message_data_fragment_t *msg, uint8_t *buffer, size_t buffer_size);
+int message_fragment_request_encode(const message_fragment_request_t *msg, uint8_t *buffer, size_t buffer_size);
 
 #ifdef  __cplusplus
 }
@@ -14,6 +14,9 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
 #include "kx_config.h"
 
 cluster_socket_fd cluster_socket_datagram(const cluster_sockaddr_storage *addr, 
@@ -59,6 +62,20 @@ ssize_t cluster_recv_from(cluster_socket_fd fd,
     return recvfrom(fd, buffer, buffer_size, MSG_WAITALL, (struct sockaddr *)addr, addr_len);
 }
 
+int cluster_recv_many(cluster_socket_fd fd, 
+                      cluster_mmsghdr *msgs, 
+                      unsigned int msgs_len)
+{
+    int result;
+    do {
+        result = recvmmsg(fd, msgs, msgs_len, MSG_DONTWAIT, NULL);
+    } while (result < 0 && errno == EINTR);
+
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    return result;
+}
+
 ssize_t cluster_send_to(cluster_socket_fd fd, 
                         const uint8_t *buffer, 
                         size_t buffer_size, 
@@ -68,6 +85,20 @@ ssize_t cluster_send_to(cluster_socket_fd fd,
     return sendto(fd, buffer, buffer_size, 0, (const struct sockaddr *)addr, addr_len);
 }
 
+int cluster_send_many(cluster_socket_fd fd, 
+                      cluster_mmsghdr *msgs, 
+                      unsigned int msgs_len)
+{
+    int result;
+    do {
+        result = sendmmsg(fd, msgs, msgs_len, MSG_DONTWAIT);
+    } while (result < 0 && errno == EINTR);
+
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    return result;
+}
+
 void cluster_close(cluster_socket_fd fd) {
     close(fd);
 }
@@ -77,4 +108,47 @@ int cluster_get_sock_name(cluster_socket_fd fd,
                           cluster_socklen_t *addr_len)
 {
     return getsockname(fd, (struct sockaddr *)addr, addr_len);
-}
\ No newline at end of file
+}
+
+/* The IP and UDP headers which precede the payload in every datagram. */
+#define IPV4_HEADER_SIZE 20
+#define IPV6_HEADER_SIZE 40
+#define UDP_HEADER_SIZE 8
+#define UDP_MAX_PAYLOAD_SIZE 65507
+
+static cluster_bool_t cluster_interface_owns(const struct sockaddr *interface_addr,
+                                             const cluster_sockaddr_storage *addr) {
+    if (addr->ss_family == AF_INET) {
+        const struct in_addr *host = &((const cluster_sockaddr_in *) addr)->sin_addr;
+        // A wildcard address is bound to all interfaces.
+        return host->s_addr == htonl(INADDR_ANY) ||
+               host->s_addr == ((const cluster_sockaddr_in *) interface_addr)->sin_addr.s_addr;
+    }
+    const struct in6_addr *host = &((const cluster_sockaddr_in6 *) addr)->sin6_addr;
+    return IN6_IS_ADDR_UNSPECIFIED(host) ||
+           IN6_ARE_ADDR_EQUAL(host, &((const cluster_sockaddr_in6 *) interface_addr)->sin6_addr);
+}
+
+int cluster_max_datagram_size(const cluster_sockaddr_storage *addr) {
+    if (addr->ss_family != AF_INET && addr->ss_family != AF_INET6) return -1;
+    struct ifaddrs *interfaces = NULL;
+    if (getifaddrs(&interfaces) < 0) return -1;
+    int fd = socket(addr->ss_family, SOCK_DGRAM, 0);
+    int mtu = -1;
+    for (const struct ifaddrs *it = interfaces; fd >= 0 && it != NULL; it = it->ifa_next) {
+        if (it->ifa_addr == NULL || it->ifa_addr->sa_family != addr->ss_family) continue;
+        if (!cluster_interface_owns(it->ifa_addr, addr)) continue;
+        struct ifreq request;
+        memset(&request, 0, sizeof(request));
+        strncpy(request.ifr_name, it->ifa_name, sizeof(request.ifr_name) - 1);
+        if (ioctl(fd, SIOCGIFMTU, &request) < 0) continue;
+        // Datagrams sent from a wildcard address may leave through any interface.
+        if (mtu < 0 || request.ifr_mtu < mtu) mtu = request.ifr_mtu;
+    }
+    if (fd >= 0) close(fd);
+    freeifaddrs(interfaces);
+
+    int overhead = (addr->ss_family == AF_INET6 ? IPV6_HEADER_SIZE : IPV4_HEADER_SIZE) + UDP_HEADER_SIZE;
+    if (mtu <= overhead) return -1;
+    return mtu - overhead < UDP_MAX_PAYLOAD_SIZE ? mtu - overhead : UDP_MAX_PAYLOAD_SIZE;
+}
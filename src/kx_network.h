@@ -29,12 +29,48 @@ int cluster_bind(cluster_socket_fd fd, const cluster_sockaddr_storage *addr,
     cluster_socklen_t addr_len);
 ssize_t cluster_recv_from(cluster_socket_fd fd, uint8_t *buffer, 
     size_t buffer_size, cluster_sockaddr_storage *addr, cluster_socklen_t *addr_len);
+
+/**
+ * Reads up to msgs_len datagrams from the socket with a single
+ * system call. The buffers and address storage of each entry must be
+ * set up by the caller. The socket is never blocked on.
+ *
+ * @param fd a socket descriptor.
+ * @param msgs a vector of message headers to fill in.
+ * @param msgs_len a size of the vector.
+ * @return a number of received datagrams, zero if there is nothing to read
+ *         or negative value if the operation failed.
+ */
+int cluster_recv_many(cluster_socket_fd fd, cluster_mmsghdr *msgs, unsigned int msgs_len);
 ssize_t cluster_send_to(cluster_socket_fd fd, const uint8_t *buffer, 
     size_t buffer_size, const cluster_sockaddr_storage *addr, cluster_socklen_t addr_len);
+
+/**
+ * Writes up to msgs_len datagrams to the socket with a single
+ * system call. The socket is never blocked on.
+ *
+ * @param fd a socket descriptor.
+ * @param msgs a vector of message headers to send.
+ * @param msgs_len a size of the vector.
+ * @return a number of sent datagrams which can be less than msgs_len if
+ *         the socket buffer is full, or negative value if the operation failed.
+ */
+int cluster_send_many(cluster_socket_fd fd, cluster_mmsghdr *msgs, unsigned int msgs_len);
 void cluster_close(cluster_socket_fd fd);
 int cluster_get_sock_name(cluster_socket_fd fd, cluster_sockaddr_storage *addr, 
     cluster_socklen_t *addr_len);
 
+/**
+ * Returns the largest UDP payload which is sent from the given address
+ * without IP fragmentation, based on the MTU of the network interface the
+ * address belongs to. For a wildcard address the smallest MTU among all
+ * interfaces is taken.
+ *
+ * @param addr a local address.
+ * @return the payload size or negative value if the MTU can't be determined.
+ */
+int cluster_max_datagram_size(const cluster_sockaddr_storage *addr);
+
 #ifdef  __cplusplus
 }
 #endif
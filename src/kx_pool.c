@@ -0,0 +1,86 @@
+/*
+ * Copyright 2023-2023 yanruibinghxu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "kx_config.h"
+
+#define POOL_ALIGNMENT 16
+#define POOL_ALIGN(size) (((size) + POOL_ALIGNMENT - 1) & ~((size_t) POOL_ALIGNMENT - 1))
+
+static int cluster_pool_grow(cluster_pool_t *pool) {
+    if (pool->max_chunks != 0 && pool->chunks_num >= pool->max_chunks)
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+
+    size_t header_size = POOL_ALIGN(sizeof(cluster_pool_chunk_t));
+    cluster_pool_chunk_t *chunk =
+            (cluster_pool_chunk_t *) malloc(header_size + pool->object_size * pool->chunk_capacity);
+    if (chunk == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    ++pool->chunks_num;
+    ++pool->grow_count;
+
+    // Thread all objects of the new chunk onto the free list.
+    uint8_t *objects = (uint8_t *) chunk + header_size;
+    for (int i = pool->chunk_capacity - 1; i >= 0; --i) {
+        void **object = (void **) (objects + i * pool->object_size);
+        *object = pool->free_list;
+        pool->free_list = object;
+    }
+    return CLUSTER_ERR_NONE;
+}
+
+int cluster_pool_init(cluster_pool_t *pool, size_t object_size,
+                      uint32_t chunk_capacity, uint32_t max_chunks) {
+    if (object_size < sizeof(void *)) object_size = sizeof(void *);
+    pool->object_size = POOL_ALIGN(object_size);
+    pool->chunk_capacity = chunk_capacity > 0 ? chunk_capacity : 1;
+    pool->max_chunks = max_chunks;
+    pool->chunks_num = 0;
+    pool->chunks = NULL;
+    pool->free_list = NULL;
+    pool->alloc_count = 0;
+    pool->free_count = 0;
+    pool->grow_count = 0;
+    return cluster_pool_grow(pool);
+}
+
+void *cluster_pool_alloc(cluster_pool_t *pool) {
+    if (pool->free_list == NULL && cluster_pool_grow(pool) < 0) return NULL;
+
+    void **object = (void **) pool->free_list;
+    pool->free_list = *object;
+    ++pool->alloc_count;
+    return object;
+}
+
+void cluster_pool_free(cluster_pool_t *pool, void *object) {
+    if (object == NULL) return;
+    *(void **) object = pool->free_list;
+    pool->free_list = object;
+    ++pool->free_count;
+}
+
+void cluster_pool_destroy(cluster_pool_t *pool) {
+    cluster_pool_chunk_t *chunk = pool->chunks;
+    while (chunk != NULL) {
+        cluster_pool_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    pool->chunks = NULL;
+    pool->chunks_num = 0;
+    pool->free_list = NULL;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2023-2023 yanruibinghxu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __CLUSTER_POOL_H__
+#define __CLUSTER_POOL_H__
+
+#include "kx_config.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+typedef struct cluster_pool_chunk {
+    struct cluster_pool_chunk *next;
+} cluster_pool_chunk_t;
+
+struct cluster_pool {
+    size_t object_size;             /**< size of a single object including alignment. */
+    uint32_t chunk_capacity;        /**< number of objects in a single chunk. */
+    uint32_t max_chunks;            /**< maximum number of chunks, 0 - unlimited. */
+    uint32_t chunks_num;            /**< number of allocated chunks. */
+    cluster_pool_chunk_t *chunks;   /**< list of allocated chunks. */
+    void *free_list;                /**< list of available objects. */
+    uint64_t alloc_count;           /**< number of objects taken from the pool. */
+    uint64_t free_count;            /**< number of objects returned to the pool. */
+    uint64_t grow_count;            /**< number of chunks requested from the system allocator. */
+};
+
+/**
+ * Initializes a pool of fixed-size objects. The first chunk
+ * is allocated immediately.
+ *
+ * @param pool a pool instance.
+ * @param object_size a size of a single object.
+ * @param chunk_capacity a number of objects allocated at once.
+ * @param max_chunks the maximum number of chunks the pool can grow to.
+ *                   Zero means no limit.
+ * @return zero on success or negative value if the operation failed.
+ */
+int cluster_pool_init(cluster_pool_t *pool, size_t object_size,
+                      uint32_t chunk_capacity, uint32_t max_chunks);
+
+/**
+ * Takes an object from the pool. The system allocator is used only when
+ * there are no free objects left and the pool is allowed to grow.
+ *
+ * @param pool a pool instance.
+ * @return an uninitialized object or NULL if the pool is exhausted.
+ */
+void *cluster_pool_alloc(cluster_pool_t *pool);
+void cluster_pool_free(cluster_pool_t *pool, void *object);
+void cluster_pool_destroy(cluster_pool_t *pool);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
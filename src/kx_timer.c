@@ -0,0 +1,130 @@
+/*
+ * Copyright 2023-2023 yanruibinghxu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "kx_config.h"
+
+static const uint32_t TIMERS_INITIAL_CAPACITY = 64;
+static const uint8_t TIMERS_EXTENSION_FACTOR = 2;
+
+void cluster_timer_init(cluster_timer_t *timer, void *data) {
+    timer->deadline = 0;
+    timer->order = 0;
+    timer->heap_idx = TIMER_NOT_SCHEDULED;
+    timer->data = data;
+}
+
+int cluster_timer_is_scheduled(const cluster_timer_t *timer) {
+    return timer->heap_idx != TIMER_NOT_SCHEDULED;
+}
+
+int cluster_timer_heap_init(cluster_timer_heap_t *heap) {
+    heap->heap = (cluster_timer_t **) malloc(TIMERS_INITIAL_CAPACITY * sizeof(cluster_timer_t *));
+    if (heap->heap == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+    heap->size = 0;
+    heap->capacity = TIMERS_INITIAL_CAPACITY;
+    heap->next_order = 0;
+    return CLUSTER_ERR_NONE;
+}
+
+void cluster_timer_heap_destroy(cluster_timer_heap_t *heap) {
+    for (int i = 0; i < heap->size; ++i) {
+        heap->heap[i]->heap_idx = TIMER_NOT_SCHEDULED;
+    }
+    free(heap->heap);
+    heap->heap = NULL;
+    heap->size = 0;
+    heap->capacity = 0;
+}
+
+static int cluster_timer_less(const cluster_timer_t *first, const cluster_timer_t *second) {
+    if (first->deadline != second->deadline) return first->deadline < second->deadline;
+    return first->order < second->order;
+}
+
+static void cluster_timer_heap_set(cluster_timer_heap_t *heap, uint32_t idx, cluster_timer_t *timer) {
+    heap->heap[idx] = timer;
+    timer->heap_idx = idx;
+}
+
+static void cluster_timer_heap_sift_up(cluster_timer_heap_t *heap, uint32_t idx) {
+    cluster_timer_t *timer = heap->heap[idx];
+    while (idx > 0) {
+        uint32_t parent = (idx - 1) / 2;
+        if (!cluster_timer_less(timer, heap->heap[parent])) break;
+        cluster_timer_heap_set(heap, idx, heap->heap[parent]);
+        idx = parent;
+    }
+    cluster_timer_heap_set(heap, idx, timer);
+}
+
+static void cluster_timer_heap_sift_down(cluster_timer_heap_t *heap, uint32_t idx) {
+    cluster_timer_t *timer = heap->heap[idx];
+    while (1) {
+        uint32_t child = 2 * idx + 1;
+        if (child >= heap->size) break;
+        if (child + 1 < heap->size && cluster_timer_less(heap->heap[child + 1], heap->heap[child])) ++child;
+        if (!cluster_timer_less(heap->heap[child], timer)) break;
+        cluster_timer_heap_set(heap, idx, heap->heap[child]);
+        idx = child;
+    }
+    cluster_timer_heap_set(heap, idx, timer);
+}
+
+int cluster_timer_heap_schedule(cluster_timer_heap_t *heap, cluster_timer_t *timer, uint64_t deadline) {
+    if (cluster_timer_is_scheduled(timer)) cluster_timer_heap_cancel(heap, timer);
+
+    if (heap->size >= heap->capacity) {
+        uint32_t new_capacity = heap->capacity * TIMERS_EXTENSION_FACTOR;
+        cluster_timer_t **new_heap = (cluster_timer_t **) realloc(heap->heap, new_capacity * sizeof(cluster_timer_t *));
+        if (new_heap == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+        heap->heap = new_heap;
+        heap->capacity = new_capacity;
+    }
+
+    timer->deadline = deadline;
+    timer->order = heap->next_order++;
+    cluster_timer_heap_set(heap, heap->size, timer);
+    ++heap->size;
+    cluster_timer_heap_sift_up(heap, timer->heap_idx);
+    return CLUSTER_ERR_NONE;
+}
+
+void cluster_timer_heap_cancel(cluster_timer_heap_t *heap, cluster_timer_t *timer) {
+    if (!cluster_timer_is_scheduled(timer)) return;
+    uint32_t idx = timer->heap_idx;
+    timer->heap_idx = TIMER_NOT_SCHEDULED;
+
+    --heap->size;
+    if (idx == heap->size) return;
+
+    // Move the last timer into the freed position and restore the heap order.
+    cluster_timer_heap_set(heap, idx, heap->heap[heap->size]);
+    if (idx > 0 && cluster_timer_less(heap->heap[idx], heap->heap[(idx - 1) / 2])) {
+        cluster_timer_heap_sift_up(heap, idx);
+    } else {
+        cluster_timer_heap_sift_down(heap, idx);
+    }
+}
+
+cluster_timer_t *cluster_timer_heap_peek(const cluster_timer_heap_t *heap) {
+    return heap->size > 0 ? heap->heap[0] : NULL;
+}
+
+cluster_timer_t *cluster_timer_heap_pop_expired(cluster_timer_heap_t *heap, uint64_t current_ts) {
+    cluster_timer_t *timer = cluster_timer_heap_peek(heap);
+    if (timer == NULL || timer->deadline > current_ts) return NULL;
+    cluster_timer_heap_cancel(heap, timer);
+    return timer;
+}
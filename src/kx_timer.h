@@ -0,0 +1,80 @@
+/*
+ * Copyright 2023-2023 yanruibinghxu
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef __CLUSTER_TIMER_H__
+#define __CLUSTER_TIMER_H__
+
+#include "kx_config.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#define TIMER_NOT_SCHEDULED UINT32_MAX
+
+struct cluster_timer {
+    uint64_t deadline;      /**< the time in milliseconds when the timer is due. */
+    uint64_t order;         /**< breaks ties between timers with the same deadline. */
+    uint32_t heap_idx;      /**< position in the heap or TIMER_NOT_SCHEDULED. */
+    void *data;             /**< an arbitrary payload of the timer owner. */
+};
+
+struct cluster_timer_heap {
+    cluster_timer_t **heap;
+    uint32_t size;
+    uint32_t capacity;
+    uint64_t next_order;
+};
+
+void cluster_timer_init(cluster_timer_t *timer, void *data);
+int cluster_timer_is_scheduled(const cluster_timer_t *timer);
+int cluster_timer_heap_init(cluster_timer_heap_t *heap);
+void cluster_timer_heap_destroy(cluster_timer_heap_t *heap);
+
+/**
+ * Schedules the timer or moves the already scheduled timer to a new
+ * deadline. Timers with the same deadline expire in the order they
+ * were scheduled.
+ *
+ * @param heap a timer heap instance.
+ * @param timer a timer to schedule.
+ * @param deadline the time in milliseconds when the timer is due.
+ * @return zero on success or negative value if the operation failed.
+ */
+int cluster_timer_heap_schedule(cluster_timer_heap_t *heap, cluster_timer_t *timer, uint64_t deadline);
+void cluster_timer_heap_cancel(cluster_timer_heap_t *heap, cluster_timer_t *timer);
+
+/**
+ * Retrieves the timer with the earliest deadline.
+ *
+ * @param heap a timer heap instance.
+ * @return the earliest timer or NULL if no timers are scheduled.
+ */
+cluster_timer_t *cluster_timer_heap_peek(const cluster_timer_heap_t *heap);
+
+/**
+ * Removes and returns the earliest timer if it's due at the given time.
+ *
+ * @param heap a timer heap instance.
+ * @param current_ts the current time in milliseconds.
+ * @return the expired timer or NULL if no timers are due.
+ */
+cluster_timer_t *cluster_timer_heap_pop_expired(cluster_timer_heap_t *heap, uint64_t current_ts);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -7,7 +7,9 @@
 #  include <windows.h>
 #  pragma comment(lib, "advapi32.lib")
 #elif __linux__
-#  define _GNU_SOURCE
+#  ifndef _GNU_SOURCE
+#    define _GNU_SOURCE
+#  endif
 #  include <unistd.h>
 #  include <sys/time.h>
 #  include <sys/syscall.h>
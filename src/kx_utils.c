@@ -26,6 +26,29 @@ uint32_t cluster_random() {
     return random();
 }
 
+void cluster_rng_seed(cluster_rng_t *rng, uint64_t seed) {
+    // A splitmix64 step spreads similar seeds apart and never yields
+    // the zero state which xorshift can't leave.
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    rng->state = z != 0 ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+uint32_t cluster_rng_next(cluster_rng_t *rng) {
+    uint64_t x = rng->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng->state = x;
+    return (uint32_t) ((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+uint32_t cluster_rng_uniform(cluster_rng_t *rng, uint32_t bound) {
+    return (uint32_t) (((uint64_t) cluster_rng_next(rng) * bound) >> 32);
+}
+
 uint16_t uint16_decode(const uint8_t *buffer) {
     return CLUSTER_NTOHS(*(uint16_t *)buffer);
 }
@@ -42,4 +65,60 @@ uint32_t uint32_decode(const uint8_t *buffer) {
 void uint32_encode(uint32_t n, uint8_t *buffer) {
     uint32_t network_n = CLUSTER_HTONL(n);
     memcpy(buffer, &network_n, sizeof(uint32_t));
+}
+
+uint64_t uint64_decode(const uint8_t *buffer) {
+    return ((uint64_t) uint32_decode(buffer) << 32) | uint32_decode(buffer + sizeof(uint32_t));
+}
+
+void uint64_encode(uint64_t n, uint8_t *buffer) {
+    uint32_encode((uint32_t) (n >> 32), buffer);
+    uint32_encode((uint32_t) n, buffer + sizeof(uint32_t));
+}
+int varint_encode(uint32_t n, uint8_t *buffer, size_t buffer_size) {
+    size_t idx = 0;
+    do {
+        if (idx >= buffer_size) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+        uint8_t byte = n & 0x7F;
+        n >>= 7;
+        buffer[idx++] = n != 0 ? (byte | 0x80) : byte;
+    } while (n != 0);
+    return idx;
+}
+
+int varint_decode(const uint8_t *buffer, size_t buffer_size, uint32_t *result) {
+    uint32_t value = 0;
+    for (size_t idx = 0; idx < buffer_size && idx < 5; ++idx) {
+        value |= (uint32_t) (buffer[idx] & 0x7F) << (7 * idx);
+        if ((buffer[idx] & 0x80) == 0) {
+            *result = value;
+            return idx + 1;
+        }
+    }
+    return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+}
+
+size_t varint_size(uint32_t n) {
+    size_t size = 1;
+    while (n >= 0x80) {
+        n >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+/* A nibble-wide table of the reflected polynomial 0xEDB88320. */
+static const uint32_t CRC32_TABLE[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t cluster_crc32(uint32_t crc, const uint8_t *buffer, size_t buffer_size) {
+    crc = ~crc;
+    for (size_t i = 0; i < buffer_size; ++i) {
+        crc ^= buffer[i];
+        crc = (crc >> 4) ^ CRC32_TABLE[crc & 0x0F];
+        crc = (crc >> 4) ^ CRC32_TABLE[crc & 0x0F];
+    }
+    return ~crc;
 }
\ No newline at end of file
@@ -34,10 +34,47 @@ enum cluster_bool {
  */
 uint64_t cluster_time();
 uint32_t cluster_random();
+
+/* The state of a fast xorshift64* pseudo-random number generator.
+ * Each gossip instance owns its generator, so sampling doesn't
+ * contend on the libc random() state. */
+struct cluster_rng {
+    uint64_t state;
+};
+
+/**
+ * Seeds the generator. Any seed including 0 is valid.
+ */
+void cluster_rng_seed(cluster_rng_t *rng, uint64_t seed);
+uint32_t cluster_rng_next(cluster_rng_t *rng);
+/**
+ * Returns a pseudo-random number in the range [0, bound) using
+ * a multiplication instead of the modulo operation.
+ */
+uint32_t cluster_rng_uniform(cluster_rng_t *rng, uint32_t bound);
 uint16_t uint16_decode(const uint8_t *buffer);
 void uint16_encode(uint16_t n, uint8_t *buffer);
 uint32_t uint32_decode(const uint8_t *buffer);
 void uint32_encode(uint32_t n, uint8_t *buffer);
+uint64_t uint64_decode(const uint8_t *buffer);
+void uint64_encode(uint64_t n, uint8_t *buffer);
+
+/**
+ * Encodes an unsigned integer as a variable length (LEB128) sequence
+ * of 1 to 5 bytes.
+ *
+ * @return the number of bytes written or CLUSTER_ERR_BUFFER_NOT_ENOUGH.
+ */
+int varint_encode(uint32_t n, uint8_t *buffer, size_t buffer_size);
+int varint_decode(const uint8_t *buffer, size_t buffer_size, uint32_t *result);
+size_t varint_size(uint32_t n);
+
+/**
+ * Updates the CRC-32 (IEEE 802.3) checksum with the given bytes.
+ * The checksum of a sequence of buffers is computed by passing
+ * the previous result. Start with zero.
+ */
+uint32_t cluster_crc32(uint32_t crc, const uint8_t *buffer, size_t buffer_size);
 
 #ifdef  __cplusplus
 }
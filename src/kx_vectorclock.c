@@ -14,39 +14,185 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <endian.h>
 #include "kx_config.h"
 
+#if VECTOR_CLOCK_SIMD && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VECTOR_CLOCK_X86
+#include <immintrin.h>
+#endif
+
+/* The outcome of comparing sequence numbers of the same members. */
+#define VC_SEQS_AFTER   0x01    /* some numbers of the first clock are greater */
+#define VC_SEQS_BEFORE  0x02    /* some numbers of the second clock are greater */
+
 static void vector_clock_create_member_id(const cluster_member_t *member, member_id_t *result) {
     // copy 4 bytes of address and 2 bytes of port
-    cluster_sockaddr_storage *addr = member->address;
     uint8_t *result_buf = (uint8_t *) result;
-    if (addr->ss_family == AF_INET) {
-        cluster_sockaddr_in *addr_in = (cluster_sockaddr_in *) addr;
-        memcpy(result_buf, &addr_in->sin_addr, 4);
-        memcpy(result_buf + 4, &addr_in->sin_port, 2);
-    } else {
-        cluster_sockaddr_in6 *addr_in6 = (cluster_sockaddr_in6 *) addr;
-        memcpy(result_buf, &addr_in6->sin6_addr, 4);
-        memcpy(result_buf + 4, &addr_in6->sin6_port, 2);
-    }
+    memcpy(result_buf, member->address.addr, 4);
+    memcpy(result_buf + 4, &member->address.port, 2);
     // fill the remaining 2 bytes with member's uid.
     uint32_t uid_network = CLUSTER_HTONL(member->uid);
     memcpy(result_buf + 6, &uid_network, 2);
 }
 
-static int vector_clock_find_by_member_id(const vector_clock_t *clock, const member_id_t *member_id) {
-    for (int i = 0; i < clock->size; ++i) {
-        if (clock->records[i].member_id == *member_id) return i;
+/* Member IDs are raw bytes. Records are ordered by these bytes as they are sent
+ * over the wire, so that all hosts agree on the order regardless of their byte
+ * order. Deltas refer to records by their position in this order. */
+static inline uint64_t vector_clock_id_key(member_id_t member_id) {
+    return be64toh(member_id);
+}
+
+/* Compares sequence numbers pairwise and optionally stores the
+ * maximum of each pair into the first array. */
+typedef int (*vector_clock_seqs_kernel_t)(uint32_t *first, const uint32_t *second,
+                                          uint32_t n, cluster_bool_t merge);
+
+static int vector_clock_seqs_scalar(uint32_t *first, const uint32_t *second,
+                                    uint32_t n, cluster_bool_t merge) {
+    int result = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        if (first[i] > second[i]) {
+            result |= VC_SEQS_AFTER;
+        } else if (first[i] < second[i]) {
+            result |= VC_SEQS_BEFORE;
+            if (merge) first[i] = second[i];
+        }
+    }
+    return result;
+}
+
+#ifdef VECTOR_CLOCK_X86
+__attribute__((target("sse2")))
+static int vector_clock_seqs_sse2(uint32_t *first, const uint32_t *second,
+                                  uint32_t n, cluster_bool_t merge) {
+    // SSE2 only compares signed numbers, so the sign bit is flipped first.
+    const __m128i bias = _mm_set1_epi32((int) 0x80000000);
+    __m128i after = _mm_setzero_si128();
+    __m128i before = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (first + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (second + i));
+        __m128i a_biased = _mm_xor_si128(a, bias);
+        __m128i b_biased = _mm_xor_si128(b, bias);
+        __m128i greater = _mm_cmpgt_epi32(a_biased, b_biased);
+        __m128i less = _mm_cmpgt_epi32(b_biased, a_biased);
+        after = _mm_or_si128(after, greater);
+        before = _mm_or_si128(before, less);
+        if (merge) {
+            __m128i max = _mm_or_si128(_mm_andnot_si128(less, a), _mm_and_si128(less, b));
+            _mm_storeu_si128((__m128i *) (first + i), max);
+        }
+    }
+    int result = 0;
+    if (_mm_movemask_epi8(after)) result |= VC_SEQS_AFTER;
+    if (_mm_movemask_epi8(before)) result |= VC_SEQS_BEFORE;
+    return result | vector_clock_seqs_scalar(first + i, second + i, n - i, merge);
+}
+
+__attribute__((target("avx2")))
+static int vector_clock_seqs_avx2(uint32_t *first, const uint32_t *second,
+                                  uint32_t n, cluster_bool_t merge) {
+    __m256i after = _mm256_setzero_si256();
+    __m256i before = _mm256_setzero_si256();
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (first + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (second + i));
+        // a >= b exactly when max(a, b) == a.
+        __m256i max = _mm256_max_epu32(a, b);
+        __m256i a_not_less = _mm256_cmpeq_epi32(max, a);
+        __m256i b_not_less = _mm256_cmpeq_epi32(max, b);
+        after = _mm256_or_si256(after, _mm256_andnot_si256(b_not_less, a_not_less));
+        before = _mm256_or_si256(before, _mm256_andnot_si256(a_not_less, b_not_less));
+        if (merge) _mm256_storeu_si256((__m256i *) (first + i), max);
+    }
+    int result = 0;
+    if (_mm256_movemask_epi8(after)) result |= VC_SEQS_AFTER;
+    if (_mm256_movemask_epi8(before)) result |= VC_SEQS_BEFORE;
+    // Avoid the AVX to SSE transition penalty in the tail.
+    _mm256_zeroupper();
+    return result | vector_clock_seqs_sse2(first + i, second + i, n - i, merge);
+}
+#endif
+
+static int vector_clock_seqs_dispatch(uint32_t *first, const uint32_t *second,
+                                      uint32_t n, cluster_bool_t merge);
+
+static vector_clock_seqs_kernel_t vector_clock_seqs_kernel = vector_clock_seqs_dispatch;
+
+/* Picks the best kernel supported by the CPU on the first use. */
+static int vector_clock_seqs_dispatch(uint32_t *first, const uint32_t *second,
+                                      uint32_t n, cluster_bool_t merge) {
+    vector_clock_seqs_kernel_t kernel = vector_clock_seqs_scalar;
+#ifdef VECTOR_CLOCK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = vector_clock_seqs_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel = vector_clock_seqs_sse2;
+    }
+#endif
+    vector_clock_seqs_kernel = kernel;
+    return kernel(first, second, n, merge);
+}
+
+/* Returns the index of the first record whose member ID is not less than the given one. */
+static uint32_t vector_clock_lower_bound(const vector_clock_t *clock, member_id_t member_id) {
+    uint32_t low = 0;
+    uint32_t high = clock->size;
+    while (low < high) {
+        uint32_t mid = (low + high) >> 1;
+        if (vector_clock_id_key(clock->ids[mid]) < vector_clock_id_key(member_id)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
     }
+    return low;
+}
+
+static int vector_clock_find_by_member_id(const vector_clock_t *clock, const member_id_t *member_id) {
+    uint32_t idx = vector_clock_lower_bound(clock, *member_id);
+    if (idx < clock->size && clock->ids[idx] == *member_id) return idx;
     return CLUSTER_ERR_NOT_FOUND;
 }
 
-vector_record_t *vector_clock_find_record(vector_clock_t *clock, const cluster_member_t *member) {
+static int vector_clock_reserve(vector_clock_t *clock, uint32_t capacity) {
+    if (capacity <= clock->capacity) return CLUSTER_ERR_NONE;
+    if (capacity > MAX_VECTOR_SIZE) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    uint32_t new_capacity = clock->capacity > 0 ? clock->capacity : VECTOR_CLOCK_INITIAL_CAPACITY;
+    while (new_capacity < capacity) new_capacity <<= 1;
+    if (new_capacity > MAX_VECTOR_SIZE) new_capacity = MAX_VECTOR_SIZE;
+
+    // Sequence numbers follow member IDs in the same block.
+    member_id_t *new_ids = (member_id_t *) malloc(new_capacity * (sizeof(member_id_t) + sizeof(uint32_t)));
+    if (new_ids == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+    uint32_t *new_seqs = (uint32_t *) (new_ids + new_capacity);
+    if (clock->size > 0) {
+        memcpy(new_ids, clock->ids, clock->size * sizeof(member_id_t));
+        memcpy(new_seqs, clock->seqs, clock->size * sizeof(uint32_t));
+    }
+    free(clock->ids);
+    clock->ids = new_ids;
+    clock->seqs = new_seqs;
+    clock->capacity = new_capacity;
+    return CLUSTER_ERR_NONE;
+}
+
+static void vector_clock_get_record(const vector_clock_t *clock, uint32_t idx, vector_record_t *result) {
+    result->member_id = clock->ids[idx];
+    result->sequence_number = clock->seqs[idx];
+}
+
+int vector_clock_find_record(const vector_clock_t *clock, const cluster_member_t *member, vector_record_t *result) {
     member_id_t member_id;
     vector_clock_create_member_id(member, &member_id);
     int idx = vector_clock_find_by_member_id(clock, &member_id);
-    if (idx < 0) return NULL;
-    return &clock->records[idx];
+    if (idx < 0) return idx;
+    vector_clock_get_record(clock, idx, result);
+    return CLUSTER_ERR_NONE;
 }
 
 int vector_clock_init(vector_clock_t *clock) {
@@ -55,47 +201,62 @@ int vector_clock_init(vector_clock_t *clock) {
     return CLUSTER_ERR_NONE;
 }
 
-static vector_record_t *vector_clock_set_by_id(vector_clock_t *clock,
-                                               const member_id_t *member_id,
-                                               uint32_t seq_num) {
-    int idx = vector_clock_find_by_member_id(clock, member_id);
-    if (idx < 0) {
-        // insert or override the latest record with the new record.
-        uint32_t new_idx = clock->current_idx;
-        clock->records[new_idx].member_id = *member_id;
-        clock->records[new_idx].sequence_number = seq_num;
-
-        if (clock->size < MAX_VECTOR_SIZE) ++clock->size;
-        if (++clock->current_idx >= MAX_VECTOR_SIZE) clock->current_idx = 0;
-        return &clock->records[new_idx];
-    } else {
-        clock->records[idx].sequence_number = seq_num;
-        return &clock->records[idx];
+void vector_clock_destroy(vector_clock_t *clock) {
+    free(clock->ids);
+    clock->ids = NULL;
+    clock->seqs = NULL;
+    clock->size = 0;
+    clock->capacity = 0;
+}
+
+static int vector_clock_set_by_id(vector_clock_t *clock,
+                                  const member_id_t *member_id,
+                                  uint32_t seq_num) {
+    uint32_t idx = vector_clock_lower_bound(clock, *member_id);
+    if (idx >= clock->size || clock->ids[idx] != *member_id) {
+        // Insert the new record keeping the order.
+        int result = vector_clock_reserve(clock, clock->size + 1);
+        if (result < 0) return result;
+        uint32_t tail = clock->size - idx;
+        memmove(&clock->ids[idx + 1], &clock->ids[idx], tail * sizeof(member_id_t));
+        memmove(&clock->seqs[idx + 1], &clock->seqs[idx], tail * sizeof(uint32_t));
+        clock->ids[idx] = *member_id;
+        ++clock->size;
     }
+    clock->seqs[idx] = seq_num;
+    return idx;
 }
 
-vector_record_t *vector_clock_increment(vector_clock_t *clock, const cluster_member_t *member) {
-    vector_record_t *record = vector_clock_find_record(clock, member);
-    if (record == NULL) return NULL;
-    ++record->sequence_number;
-    return record;
+int vector_clock_increment(vector_clock_t *clock, const cluster_member_t *member, vector_record_t *result) {
+    member_id_t member_id;
+    vector_clock_create_member_id(member, &member_id);
+    int idx = vector_clock_find_by_member_id(clock, &member_id);
+    if (idx < 0) return idx;
+    ++clock->seqs[idx];
+    if (result != NULL) vector_clock_get_record(clock, idx, result);
+    return CLUSTER_ERR_NONE;
 }
 
-vector_record_t *vector_clock_set(vector_clock_t *clock,
-                                  const cluster_member_t *member,
-                                  uint32_t seq_num) {
+int vector_clock_set(vector_clock_t *clock, const cluster_member_t *member, uint32_t seq_num,
+                     vector_record_t *result) {
     member_id_t member_id;
     vector_clock_create_member_id(member, &member_id);
-    return vector_clock_set_by_id(clock, &member_id, seq_num);
+    int idx = vector_clock_set_by_id(clock, &member_id, seq_num);
+    if (idx < 0) return idx;
+    if (result != NULL) vector_clock_get_record(clock, idx, result);
+    return CLUSTER_ERR_NONE;
+}
+
+int vector_clock_set_record(vector_clock_t *clock, const vector_record_t *record) {
+    int idx = vector_clock_set_by_id(clock, &record->member_id, record->sequence_number);
+    return idx < 0 ? idx : CLUSTER_ERR_NONE;
 }
 
 void vector_clock_to_string(const vector_clock_t *clock, char *result) {
     char *cursor = result;
     int str_size = 0;
     for (int i = 0; i < clock->size; ++i) {
-        str_size = sprintf(cursor, "(%lu:%u)  ",
-                           clock->records[i].member_id,
-                           clock->records[i].sequence_number);
+        str_size = sprintf(cursor, "(%lu:%u)  ", clock->ids[i], clock->seqs[i]);
         cursor += str_size;
     }
 }
@@ -107,10 +268,12 @@ int vector_clock_record_copy(vector_record_t *dst, const vector_record_t *src) {
 }
 
 int vector_clock_copy(vector_clock_t *dst, const vector_clock_t *src) {
+    int result = vector_clock_reserve(dst, src->size);
+    if (result < 0) return result;
     dst->size = src->size;
-    dst->current_idx = src->current_idx;
-    for (int i = 0; i < src->size; ++i) {
-        vector_clock_record_copy(&dst->records[i], &src->records[i]);
+    if (src->size > 0) {
+        memcpy(dst->ids, src->ids, src->size * sizeof(member_id_t));
+        memcpy(dst->seqs, src->seqs, src->size * sizeof(uint32_t));
     }
     return CLUSTER_ERR_NONE;
 }
@@ -131,63 +294,94 @@ vector_clock_comp_res_t vector_clock_compare_with_record(vector_clock_t *clock,
             vector_clock_set_by_id(clock, &record->member_id, record->sequence_number);
         }
     } else {
-        uint32_t first_seq_num = clock->records[idx].sequence_number;
+        uint32_t first_seq_num = clock->seqs[idx];
         uint32_t second_seq_num = record->sequence_number;
         if (first_seq_num > second_seq_num) {
             result = VC_AFTER;
         } else if (first_seq_num < second_seq_num) {
             result = VC_BEFORE;
             if (merge) {
-                clock->records[idx].sequence_number = second_seq_num;
+                clock->seqs[idx] = second_seq_num;
             }
         }
     }
     return result;
 }
 
+/* Inserts the records of the second clock which are missing in the first one.
+ * Both clocks are merged from their ends, so the first clock is updated in place. */
+static void vector_clock_merge_missing(vector_clock_t *first, const vector_clock_t *second,
+                                       uint32_t missing_num) {
+    if (vector_clock_reserve(first, first->size + missing_num) < 0) return;
+    int i = first->size - 1;
+    int j = second->size - 1;
+    int k = first->size + missing_num - 1;
+    while (j >= 0) {
+        if (i >= 0 && vector_clock_id_key(first->ids[i]) >= vector_clock_id_key(second->ids[j])) {
+            // Records present in both clocks have been merged already.
+            if (first->ids[i] == second->ids[j]) --j;
+            first->ids[k] = first->ids[i];
+            first->seqs[k--] = first->seqs[i--];
+        } else {
+            first->ids[k] = second->ids[j];
+            first->seqs[k--] = second->seqs[j--];
+        }
+    }
+    first->size += missing_num;
+}
+
 vector_clock_comp_res_t vector_clock_compare(vector_clock_t *first,
                                              const vector_clock_t *second,
                                              cluster_bool_t merge) {
-    vector_clock_comp_res_t result = VC_EQUAL;
-
-    uint32_t second_visited_idxs = 0;
+    if (first->size == second->size &&
+        (first->size == 0 || memcmp(first->ids, second->ids, first->size * sizeof(member_id_t)) == 0)) {
+        // Both clocks track the same members, so only sequence numbers differ.
+        switch (vector_clock_seqs_kernel(first->seqs, second->seqs, first->size, merge)) {
+            case VC_SEQS_AFTER:
+                return VC_AFTER;
+            case VC_SEQS_BEFORE:
+                return VC_BEFORE;
+            case VC_SEQS_AFTER | VC_SEQS_BEFORE:
+                return VC_CONFLICT;
+            default:
+                return VC_EQUAL;
+        }
+    }
 
-    for (int i = 0; i < first->size; ++i) {
-        int second_idx = vector_clock_find_by_member_id(second, &first->records[i].member_id);
-        if (second_idx < 0) {
+    vector_clock_comp_res_t result = VC_EQUAL;
+    uint32_t missing_num = 0;
+
+    // Walk both sorted clocks side by side.
+    int i = 0;
+    int j = 0;
+    while (i < first->size || j < second->size) {
+        if (j >= second->size ||
+            (i < first->size && vector_clock_id_key(first->ids[i]) < vector_clock_id_key(second->ids[j]))) {
+            // The record is missing in the second clock.
             result = vector_clock_resolve_comp_result(result, VC_AFTER);
+            ++i;
+        } else if (i >= first->size || vector_clock_id_key(second->ids[j]) < vector_clock_id_key(first->ids[i])) {
+            // The record is missing in the first clock.
+            result = vector_clock_resolve_comp_result(result, VC_BEFORE);
+            ++missing_num;
+            ++j;
         } else {
-            second_visited_idxs |= (1 << second_idx);
-            uint32_t first_seq_num = first->records[i].sequence_number;
-            uint32_t second_seq_num = second->records[second_idx].sequence_number;
+            uint32_t first_seq_num = first->seqs[i];
+            uint32_t second_seq_num = second->seqs[j];
             if (first_seq_num > second_seq_num) {
                 result = vector_clock_resolve_comp_result(result, VC_AFTER);
             } else if (second_seq_num > first_seq_num) {
                 result = vector_clock_resolve_comp_result(result, VC_BEFORE);
                 if (merge) {
-                    first->records[i].sequence_number = second_seq_num;
+                    first->seqs[i] = second_seq_num;
                 }
             }
+            ++i;
+            ++j;
         }
     }
 
-    uint32_t second_visited_mask = ((1 << second->size) - 1) & 0xFFFFFFFF;
-    uint32_t missing_idxs = (second_visited_idxs ^ second_visited_mask);
-    if (missing_idxs != 0) {
-        // There are some records in the second clock that are missing
-        // in the first one.
-        result = vector_clock_resolve_comp_result(result, VC_BEFORE);
-
-        if (merge) {
-            for (int i = 0; missing_idxs != 0; ++i) {
-                if ((missing_idxs & 0x01) != 0) {
-                    vector_clock_set_by_id(first, &second->records[i].member_id,
-                                           second->records[i].sequence_number);
-                }
-                missing_idxs >>= 1;
-            }
-        }
-    }
+    if (merge && missing_num > 0) vector_clock_merge_missing(first, second, missing_num);
     return result;
 }
 
@@ -217,7 +411,32 @@ int vector_clock_record_encode(const vector_record_t *record, uint8_t *buffer, s
     return cursor - buffer;
 }
 
+static int vector_clock_record_cmp(const void *first, const void *second) {
+    uint64_t first_id = vector_clock_id_key(((const vector_record_t *) first)->member_id);
+    uint64_t second_id = vector_clock_id_key(((const vector_record_t *) second)->member_id);
+    return (first_id > second_id) - (first_id < second_id);
+}
+
+/* Sorts records of the clock by the member ID and drops duplicates. */
+static int vector_clock_sort(vector_clock_t *clock) {
+    vector_record_t *records = (vector_record_t *) malloc(clock->size * sizeof(vector_record_t));
+    if (records == NULL) return CLUSTER_ERR_ALLOCATION_FAILED;
+    for (uint32_t i = 0; i < clock->size; ++i) vector_clock_get_record(clock, i, &records[i]);
+    qsort(records, clock->size, sizeof(vector_record_t), vector_clock_record_cmp);
+
+    uint16_t unique = 0;
+    for (uint32_t i = 0; i < clock->size; ++i) {
+        if (unique > 0 && clock->ids[unique - 1] == records[i].member_id) continue;
+        clock->ids[unique] = records[i].member_id;
+        clock->seqs[unique++] = records[i].sequence_number;
+    }
+    clock->size = unique;
+    free(records);
+    return CLUSTER_ERR_NONE;
+}
+
 int vector_clock_decode(const uint8_t *buffer, size_t buffer_size, vector_clock_t *result) {
+    if (buffer_size < sizeof(uint16_t)) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
     const uint8_t *cursor = buffer;
     const uint8_t *buffer_end = buffer + buffer_size;
 
@@ -225,21 +444,41 @@ int vector_clock_decode(const uint8_t *buffer, size_t buffer_size, vector_clock_
     cursor += sizeof(uint16_t);
     if (buffer_end - cursor < size * VECTOR_RECORD_SIZE) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
 
-    result->size = size;
-    result->current_idx = 0;
+    vector_clock_init(result);
+    if (vector_clock_reserve(result, size) < 0) return CLUSTER_ERR_ALLOCATION_FAILED;
 
+    cluster_bool_t sorted = CLUSTER_TRUE;
+    vector_record_t record;
     int decode_result = 0;
     for (int i = 0; i < size; ++i) {
-        decode_result = vector_clock_record_decode(cursor, buffer_end - cursor, &result->records[i]);
-        if (decode_result < 0) return decode_result;
+        decode_result = vector_clock_record_decode(cursor, buffer_end - cursor, &record);
+        if (decode_result < 0) {
+            vector_clock_destroy(result);
+            return decode_result;
+        }
+        result->ids[i] = record.member_id;
+        result->seqs[i] = record.sequence_number;
+        if (i > 0 && vector_clock_id_key(result->ids[i - 1]) >= vector_clock_id_key(record.member_id)) {
+            sorted = CLUSTER_FALSE;
+        }
         cursor += VECTOR_RECORD_SIZE;
     }
+    result->size = size;
 
+    // Older nodes keep records in the insertion order.
+    if (!sorted && vector_clock_sort(result) < 0) {
+        vector_clock_destroy(result);
+        return CLUSTER_ERR_ALLOCATION_FAILED;
+    }
     return cursor - buffer;
 }
 
+size_t vector_clock_encoded_size(const vector_clock_t *clock) {
+    return sizeof(uint16_t) + clock->size * VECTOR_RECORD_SIZE;
+}
+
 int vector_clock_encode(const vector_clock_t *clock, uint8_t *buffer, size_t buffer_size) {
-    if (buffer_size < sizeof(uint16_t) + clock->size * VECTOR_RECORD_SIZE) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+    if (buffer_size < vector_clock_encoded_size(clock)) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
 
     uint8_t *cursor = buffer;
     uint8_t *buffer_end = buffer + buffer_size;
@@ -247,12 +486,129 @@ int vector_clock_encode(const vector_clock_t *clock, uint8_t *buffer, size_t buf
     uint16_encode(clock->size, cursor);
     cursor += sizeof(uint16_t);
 
+    vector_record_t record;
     int encode_result = 0;
     for (int i = 0; i < clock->size; ++i) {
-        encode_result = vector_clock_record_encode(&clock->records[i], cursor, buffer_end - cursor);
+        vector_clock_get_record(clock, i, &record);
+        encode_result = vector_clock_record_encode(&record, cursor, buffer_end - cursor);
+        if (encode_result < 0) return encode_result;
+        cursor += encode_result;
+    }
+
+    return cursor - buffer;
+}
+
+/* Walks the base and the clock side by side and either counts or
+ * writes records of the delta, depending on whether the cursor is set. */
+static int vector_clock_delta_walk(const vector_clock_t *clock, const vector_clock_t *base,
+                                   cluster_bool_t added, uint8_t *cursor, uint8_t *buffer_end,
+                                   uint32_t *count) {
+    uint8_t *start = cursor;
+    *count = 0;
+    int i = 0;
+    for (int j = 0; j < clock->size; ++j) {
+        // Records never disappear from a newer clock.
+        if (i < base->size && vector_clock_id_key(base->ids[i]) < vector_clock_id_key(clock->ids[j])) {
+            return CLUSTER_ERR_INVALID_MESSAGE;
+        }
+        int encode_result = 0;
+        if (i < base->size && base->ids[i] == clock->ids[j]) {
+            if (clock->seqs[j] < base->seqs[i]) return CLUSTER_ERR_INVALID_MESSAGE;
+            if (!added && clock->seqs[j] != base->seqs[i]) {
+                ++*count;
+                if (cursor != NULL) {
+                    encode_result = varint_encode(i, cursor, buffer_end - cursor);
+                    if (encode_result < 0) return encode_result;
+                    cursor += encode_result;
+                    encode_result = varint_encode(clock->seqs[j] - base->seqs[i], cursor, buffer_end - cursor);
+                    if (encode_result < 0) return encode_result;
+                    cursor += encode_result;
+                }
+            }
+            ++i;
+        } else if (added) {
+            ++*count;
+            if (cursor != NULL) {
+                if (buffer_end - cursor < MEMBER_ID_SIZE) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+                memcpy(cursor, &clock->ids[j], MEMBER_ID_SIZE);
+                cursor += MEMBER_ID_SIZE;
+                encode_result = varint_encode(clock->seqs[j], cursor, buffer_end - cursor);
+                if (encode_result < 0) return encode_result;
+                cursor += encode_result;
+            }
+        }
+    }
+    if (i < base->size) return CLUSTER_ERR_INVALID_MESSAGE;
+    return cursor != NULL ? cursor - start : 0;
+}
+
+int vector_clock_delta_encode(const vector_clock_t *clock, const vector_clock_t *base,
+                              uint8_t *buffer, size_t buffer_size) {
+    uint8_t *cursor = buffer;
+    uint8_t *buffer_end = buffer + buffer_size;
+    for (int added = 0; added <= 1; ++added) {
+        uint32_t count = 0;
+        int walk_result = vector_clock_delta_walk(clock, base, added, NULL, NULL, &count);
+        if (walk_result < 0) return walk_result;
+
+        int encode_result = varint_encode(count, cursor, buffer_end - cursor);
         if (encode_result < 0) return encode_result;
         cursor += encode_result;
+
+        walk_result = vector_clock_delta_walk(clock, base, added, cursor, buffer_end, &count);
+        if (walk_result < 0) return walk_result;
+        cursor += walk_result;
     }
+    return cursor - buffer;
+}
 
+/* Applies the encoded delta to the copy of its base. */
+static int vector_clock_delta_apply(const uint8_t *buffer, size_t buffer_size, vector_clock_t *result) {
+    const uint8_t *cursor = buffer;
+    const uint8_t *buffer_end = buffer + buffer_size;
+    uint16_t base_size = result->size;
+
+    uint32_t changed_n = 0;
+    int decode_result = varint_decode(cursor, buffer_end - cursor, &changed_n);
+    if (decode_result < 0) return decode_result;
+    cursor += decode_result;
+    for (uint32_t i = 0; i < changed_n; ++i) {
+        uint32_t idx = 0;
+        uint32_t increment = 0;
+        decode_result = varint_decode(cursor, buffer_end - cursor, &idx);
+        if (decode_result < 0) return decode_result;
+        cursor += decode_result;
+        decode_result = varint_decode(cursor, buffer_end - cursor, &increment);
+        if (decode_result < 0) return decode_result;
+        cursor += decode_result;
+        if (idx >= base_size) return CLUSTER_ERR_INVALID_MESSAGE;
+        result->seqs[idx] += increment;
+    }
+
+    // New records are inserted after the changed ones, so that indices refer to the base.
+    uint32_t added_n = 0;
+    decode_result = varint_decode(cursor, buffer_end - cursor, &added_n);
+    if (decode_result < 0) return decode_result;
+    cursor += decode_result;
+    for (uint32_t i = 0; i < added_n; ++i) {
+        vector_record_t record;
+        if (buffer_end - cursor < MEMBER_ID_SIZE) return CLUSTER_ERR_BUFFER_NOT_ENOUGH;
+        memcpy(&record.member_id, cursor, MEMBER_ID_SIZE);
+        cursor += MEMBER_ID_SIZE;
+        decode_result = varint_decode(cursor, buffer_end - cursor, &record.sequence_number);
+        if (decode_result < 0) return decode_result;
+        cursor += decode_result;
+        int set_result = vector_clock_set_record(result, &record);
+        if (set_result < 0) return set_result;
+    }
     return cursor - buffer;
 }
+
+int vector_clock_delta_decode(const uint8_t *buffer, size_t buffer_size,
+                              const vector_clock_t *base, vector_clock_t *result) {
+    vector_clock_init(result);
+    if (vector_clock_copy(result, base) < 0) return CLUSTER_ERR_ALLOCATION_FAILED;
+    int decode_result = vector_clock_delta_apply(buffer, buffer_size, result);
+    if (decode_result < 0) vector_clock_destroy(result);
+    return decode_result;
+}
@@ -23,7 +23,9 @@
 extern "C" {
 #endif
 
-#define MAX_VECTOR_SIZE     20
+/* The size of a clock is encoded as a 16-bit number. */
+#define MAX_VECTOR_SIZE     UINT16_MAX
+#define VECTOR_CLOCK_INITIAL_CAPACITY 8
 #define MEMBER_ID_SIZE      8
 #define VECTOR_RECORD_SIZE  (sizeof(uint32_t) + MEMBER_ID_SIZE)
 
@@ -34,10 +36,15 @@ struct vector_record {
     member_id_t member_id;
 };
 
+/* Records are kept sorted by the bytes of the member ID, so that clocks
+ * are compared with a single merge-join pass. Member IDs and
+ * sequence numbers are stored as separate arrays which share
+ * a single allocation, so both can be compared with SIMD. */
 struct vector_clock {
     uint16_t size;
-    uint16_t current_idx;
-    vector_record_t records[MAX_VECTOR_SIZE];
+    uint16_t capacity;
+    member_id_t *ids;
+    uint32_t *seqs;
 };
 
 enum vector_clock_comp_res {
@@ -48,17 +55,43 @@ enum vector_clock_comp_res {
 };
 
 int vector_clock_init(vector_clock_t *clock);
-vector_record_t *vector_clock_find_record(vector_clock_t *clock, const cluster_member_t *member);
-vector_record_t *vector_clock_set(vector_clock_t *clock, const cluster_member_t *member, uint32_t seq_num);
-vector_record_t *vector_clock_increment(vector_clock_t *clock, const cluster_member_t *member);
+void vector_clock_destroy(vector_clock_t *clock);
+/**
+ * Looks up the record of the member and copies it into result.
+ *
+ * @return CLUSTER_ERR_NONE or CLUSTER_ERR_NOT_FOUND.
+ */
+int vector_clock_find_record(const vector_clock_t *clock, const cluster_member_t *member, vector_record_t *result);
+/**
+ * Sets the sequence number of the member, adding a new record if needed.
+ * The updated record is copied into result unless it's NULL.
+ *
+ * @return CLUSTER_ERR_NONE or an error if the clock can't grow.
+ */
+int vector_clock_set(vector_clock_t *clock, const cluster_member_t *member, uint32_t seq_num,
+                     vector_record_t *result);
+int vector_clock_increment(vector_clock_t *clock, const cluster_member_t *member, vector_record_t *result);
+/**
+ * Sets the record, adding it to the clock if needed.
+ *
+ * @return CLUSTER_ERR_NONE or an error if the clock can't grow.
+ */
+int vector_clock_set_record(vector_clock_t *clock, const vector_record_t *record);
 void vector_clock_to_string(const vector_clock_t *clock, char *result);
 
 int vector_clock_record_copy(vector_record_t *dst, const vector_record_t *src);
+/**
+ * Copies the clock into an initialized destination clock.
+ */
 int vector_clock_copy(vector_clock_t *dst, const vector_clock_t *src);
 
 /**
- * Compares 2 vector clocks. If the "merge" parameter is set to true, 2 clocks
- * will be merged into the first vector clock instance.
+ * Compares 2 vector clocks in O(n) time. If the "merge" parameter is set to
+ * true, 2 clocks will be merged into the first vector clock instance. Records
+ * missing in the first clock are not merged if it can't grow.
+ *
+ * Clocks of the same members, which is the usual case once the cluster
+ * settles, are compared with SIMD kernels chosen at runtime.
  *
  * @param first the first vector clock. This vector clock will contain the
  *              merge result eventually.
@@ -92,7 +125,33 @@ vector_clock_comp_res_t vector_clock_compare_with_record(vector_clock_t *clock,
 
 int vector_clock_record_decode(const uint8_t *buffer, size_t buffer_size, vector_record_t *result);
 int vector_clock_record_encode(const vector_record_t *record, uint8_t *buffer, size_t buffer_size);
+/**
+ * Decodes a clock into a new instance which must be released with
+ * vector_clock_destroy(). Records of peers that don't sort them
+ * are sorted after decoding.
+ */
 int vector_clock_decode(const uint8_t *buffer, size_t buffer_size, vector_clock_t *result);
+size_t vector_clock_encoded_size(const vector_clock_t *clock);
+
+/**
+ * Encodes the clock as a delta against an older version of it:
+ *   the number of changed records (varint), followed by the index in the
+ *   base (varint) and the sequence number increment (varint) of each one;
+ *   the number of new records (varint), followed by the member ID and
+ *   the sequence number (varint) of each one.
+ * An unchanged clock takes 2 bytes.
+ *
+ * @return the number of bytes written, CLUSTER_ERR_BUFFER_NOT_ENOUGH or
+ *         CLUSTER_ERR_INVALID_MESSAGE if the base is not older than the clock.
+ */
+int vector_clock_delta_encode(const vector_clock_t *clock, const vector_clock_t *base,
+                              uint8_t *buffer, size_t buffer_size);
+/**
+ * Decodes a delta against the base into a new clock instance which
+ * must be released with vector_clock_destroy().
+ */
+int vector_clock_delta_decode(const uint8_t *buffer, size_t buffer_size,
+                              const vector_clock_t *base, vector_clock_t *result);
 int vector_clock_encode(const vector_clock_t *clock, uint8_t *buffer, size_t buffer_size);
 
 #ifdef  __cplusplus